@@ -0,0 +1,70 @@
+// throughput of read_csv on a generated file of 8 feature columns and a label, with 1% of the rows invalid
+// (malformed or NaN), which are dropped. the file is read once to warm the page cache, the times are
+// the best of 3 reads
+
+#include "../include/cusr.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+
+using namespace cusr;
+
+int main(int argc, char **argv) {
+    long lines = argc > 1 ? atol(argv[1]) : 5000000L;
+    string path = "/tmp/cusr_csv_bench_" + to_string(getpid()) + ".csv";
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        fprintf(stderr, "cannot create %s\n", path.c_str());
+        return 1;
+    }
+    fprintf(file, "x0,x1,x2,x3,x4,x5,x6,x7,y\n");
+    for (long i = 0; i < lines; i++) {
+        if (i % 200 == 3) {
+            fprintf(file, "1,2,3\n");
+        } else if (i % 200 == 7) {
+            fprintf(file, "1,,3,4,5,6,7,8,9\n");
+        } else {
+            for (int j = 0; j < 8; j++) {
+                fprintf(file, "%.6g,", ((i * 31 + j * 17) % 99991) / 97.0);
+            }
+            fprintf(file, "%.9g\n", i * 0.001);
+        }
+    }
+    fclose(file);
+    long bytes = 0;
+    file = fopen(path.c_str(), "r");
+    if (file != nullptr && fseek(file, 0, SEEK_END) == 0) {
+        bytes = ftell(file);
+    }
+    if (file != nullptr) {
+        fclose(file);
+    }
+
+    vector<int> thread_counts = {1};
+    if (std::thread::hardware_concurrency() > 1) {
+        thread_counts.push_back((int) std::thread::hardware_concurrency());
+    }
+    for (int threads: thread_counts) {
+        CsvOptions options;
+        options.threads = threads;
+        CsvReport report;
+        double best = HUGE_VAL;
+        for (int rep = 0; rep < 4; rep++) {
+            ColumnStore store;
+            auto begin = std::chrono::steady_clock::now();
+            if (!read_csv(path, store, options, &report)) {
+                unlink(path.c_str());
+                return 1;
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            if (rep > 0) {
+                best = min(best, seconds);
+            }
+        }
+        printf("%d threads: %.1f MB in %.3f s, %.0f MB/s, %d rows kept, %d malformed, %d with NaN\n", threads,
+               bytes / 1e6, best, bytes / 1e6 / best, report.rows, report.malformed_rows, report.nan_rows);
+    }
+    unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,106 @@
+// cost of the deterministic mode: random draws, breeding with a stream set per offspring, and whole CPU fits.
+// the times are the best of 3 runs for the draws and the breeding, the mean over 3 seeds for the fits
+
+#include "../include/cusr.h"
+#include <chrono>
+#include <cstdio>
+
+using namespace cusr;
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void bench_draws() {
+    const int draws = 20000000;
+    for (int deterministic = 0; deterministic < 2; deterministic++) {
+        set_deterministic(deterministic);
+        double best = HUGE_VAL;
+        volatile float sink = 0;
+        for (int rep = 0; rep < 3; rep++) {
+            double begin = now();
+            for (int i = 0; i < draws; i++) {
+                if (deterministic && i % 64 == 0) {
+                    set_rand_stream(1, 0, i);
+                }
+                sink = sink + gen_rand_float(0, 1);
+            }
+            best = min(best, now() - begin);
+        }
+        printf("random float draw, %s: %.2f ns\n", deterministic ? "deterministic" : "default",
+               best * 1e9 / draws);
+    }
+}
+
+static void bench_breeding() {
+    vector<Function> function_set = {ADD, SUB, MUL, DIV, SIN, COS, TAN, LOG, INV};
+    pair<float, float> const_range = {-1, 1};
+    const int population_size = 2000, rounds = 100, variables = 8;
+    for (int deterministic = 0; deterministic < 2; deterministic++) {
+        set_deterministic(deterministic);
+        vector<Program> population;
+        for (int i = 0; i < population_size; i++) {
+            set_rand_stream(1, 0, i);
+            population.push_back(*gen_growth_init_program(4 + i % 6, const_range, function_set, variables));
+        }
+        vector<Program> offspring(population_size);
+        double best = HUGE_VAL;
+        for (int rep = 0; rep < 3; rep++) {
+            double begin = now();
+            for (int round = 0; round < rounds; round++) {
+                for (int i = 0; i < population_size; i++) {
+                    if (deterministic) {
+                        set_rand_stream(2, round, i);
+                    }
+                    if (i % 2) {
+                        crossover_mutation(population[i], population[(i + 7) % population_size], offspring[i], 10,
+                                           1 << 20);
+                    } else {
+                        subtree_mutation(population[i], offspring[i], 4, const_range, function_set, variables, 10,
+                                         1 << 20);
+                    }
+                }
+            }
+            best = min(best, now() - begin);
+        }
+        printf("breeding (crossover / subtree), %s: %.0f ns per offspring\n",
+               deterministic ? "deterministic" : "default", best * 1e9 / (rounds * population_size));
+    }
+}
+
+static void bench_fits(int rows) {
+    const int variables = 8;
+    vector<vector<float>> dataset(rows, vector<float>(variables));
+    vector<float> real_value(rows);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < variables; j++) {
+            dataset[i][j] = ((i * 31 + j * 17) % 997) / 100.f;
+        }
+        real_value[i] = dataset[i][0] * dataset[i][1] - dataset[i][2];
+    }
+    double times[2];
+    for (int deterministic = 0; deterministic < 2; deterministic++) {
+        double total = 0;
+        for (int seed = 1; seed <= 3; seed++) {
+            RegressionEngine reg;
+            reg.population_size = 1000;
+            reg.generations = 15;
+            reg.deterministic = deterministic;
+            reg.seed = seed;
+            reg.metric = mean_square_error;
+            reg.fit(dataset, real_value);
+            total += reg.regress_time_in_sec;
+        }
+        times[deterministic] = total / 3;
+    }
+    printf("fit, 1000 programs x 15 generations, %d rows: %.3f s default, %.3f s deterministic\n", rows, times[0],
+           times[1]);
+}
+
+int main() {
+    bench_draws();
+    bench_breeding();
+    bench_fits(2000);
+    bench_fits(50000);
+    return 0;
+}
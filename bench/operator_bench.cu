@@ -0,0 +1,62 @@
+// the genetic operators on a population of growth-initialised programs, the offspring are written into
+// reused buffers as in the engine. deterministic streams, so every run breeds the same offspring.
+// the times of hoist and the point mutations include the copy of the parent into the offspring buffer
+
+#include "../include/cusr.h"
+#include <chrono>
+#include <cstdio>
+
+using namespace cusr;
+
+int main() {
+    vector<Function> function_set = {ADD, SUB, MUL, DIV, SIN, COS, TAN, LOG, INV};
+    pair<float, float> const_range = {-1, 1};
+    const int population_size = 1000, rounds = 200, variables = 8;
+    set_deterministic(true);
+
+    vector<Program> population;
+    for (int i = 0; i < population_size; i++) {
+        set_rand_stream(1, 0, i);
+        population.push_back(*gen_growth_init_program(4 + i % 5, const_range, function_set, variables));
+    }
+    FunctionTable table;
+    build_function_table(table, function_set);
+    vector<Program> offspring(population_size);
+
+    const char *names[] = {"crossover", "subtree mutation", "hoist mutation", "point mutation", "point replace"};
+    for (int op = 0; op < 5; op++) {
+        double best = HUGE_VAL;
+        long long nodes = 0;
+        for (int rep = 0; rep < 3; rep++) {
+            auto begin = std::chrono::steady_clock::now();
+            nodes = 0;
+            for (int round = 0; round < rounds; round++) {
+                for (int i = 0; i < population_size; i++) {
+                    set_rand_stream(2, round, i);
+                    Program &parent = population[i];
+                    Program &ret = offspring[i];
+                    if (op == 0) {
+                        crossover_mutation(parent, population[(i + 7) % population_size], ret, 10, 1 << 20);
+                    } else if (op == 1) {
+                        subtree_mutation(parent, ret, 4, const_range, function_set, variables, 10, 1 << 20);
+                    } else {
+                        ret = parent;
+                        if (op == 2) {
+                            hoist_mutation(ret);
+                        } else if (op == 3) {
+                            point_mutation(ret, table, const_range, variables);
+                        } else {
+                            point_replace_mutation(ret, table, const_range, variables);
+                        }
+                    }
+                    nodes += ret.length;
+                }
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            best = min(best, seconds);
+        }
+        printf("%-16s %8.0f ns per offspring, %.1f nodes on average\n", names[op],
+               best * 1e9 / ((double) rounds * population_size), (double) nodes / ((double) rounds * population_size));
+    }
+    return 0;
+}
@@ -2,5 +2,7 @@
 #define LUMINOCUGP_CUSR_H
 
 #include "../src/regression.cuh"
+#include "../src/columnar.cuh"
+#include "../src/csv.cuh"
 
 #endif //LUMINOCUGP_CUSR_H
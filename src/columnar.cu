@@ -0,0 +1,443 @@
+#include "columnar.cuh"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <new>
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+#define COLUMNAR_MAGIC "CUSRCOL"
+#define COLUMNAR_VERSION 1
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL
+#define WRITE_CHUNK_ROWS (1 << 20)
+#define SHARED_MAGIC "CUSRSHM"
+#define SHARED_IMAGE_OFFSET 4096
+
+namespace cusr {
+    namespace data {
+
+        using namespace std;
+
+        static size_t align_up(size_t size) {
+            return (size + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+        }
+
+        static size_t dtype_size(uint32_t dtype) {
+            return dtype == dtype_t::float64 ? sizeof(double) : sizeof(float);
+        }
+
+        /**
+         * hash 8-byte words, bytes must be a multiple of 8
+         */
+        static uint64_t checksum_update(uint64_t hash, const void *data, size_t bytes) {
+            const char *ptr = (const char *) data;
+            for (size_t i = 0; i + 8 <= bytes; i += 8) {
+                uint64_t word;
+                memcpy(&word, ptr + i, 8);
+                hash = (hash ^ word) * 0x100000001b3ULL;
+                hash ^= hash >> 29;
+            }
+            return hash;
+        }
+
+        uint64_t columnar_checksum(const void *data, size_t bytes) {
+            return checksum_update(CHECKSUM_SEED, data, bytes);
+        }
+
+        bool write_columnar(const string &path, const DataView &dataset, const DataView &label, dtype_t dtype) {
+            if (dataset.rows != label.rows) {
+                cerr << "write_columnar: the dataset and the label have different rows" << endl;
+                return false;
+            }
+            if (dtype != dtype_t::float32 && dtype != dtype_t::float64) {
+                cerr << "write_columnar: only float32 and float64 files are supported" << endl;
+                return false;
+            }
+
+            FILE *file = fopen(path.c_str(), "wb");
+            if (file == nullptr) {
+                cerr << "write_columnar: cannot open " << path << endl;
+                return false;
+            }
+
+            row_t rows = dataset.rows;
+            int cols = dataset.cols;
+            size_t elem_size = dtype_size(dtype);
+
+            ColumnarHeader header{};
+            memcpy(header.magic, COLUMNAR_MAGIC, sizeof(header.magic));
+            header.version = COLUMNAR_VERSION;
+            header.dtype = dtype;
+            header.rows = rows;
+            header.cols = cols;
+            header.stats_offset = align_up(sizeof(ColumnarHeader));
+            header.data_offset = align_up(header.stats_offset + sizeof(ColumnStats) * (cols + 1));
+            header.column_stride = align_up(elem_size * rows);
+
+            vector<ColumnStats> stats(cols + 1);
+            vector<double> chunk(min(rows, (row_t) WRITE_CHUNK_ROWS));
+            vector<char> bytes(align_up(elem_size * chunk.size()));
+            uint64_t checksum = CHECKSUM_SEED;
+            bool ok = fseek(file, (long) header.data_offset, SEEK_SET) == 0;
+
+            // column blocks, the label is the last one
+            for (int col = 0; col <= cols && ok; col++) {
+                const DataView &view = col < cols ? dataset : label;
+                int view_col = col < cols ? col : 0;
+                ColumnStats &stat = stats[col];
+                stat.min = rows > 0 ? INFINITY : 0;
+                stat.max = rows > 0 ? -INFINITY : 0;
+                double sum = 0;
+
+                for (row_t begin = 0; begin < rows && ok; begin += WRITE_CHUNK_ROWS) {
+                    row_t end = min(begin + WRITE_CHUNK_ROWS, rows);
+                    int n = (int) (end - begin);
+                    read_column(view, view_col, begin, end, chunk.data());
+
+                    for (int i = 0; i < n; i++) {
+                        if (dtype == dtype_t::float32) {
+                            float value = (float) chunk[i];
+                            chunk[i] = value;
+                            memcpy(&bytes[i * elem_size], &value, elem_size);
+                        } else {
+                            memcpy(&bytes[i * elem_size], &chunk[i], elem_size);
+                        }
+                        stat.min = min(stat.min, chunk[i]);
+                        stat.max = max(stat.max, chunk[i]);
+                        sum += chunk[i];
+                    }
+
+                    // pad the end of the column block with zeros
+                    size_t chunk_bytes = n * elem_size;
+                    if (end == rows) {
+                        size_t padded = header.column_stride - begin * elem_size;
+                        memset(&bytes[chunk_bytes], 0, padded - chunk_bytes);
+                        chunk_bytes = padded;
+                    }
+                    checksum = checksum_update(checksum, bytes.data(), chunk_bytes);
+                    ok = fwrite(bytes.data(), 1, chunk_bytes, file) == chunk_bytes;
+                }
+                stat.mean = rows > 0 ? sum / rows : 0;
+            }
+
+            header.checksum = checksum;
+
+            // header and statistics
+            if (ok) {
+                vector<char> head(header.data_offset, 0);
+                memcpy(head.data(), &header, sizeof(header));
+                memcpy(head.data() + header.stats_offset, stats.data(), sizeof(ColumnStats) * stats.size());
+                ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(head.data(), 1, head.size(), file) == head.size();
+            }
+
+            ok = fclose(file) == 0 && ok;
+            if (!ok) {
+                cerr << "write_columnar: failed to write " << path << endl;
+            }
+            return ok;
+        }
+
+        bool write_columnar(const string &path, vector<vector<float>> &dataset, vector<float> &label) {
+            if (dataset.empty() || dataset.size() != label.size()) {
+                cerr << "write_columnar: invalid dataset" << endl;
+                return false;
+            }
+
+            // rows of the dataset are separately allocated, so view each row as a column of a transposed view
+            int rows = dataset.size();
+            int cols = dataset[0].size();
+            vector<float> buffer((size_t) rows * cols);
+            for (int i = 0; i < rows; i++) {
+                std::copy(dataset[i].begin(), dataset[i].end(), buffer.begin() + (size_t) i * cols);
+            }
+            return write_columnar(path, make_row_major_view(buffer.data(), rows, cols),
+                                  make_vector_view(label.data(), rows));
+        }
+
+        bool check_columnar_header(const void *base, size_t size) {
+            if (size < sizeof(ColumnarHeader)) {
+                return false;
+            }
+            auto &header = *(const ColumnarHeader *) base;
+            if (memcmp(header.magic, COLUMNAR_MAGIC, sizeof(header.magic)) != 0 ||
+                header.version != COLUMNAR_VERSION || header.dtype > dtype_t::float64) {
+                return false;
+            }
+
+            // the products of the sizes are bounded by divisions first, a corrupted header must not overflow them
+            uint64_t columns = header.cols + 1;
+            uint64_t element_size = dtype_size(header.dtype);
+            if (header.cols > INT_MAX || header.stats_offset < sizeof(ColumnarHeader) ||
+                header.stats_offset > header.data_offset ||
+                columns > (header.data_offset - header.stats_offset) / sizeof(ColumnStats)) {
+                return false;
+            }
+            if (header.data_offset % COLUMN_ALIGNMENT != 0 || header.column_stride % COLUMN_ALIGNMENT != 0 ||
+                header.data_offset > size || header.column_stride > (size - header.data_offset) / columns) {
+                return false;
+            }
+            return header.rows <= header.column_stride / element_size;
+        }
+
+        DataView columnar_dataset_view(const void *base) {
+            auto &header = *(const ColumnarHeader *) base;
+            const char *data = (const char *) base + header.data_offset;
+            long col_stride = header.column_stride / dtype_size(header.dtype);
+            if (header.dtype == dtype_t::float64) {
+                return make_view((const double *) data, header.rows, header.cols, 1, col_stride);
+            }
+            return make_view((const float *) data, header.rows, header.cols, 1, col_stride);
+        }
+
+        DataView columnar_label_view(const void *base) {
+            auto &header = *(const ColumnarHeader *) base;
+            const char *data = (const char *) base + header.data_offset + header.column_stride * header.cols;
+            if (header.dtype == dtype_t::float64) {
+                return make_vector_view((const double *) data, header.rows);
+            }
+            return make_vector_view((const float *) data, header.rows);
+        }
+
+        ColumnarFile::~ColumnarFile() {
+            close();
+        }
+
+        bool ColumnarFile::open(const string &path, bool verify) {
+            close();
+            if (!file.open(path)) {
+                cerr << "ColumnarFile: cannot open " << path << endl;
+                return false;
+            }
+            base = file.data();
+            if (base == nullptr || !check_columnar_header(base, file.size())) {
+                cerr << "ColumnarFile: invalid columnar file " << path << endl;
+                close();
+                return false;
+            }
+            if (verify && !this->verify()) {
+                cerr << "ColumnarFile: checksum mismatch in " << path << endl;
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void ColumnarFile::close() {
+            file.close();
+            base = nullptr;
+            column_state.clear();
+        }
+
+        bool ColumnarFile::verify() const {
+            auto &h = header();
+            return columnar_checksum(base + h.data_offset, h.column_stride * (h.cols + 1)) == h.checksum;
+        }
+
+        DataView ColumnarFile::dataset() const {
+            return columnar_dataset_view(base);
+        }
+
+        DataView ColumnarFile::label() const {
+            return columnar_label_view(base);
+        }
+
+        const ColumnStats &ColumnarFile::stats(int col) const {
+            return ((const ColumnStats *) (base + header().stats_offset))[col];
+        }
+
+        const char *ColumnarFile::column_data(int col) const {
+            return base + header().data_offset + header().column_stride * col;
+        }
+
+        void ColumnarFile::page_columns(const vector<unsigned long long> &used) {
+            auto &h = header();
+            column_state.resize(h.cols + 1, 0);
+            for (int col = 0; col <= (int) h.cols; col++) {
+                char state = col == (int) h.cols || test_column(used, col) ? 1 : 2;
+                if (column_state[col] != state) {
+                    file.advise(h.data_offset + h.column_stride * col, h.column_stride, state == 1);
+                    column_state[col] = state;
+                }
+            }
+        }
+
+        /**
+         * header of a shared memory segment, the columnar image starts at SHARED_IMAGE_OFFSET
+         */
+        struct SharedColumnarHeader {
+            char magic[8];
+            uint64_t image_size;
+            atomic<long long> references;
+            atomic<uint32_t> ready;
+        };
+
+        SharedColumnar::~SharedColumnar() {
+            detach();
+        }
+
+        bool SharedColumnar::create(const string &name, const string &path) {
+            detach();
+#ifndef _WIN32
+            MappedFile file;
+            if (!file.open(path) || file.data() == nullptr || !check_columnar_header(file.data(), file.size())) {
+                cerr << "SharedColumnar: invalid columnar file " << path << endl;
+                return false;
+            }
+
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0) {
+                cerr << "SharedColumnar: cannot create " << name << ": " << strerror(errno) << endl;
+                return false;
+            }
+            size_t size = SHARED_IMAGE_OFFSET + file.size();
+            void *ptr = MAP_FAILED;
+            if (ftruncate(fd, (off_t) size) == 0) {
+                ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+            if (ptr == MAP_FAILED) {
+                cerr << "SharedColumnar: cannot allocate " << size << " bytes for " << name << endl;
+                shm_unlink(name.c_str());
+                return false;
+            }
+
+            // the segment is published after the image is copied, with the reference of this process
+            auto *head = new(ptr) SharedColumnarHeader();
+            memcpy(head->magic, SHARED_MAGIC, sizeof(head->magic));
+            head->image_size = file.size();
+            head->references.store(1);
+            memcpy((char *) ptr + SHARED_IMAGE_OFFSET, file.data(), file.size());
+            head->ready.store(1, memory_order_release);
+            munmap(ptr, size);
+
+            if (!map(name)) {
+                shm_unlink(name.c_str());
+                return false;
+            }
+            this->name = name;
+            return true;
+#else
+            cerr << "SharedColumnar: shared memory segments are not supported on this platform" << endl;
+            return false;
+#endif
+        }
+
+        bool SharedColumnar::attach(const string &name) {
+            detach();
+            if (!map(name)) {
+                return false;
+            }
+
+            // a segment whose count has dropped to 0 is being removed
+            auto *head = (SharedColumnarHeader *) control;
+            long long count = head->references.load();
+            do {
+                if (count <= 0) {
+                    cerr << "SharedColumnar: " << name << " is being removed" << endl;
+                    unmap();
+                    return false;
+                }
+            } while (!head->references.compare_exchange_weak(count, count + 1));
+            this->name = name;
+            return true;
+        }
+
+        void SharedColumnar::detach() {
+            if (image == nullptr) {
+                return;
+            }
+#ifndef _WIN32
+            auto *head = (SharedColumnarHeader *) control;
+            if (head->references.fetch_sub(1) == 1) {
+                shm_unlink(name.c_str());
+            }
+#endif
+            unmap();
+            this->name.clear();
+        }
+
+        bool SharedColumnar::remove(const string &name) {
+#ifndef _WIN32
+            return shm_unlink(name.c_str()) == 0;
+#else
+            return false;
+#endif
+        }
+
+        long long SharedColumnar::references() const {
+            return image == nullptr ? 0 : ((const SharedColumnarHeader *) control)->references.load();
+        }
+
+        DataView SharedColumnar::dataset() const {
+            return columnar_dataset_view(image);
+        }
+
+        DataView SharedColumnar::label() const {
+            return columnar_label_view(image);
+        }
+
+        bool SharedColumnar::map(const string &name) {
+#ifndef _WIN32
+            int fd = shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0) {
+                cerr << "SharedColumnar: cannot open " << name << ": " << strerror(errno) << endl;
+                return false;
+            }
+            struct stat st{};
+            void *head = MAP_FAILED;
+            void *ptr = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && st.st_size > SHARED_IMAGE_OFFSET) {
+                // only the header is writable, the image is read-only
+                head = mmap(nullptr, SHARED_IMAGE_OFFSET, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+            this->control = head == MAP_FAILED ? nullptr : head;
+            this->mapping = ptr == MAP_FAILED ? nullptr : (const char *) ptr;
+            this->mapping_size = st.st_size;
+
+            auto *header = (const SharedColumnarHeader *) control;
+            size_t image_size = st.st_size - SHARED_IMAGE_OFFSET;
+            if (control == nullptr || mapping == nullptr || memcmp(header->magic, SHARED_MAGIC, 8) != 0 ||
+                header->ready.load(memory_order_acquire) != 1 || header->image_size > image_size ||
+                !check_columnar_header(mapping + SHARED_IMAGE_OFFSET, header->image_size)) {
+                cerr << "SharedColumnar: " << name << " is not a ready columnar segment" << endl;
+                unmap();
+                return false;
+            }
+            this->image = mapping + SHARED_IMAGE_OFFSET;
+            return true;
+#else
+            cerr << "SharedColumnar: shared memory segments are not supported on this platform" << endl;
+            return false;
+#endif
+        }
+
+        void SharedColumnar::unmap() {
+#ifndef _WIN32
+            if (control != nullptr) {
+                munmap(control, SHARED_IMAGE_OFFSET);
+            }
+            if (mapping != nullptr) {
+                munmap((void *) mapping, mapping_size);
+            }
+#endif
+            this->control = nullptr;
+            this->mapping = nullptr;
+            this->image = nullptr;
+            this->mapping_size = 0;
+        }
+    }
+}
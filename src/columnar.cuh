@@ -0,0 +1,259 @@
+#ifndef LUMINOCUGP_COLUMNAR_CUH
+#define LUMINOCUGP_COLUMNAR_CUH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "dataset.cuh"
+
+/**
+ * alignment of the column blocks in the columnar file
+ */
+#define COLUMN_ALIGNMENT 64
+
+namespace cusr {
+    namespace data {
+
+        using namespace std;
+
+        /**
+         * columnar binary dataset format
+         *
+         * +-------------------------+ 0
+         * | ColumnarHeader          |
+         * +-------------------------+ stats_offset
+         * | ColumnStats x (cols+1)  |  the last one is the label
+         * +-------------------------+ data_offset (64-byte aligned)
+         * | column 0                |
+         * | column 1                |  each column block is column_stride bytes (a multiple of 64)
+         * | ..                      |
+         * | label                   |
+         * +-------------------------+
+         */
+        struct ColumnarHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t dtype;
+            uint64_t rows;
+            uint64_t cols;
+            uint64_t stats_offset;
+            uint64_t data_offset;
+            uint64_t column_stride;
+            uint64_t checksum;
+        };
+
+        struct ColumnStats {
+            double min;
+            double max;
+            double mean;
+        };
+
+        /**
+         * write a dataset and its label in the columnar format
+         *
+         * @param path
+         * @param dataset
+         * @param label
+         * @param dtype element type in the file (float32 or float64)
+         * @return if or not the file is written
+         */
+        bool write_columnar(const string &path, const DataView &dataset, const DataView &label,
+                            dtype_t dtype = dtype_t::float32);
+
+        /**
+         * convert an in-memory dataset to the columnar format
+         *
+         * @param path
+         * @param dataset
+         * @param label
+         * @return if or not the file is written
+         */
+        bool write_columnar(const string &path, vector<vector<float>> &dataset, vector<float> &label);
+
+        /**
+         * checksum of the column blocks
+         *
+         * @param data
+         * @param bytes
+         * @return
+         */
+        uint64_t columnar_checksum(const void *data, size_t bytes);
+
+        /**
+         * memory-mapped columnar dataset
+         * the views returned by dataset() and label() point into the mapping, so nothing is copied
+         *
+         * ColumnarFile file;
+         * if (file.open("data.col")) {
+         *     reg.fit(file.dataset(), file.label());
+         * }
+         */
+        class ColumnarFile {
+        public:
+
+            ColumnarFile() = default;
+
+            ~ColumnarFile();
+
+            ColumnarFile(const ColumnarFile &) = delete;
+
+            ColumnarFile &operator=(const ColumnarFile &) = delete;
+
+            /**
+             * map a columnar file read-only
+             *
+             * @param path
+             * @param verify if or not to verify the checksum (reads the whole file)
+             * @return if or not the file is opened
+             */
+            bool open(const string &path, bool verify = false);
+
+            void close();
+
+            /**
+             * verify the checksum of the column blocks
+             * @return
+             */
+            bool verify() const;
+
+            DataView dataset() const;
+
+            DataView label() const;
+
+            /**
+             * statistics of column col, col == cols() refers to the label
+             * @param col
+             * @return
+             */
+            const ColumnStats &stats(int col) const;
+
+            const ColumnarHeader &header() const { return *(const ColumnarHeader *) base; }
+
+            row_t rows() const { return header().rows; }
+
+            int cols() const { return header().cols; }
+
+            /**
+             * pointer to the first byte of a column block, col == cols() refers to the label
+             * @param col
+             * @return
+             */
+            const char *column_data(int col) const;
+
+            /**
+             * keep the columns in use hot and release the others from memory,
+             * a released column is paged in from the file again when it is read
+             *
+             * @param used bitset of the feature columns in use, the label is always kept
+             */
+            void page_columns(const vector<unsigned long long> &used);
+
+        private:
+            MappedFile file;
+            const char *base = nullptr;
+            vector<char> column_state;  // 0: unknown, 1: hot, 2: released
+        };
+
+        /**
+         * a columnar dataset in a named POSIX shared memory segment, so that many processes on a host
+         * fit the same dataset from one copy in memory.
+         * the segment is a header with a reference count, followed by the columnar image as in the file.
+         * the image is mapped read-only, and the views returned by dataset() and label() point into it.
+         * each process holding the segment counts as a reference, the name is removed when the last one detaches
+         * (a process that dies without detaching keeps its reference, see remove)
+         *
+         * SharedColumnar segment;
+         * if (segment.create("/cusr_data", "data.col")) {   // or segment.attach("/cusr_data") in other processes
+         *     reg.fit(segment);
+         * }
+         */
+        class SharedColumnar {
+        public:
+
+            SharedColumnar() = default;
+
+            ~SharedColumnar();
+
+            SharedColumnar(const SharedColumnar &) = delete;
+
+            SharedColumnar &operator=(const SharedColumnar &) = delete;
+
+            /**
+             * load a columnar file into a new segment, this process holds the first reference
+             *
+             * @param name name of the segment, "/<name>"
+             * @param path
+             * @return false if the segment exists, or the file is not a valid columnar file
+             */
+            bool create(const string &name, const string &path);
+
+            /**
+             * map an existing segment read-only and add a reference
+             *
+             * @param name
+             * @return false if there is no such segment, or the segment is being created or removed
+             */
+            bool attach(const string &name);
+
+            /**
+             * drop the reference of this process, the segment is removed if it is the last one
+             */
+            void detach();
+
+            /**
+             * remove the name of a segment regardless of its references,
+             * the processes that hold it keep their mappings
+             *
+             * @param name
+             * @return if or not the name existed
+             */
+            static bool remove(const string &name);
+
+            bool is_attached() const { return image != nullptr; }
+
+            /**
+             * number of processes holding the segment
+             */
+            long long references() const;
+
+            DataView dataset() const;
+
+            DataView label() const;
+
+            const ColumnarHeader &header() const { return *(const ColumnarHeader *) image; }
+
+            row_t rows() const { return header().rows; }
+
+            int cols() const { return header().cols; }
+
+        private:
+            string name;
+            void *control = nullptr;       // read-write mapping of the segment header
+            const char *mapping = nullptr; // read-only mapping of the whole segment
+            const char *image = nullptr;
+            size_t mapping_size = 0;
+
+            bool map(const string &name);
+
+            void unmap();
+        };
+
+        /**
+         * check the header of a columnar image: the stats lie between the header and the data,
+         * the data offset and the column stride are aligned, and all columns lie within the image
+         *
+         * @param base
+         * @param size
+         * @return
+         */
+        bool check_columnar_header(const void *base, size_t size);
+
+        /**
+         * views of the dataset / label in a columnar image
+         */
+        DataView columnar_dataset_view(const void *base);
+
+        DataView columnar_label_view(const void *base);
+    }
+}
+#endif //LUMINOCUGP_COLUMNAR_CUH
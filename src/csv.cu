@@ -0,0 +1,451 @@
+#include "csv.cuh"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <algorithm>
+
+#define MAX_BAD_LINES 16
+
+namespace cusr {
+    namespace data {
+
+        using namespace std;
+
+        static const double pow10_table[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        static inline bool is_digit(char c) {
+            return c >= '0' && c <= '9';
+        }
+
+        static inline bool match_word(const char *begin, const char *end, const char *word) {
+            int len = strlen(word);
+            if (end - begin < len) {
+                return false;
+            }
+            for (int i = 0; i < len; i++) {
+                if ((begin[i] | 0x20) != word[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const char *parse_float(const char *begin, const char *end, float *value) {
+            const char *p = begin;
+            while (p < end && *p == ' ') {
+                p++;
+            }
+            if (p == end) {
+                *value = NAN;
+                return p;
+            }
+
+            bool negative = false;
+            if (*p == '-' || *p == '+') {
+                negative = *p == '-';
+                p++;
+            }
+
+            if (p < end && !is_digit(*p) && *p != '.') {
+                if (match_word(p, end, "nan")) {
+                    *value = NAN;
+                    return p + 3;
+                }
+                if (match_word(p, end, "na")) {
+                    *value = NAN;
+                    return p + 2;
+                }
+                if (match_word(p, end, "infinity")) {
+                    *value = negative ? -INFINITY : INFINITY;
+                    return p + 8;
+                }
+                if (match_word(p, end, "inf")) {
+                    *value = negative ? -INFINITY : INFINITY;
+                    return p + 3;
+                }
+                return nullptr;
+            }
+
+            // up to 19 significant digits are kept in the mantissa, the rest only shift the exponent
+            unsigned long long mantissa = 0;
+            int digits = 0;
+            int exponent = 0;
+            bool has_digit = false;
+            for (; p < end && is_digit(*p); p++) {
+                has_digit = true;
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa > 0) {
+                        digits++;
+                    }
+                } else {
+                    exponent++;
+                }
+            }
+            if (p < end && *p == '.') {
+                for (p++; p < end && is_digit(*p); p++) {
+                    has_digit = true;
+                    if (digits < 19) {
+                        mantissa = mantissa * 10 + (*p - '0');
+                        if (mantissa > 0) {
+                            digits++;
+                        }
+                        exponent--;
+                    }
+                }
+            }
+            if (!has_digit) {
+                return nullptr;
+            }
+            if (p < end && (*p == 'e' || *p == 'E')) {
+                p++;
+                bool negative_exponent = false;
+                if (p < end && (*p == '-' || *p == '+')) {
+                    negative_exponent = *p == '-';
+                    p++;
+                }
+                if (p == end || !is_digit(*p)) {
+                    return nullptr;
+                }
+                int e = 0;
+                for (; p < end && is_digit(*p); p++) {
+                    if (e < 10000) {
+                        e = e * 10 + (*p - '0');
+                    }
+                }
+                exponent += negative_exponent ? -e : e;
+            }
+
+            double result = (double) mantissa;
+            if (exponent < 0) {
+                result = -exponent <= 22 ? result / pow10_table[-exponent] : result * std::pow(10.0, exponent);
+            } else if (exponent > 0) {
+                result = exponent <= 22 ? result * pow10_table[exponent] : result * std::pow(10.0, exponent);
+            }
+            *value = (float) (negative ? -result : result);
+
+            while (p < end && *p == ' ') {
+                p++;
+            }
+            return p;
+        }
+
+        /**
+         * end of the line starting at p, excluding '\r' and '\n'
+         */
+        static inline const char *line_end(const char *p, const char *end, const char **next) {
+            auto *nl = (const char *) memchr(p, '\n', end - p);
+            const char *eol = nl == nullptr ? end : nl;
+            *next = nl == nullptr ? end : nl + 1;
+            if (eol > p && eol[-1] == '\r') {
+                eol--;
+            }
+            return eol;
+        }
+
+        static inline bool is_blank(const char *p, const char *eol) {
+            for (; p < eol; p++) {
+                if (*p != ' ' && *p != '\t') {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        struct CsvRange {
+            const char *begin;
+            const char *end;
+            long rows = 0;      // non-blank lines
+            long lines = 0;     // all lines
+            long row_offset = 0;
+            long line_offset = 0;
+            int malformed_rows = 0;
+            int nan_rows = 0;
+            vector<long> bad_lines;
+        };
+
+        static void count_range(CsvRange &range) {
+            const char *next;
+            for (const char *p = range.begin; p < range.end; p = next) {
+                const char *eol = line_end(p, range.end, &next);
+                range.lines++;
+                if (!is_blank(p, eol)) {
+                    range.rows++;
+                }
+            }
+        }
+
+        static void parse_range(CsvRange &range, char delimiter, int fields, int label_index, ColumnStore &store,
+                                vector<char> &valid) {
+            const char *next;
+            long row = range.row_offset;
+            long line = range.line_offset;
+            float *label = store.label_column();
+
+            for (const char *p = range.begin; p < range.end; p = next) {
+                const char *eol = line_end(p, range.end, &next);
+                line++;
+                if (is_blank(p, eol)) {
+                    continue;
+                }
+
+                bool malformed = false;
+                bool has_nan = false;
+                int field = 0;
+                const char *q = p;
+                while (true) {
+                    auto *field_end = (const char *) memchr(q, delimiter, eol - q);
+                    if (field_end == nullptr) {
+                        field_end = eol;
+                    }
+                    if (field >= fields) {
+                        malformed = true;
+                        break;
+                    }
+                    float value;
+                    const char *parsed = parse_float(q, field_end, &value);
+                    if (parsed != field_end) {
+                        malformed = true;
+                        value = NAN;
+                    }
+                    has_nan |= std::isnan(value);
+                    if (field == label_index) {
+                        label[row] = value;
+                    } else {
+                        store.column(field < label_index ? field : field - 1)[row] = value;
+                    }
+                    field++;
+                    if (field_end == eol) {
+                        break;
+                    }
+                    q = field_end + 1;
+                }
+                malformed |= field != fields;
+                for (; field < fields; field++) {
+                    // missing fields are kept as NaN
+                    if (field == label_index) {
+                        label[row] = NAN;
+                    } else {
+                        store.column(field < label_index ? field : field - 1)[row] = NAN;
+                    }
+                }
+
+                valid[row] = !malformed && !has_nan;
+                if (malformed) {
+                    range.malformed_rows++;
+                } else if (has_nan) {
+                    range.nan_rows++;
+                }
+                if ((malformed || has_nan) && range.bad_lines.size() < MAX_BAD_LINES) {
+                    range.bad_lines.push_back(line);
+                }
+                row++;
+            }
+        }
+
+        /**
+         * move the valid rows of a range to the front of its rows, in the columns and the label
+         */
+        static void compact_range(const CsvRange &range, ColumnStore &store, int columns, const vector<char> &valid) {
+            for (int col = 0; col <= columns; col++) {
+                float *column = col < columns ? store.column(col) : store.label_column();
+                long to = range.row_offset;
+                for (long from = range.row_offset; from < range.row_offset + range.rows; from++) {
+                    if (valid[from]) {
+                        column[to++] = column[from];
+                    }
+                }
+            }
+        }
+
+        /**
+         * move the compacted rows of the ranges together in the columns [col_begin, col_end),
+         * the label is column number columns
+         */
+        static void join_ranges(const vector<CsvRange> &ranges, ColumnStore &store, int columns, int col_begin,
+                                int col_end) {
+            for (int col = col_begin; col < col_end; col++) {
+                float *column = col < columns ? store.column(col) : store.label_column();
+                long to = 0;
+                for (auto &range: ranges) {
+                    long kept = range.rows - range.malformed_rows - range.nan_rows;
+                    memmove(column + to, column + range.row_offset, kept * sizeof(float));
+                    to += kept;
+                }
+            }
+        }
+
+        static void split_fields(const char *p, const char *eol, char delimiter, vector<string> &fields) {
+            fields.clear();
+            while (true) {
+                auto *field_end = (const char *) memchr(p, delimiter, eol - p);
+                if (field_end == nullptr) {
+                    field_end = eol;
+                }
+                string name(p, field_end);
+                name.erase(0, name.find_first_not_of(" \"")); // trim spaces and quotes
+                name.erase(name.find_last_not_of(" \"") + 1);
+                fields.push_back(name);
+                if (field_end == eol) {
+                    break;
+                }
+                p = field_end + 1;
+            }
+        }
+
+        bool read_csv(const string &path, ColumnStore &store, const CsvOptions &options, CsvReport *report) {
+            MappedFile file;
+            if (!file.open(path)) {
+                cerr << "read_csv: cannot open " << path << endl;
+                return false;
+            }
+
+            const char *begin = file.data();
+            const char *end = begin + file.size();
+            if (end - begin >= 3 && memcmp(begin, "\xEF\xBB\xBF", 3) == 0) {
+                begin += 3; // UTF-8 BOM
+            }
+            if (begin == end) {
+                cerr << "read_csv: empty file " << path << endl;
+                return false;
+            }
+
+            char delimiter = options.delimiter;
+            if (delimiter == 0) {
+                bool is_csv = path.size() >= 4 && (path.compare(path.size() - 4, 4, ".csv") == 0 ||
+                                                   path.compare(path.size() - 4, 4, ".CSV") == 0);
+                delimiter = is_csv ? ',' : '\t';
+            }
+
+            // the first line decides the number of fields
+            const char *body;
+            const char *first_eol = line_end(begin, end, &body);
+            vector<string> names;
+            split_fields(begin, first_eol, delimiter, names);
+            int fields = names.size();
+            long header_lines = 0;
+            if (options.has_header) {
+                header_lines = 1;
+            } else {
+                body = begin;
+                for (int i = 0; i < fields; i++) {
+                    names[i] = "x" + to_string(i);
+                }
+            }
+
+            int label_index = options.label_index < 0 ? fields + options.label_index : options.label_index;
+            if (!options.label_name.empty()) {
+                label_index = std::find(names.begin(), names.end(), options.label_name) - names.begin();
+            }
+            if (fields < 2 || label_index < 0 || label_index >= fields) {
+                cerr << "read_csv: cannot find the label column in " << path << endl;
+                return false;
+            }
+
+            // split the body into byte ranges at line boundaries
+            int threads = options.threads > 0 ? options.threads : max(1, (int) std::thread::hardware_concurrency());
+            threads = max(1, (int) min((long) threads, (long) (end - body) / (1 << 16) + 1));
+            vector<CsvRange> ranges(threads);
+            const char *range_begin = body;
+            for (int i = 0; i < threads; i++) {
+                const char *range_end = i == threads - 1 ? end : body + (end - body) * (i + 1) / threads;
+                if (range_end < range_begin) {
+                    range_end = range_begin;
+                }
+                if (range_end < end) {
+                    auto *nl = (const char *) memchr(range_end, '\n', end - range_end);
+                    range_end = nl == nullptr ? end : nl + 1;
+                }
+                ranges[i].begin = range_begin;
+                ranges[i].end = range_end;
+                range_begin = range_end;
+            }
+
+            // pass 1: count the rows of each range
+            vector<std::thread> workers;
+            for (int i = 0; i < threads; i++) {
+                workers.emplace_back(count_range, std::ref(ranges[i]));
+            }
+            for (auto &worker: workers) {
+                worker.join();
+            }
+
+            long total_rows = 0;
+            long total_lines = header_lines;
+            for (auto &range: ranges) {
+                range.row_offset = total_rows;
+                range.line_offset = total_lines;
+                total_rows += range.rows;
+                total_lines += range.lines;
+            }
+            if (total_rows > INT32_MAX) {
+                cerr << "read_csv: too many rows in " << path << endl;
+                return false;
+            }
+
+            // pass 2: parse each range into its rows of the columns
+            store.resize(total_rows, fields - 1);
+            vector<char> valid(total_rows);
+            workers.clear();
+            for (int i = 0; i < threads; i++) {
+                workers.emplace_back(parse_range, std::ref(ranges[i]), delimiter, fields, label_index,
+                                     std::ref(store), std::ref(valid));
+            }
+            for (auto &worker: workers) {
+                worker.join();
+            }
+
+            // drop invalid rows: each worker compacts its range in place, then the ranges are moved together
+            // with the columns split over the workers
+            long invalid_rows = 0;
+            for (auto &range: ranges) {
+                invalid_rows += range.malformed_rows + range.nan_rows;
+            }
+            int rows = total_rows;
+            if (options.drop_invalid && invalid_rows > 0) {
+                workers.clear();
+                for (int i = 0; i < threads; i++) {
+                    workers.emplace_back(compact_range, std::cref(ranges[i]), std::ref(store), fields - 1,
+                                         std::cref(valid));
+                }
+                for (auto &worker: workers) {
+                    worker.join();
+                }
+                workers.clear();
+                int column_workers = min(threads, fields);
+                for (int i = 0; i < column_workers; i++) {
+                    workers.emplace_back(join_ranges, std::cref(ranges), std::ref(store), fields - 1,
+                                         fields * i / column_workers, fields * (i + 1) / column_workers);
+                }
+                for (auto &worker: workers) {
+                    worker.join();
+                }
+                rows = total_rows - invalid_rows;
+                store.truncate(rows);
+            }
+
+            if (report != nullptr) {
+                report->rows = rows;
+                report->malformed_rows = 0;
+                report->nan_rows = 0;
+                report->bad_lines.clear();
+                for (auto &range: ranges) {
+                    report->malformed_rows += range.malformed_rows;
+                    report->nan_rows += range.nan_rows;
+                    for (long line: range.bad_lines) {
+                        if (report->bad_lines.size() < MAX_BAD_LINES) {
+                            report->bad_lines.push_back(line);
+                        }
+                    }
+                }
+                names.erase(names.begin() + label_index);
+                report->column_names = names;
+            }
+            return true;
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef LUMINOCUGP_CSV_CUH
+#define LUMINOCUGP_CSV_CUH
+
+#include <string>
+#include <vector>
+#include "dataset.cuh"
+
+namespace cusr {
+    namespace data {
+
+        using namespace std;
+
+        struct CsvOptions {
+            /**
+             * field delimiter, 0 means ',' for .csv files and '\t' otherwise
+             */
+            char delimiter = 0;
+
+            /**
+             * if or not the first line contains the column names
+             */
+            bool has_header = true;
+
+            /**
+             * label column chosen by name (requires has_header), or by index if the name is empty
+             * a negative index counts from the last column, -1 is the last column
+             */
+            string label_name;
+            int label_index = -1;
+
+            /**
+             * number of parsing threads, 0 means the number of hardware threads
+             */
+            int threads = 0;
+
+            /**
+             * drop rows that contain NaN or malformed fields
+             */
+            bool drop_invalid = true;
+        };
+
+        struct CsvReport {
+            int rows = 0;               // rows stored in the column store
+            int malformed_rows = 0;     // rows with a wrong number of fields or unparsable fields
+            int nan_rows = 0;           // rows with NaN / empty fields
+            vector<long> bad_lines;     // line numbers (1-based) of the first invalid rows
+            vector<string> column_names;
+        };
+
+        /**
+         * parse a float without locale, returns the end of the number, or nullptr if the field is malformed
+         * an empty field, "nan" and "NA" are parsed as NaN
+         *
+         * @param begin
+         * @param end
+         * @param value
+         * @return
+         */
+        const char *parse_float(const char *begin, const char *end, float *value);
+
+        /**
+         * read a CSV/TSV file into a column store
+         * the file is split into byte ranges which are parsed in parallel,
+         * each thread writes its rows directly into the columns
+         *
+         * @param path
+         * @param store feature columns and the label column
+         * @param options
+         * @param report statistics of invalid rows, may be nullptr
+         * @return if or not the file is read
+         */
+        bool read_csv(const string &path, ColumnStore &store, const CsvOptions &options, CsvReport *report);
+    }
+}
+#endif //LUMINOCUGP_CSV_CUH
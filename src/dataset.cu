@@ -0,0 +1,775 @@
+#include "dataset.cuh"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+namespace cusr {
+    namespace data {
+
+        using namespace std;
+
+        DataView make_view(const float *data, row_t rows, int cols, long row_stride, long col_stride) {
+            DataView view;
+            view.data = data;
+            view.rows = rows;
+            view.cols = cols;
+            view.row_stride = row_stride;
+            view.col_stride = col_stride;
+            view.dtype = dtype_t::float32;
+            return view;
+        }
+
+        DataView make_view(const double *data, row_t rows, int cols, long row_stride, long col_stride) {
+            DataView view = make_view((const float *) nullptr, rows, cols, row_stride, col_stride);
+            view.data = data;
+            view.dtype = dtype_t::float64;
+            return view;
+        }
+
+        DataView make_row_major_view(const float *data, row_t rows, int cols) {
+            return make_view(data, rows, cols, cols, 1);
+        }
+
+        DataView make_row_major_view(const double *data, row_t rows, int cols) {
+            return make_view(data, rows, cols, cols, 1);
+        }
+
+        DataView make_column_major_view(const float *data, row_t rows, int cols) {
+            return make_view(data, rows, cols, 1, rows);
+        }
+
+        DataView make_column_major_view(const double *data, row_t rows, int cols) {
+            return make_view(data, rows, cols, 1, rows);
+        }
+
+        DataView make_vector_view(const float *data, row_t size) {
+            return make_view(data, size, 1, 1, size);
+        }
+
+        DataView make_vector_view(const double *data, row_t size) {
+            return make_view(data, size, 1, 1, size);
+        }
+
+        template<typename T, typename D>
+        static void read_column(const T *src, long row_stride, row_t begin, row_t end, D *dst) {
+            src += begin * row_stride;
+            for (row_t i = 0; i < end - begin; i++) {
+                dst[i] = (D) src[i * row_stride];
+            }
+        }
+
+        template<typename C, typename T>
+        static void gather_codes(const C *codes, const T *table, row_t begin, row_t end, T *dst) {
+            for (row_t i = begin; i < end; i++) {
+                dst[i - begin] = table[codes[i]];
+            }
+        }
+
+        void gather_dictionary(const ColumnDictionary &dict, const float *table, row_t begin, row_t end, float *dst) {
+            if (dict.code_bytes == 1) {
+                gather_codes((const uint8_t *) dict.codes, table, begin, end, dst);
+            } else {
+                gather_codes((const uint16_t *) dict.codes, table, begin, end, dst);
+            }
+        }
+
+        void gather_dictionary(const ColumnDictionary &dict, const double *table, row_t begin, row_t end, double *dst) {
+            if (dict.code_bytes == 1) {
+                gather_codes((const uint8_t *) dict.codes, table, begin, end, dst);
+            } else {
+                gather_codes((const uint16_t *) dict.codes, table, begin, end, dst);
+            }
+        }
+
+        template<typename D, typename F>
+        static void read_column(const uint16_t *src, long row_stride, row_t begin, row_t end, D *dst, F convert) {
+            src += begin * row_stride;
+            for (row_t i = 0; i < end - begin; i++) {
+                dst[i] = (D) convert(src[i * row_stride]);
+            }
+        }
+
+        template<typename D>
+        static void read_view_column(const DataView &view, int col, row_t begin, row_t end, D *dst) {
+            const ColumnDictionary *dict = view.dictionary(col);
+            if (dict != nullptr) {
+                for (row_t i = begin; i < end; i++) {
+                    int code = dict->code_bytes == 1 ? ((const uint8_t *) dict->codes)[i]
+                                                     : ((const uint16_t *) dict->codes)[i];
+                    dst[i - begin] = (D) dict->values[code];
+                }
+            } else if (view.dtype == dtype_t::float32) {
+                read_column((const float *) view.data + view.column_offset(col), view.row_stride, begin, end, dst);
+            } else if (view.dtype == dtype_t::float64) {
+                read_column((const double *) view.data + view.column_offset(col), view.row_stride, begin, end, dst);
+            } else {
+                const uint16_t *src = (const uint16_t *) view.data + view.column_offset(col);
+                if (view.dtype == dtype_t::float16) {
+                    read_column(src, view.row_stride, begin, end, dst, half_to_float);
+                } else if (view.dtype == dtype_t::bfloat16) {
+                    read_column(src, view.row_stride, begin, end, dst, bfloat16_to_float);
+                } else {
+                    float scale = view.scale[col];
+                    float offset = view.offset[col];
+                    read_column(src, view.row_stride, begin, end, dst, [scale, offset](uint16_t code) {
+                        return (int16_t) code == INT16_NAN_CODE ? NAN : (int16_t) code * scale + offset;
+                    });
+                }
+            }
+        }
+
+        void read_column(const DataView &view, int col, row_t begin, row_t end, float *dst) {
+            read_view_column(view, col, begin, end, dst);
+        }
+
+        void read_column(const DataView &view, int col, row_t begin, row_t end, double *dst) {
+            read_view_column(view, col, begin, end, dst);
+        }
+
+        MappedFile::~MappedFile() {
+            close();
+        }
+
+        bool MappedFile::open(const string &path) {
+            close();
+#ifndef _WIN32
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st{};
+            if (fstat(fd, &st) != 0) {
+                ::close(fd);
+                return false;
+            }
+            if (st.st_size > 0) {
+                void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (ptr == MAP_FAILED) {
+                    ::close(fd);
+                    return false;
+                }
+                base = (const char *) ptr;
+                length = st.st_size;
+            }
+            // the mapping stays valid after the descriptor is closed
+            ::close(fd);
+            return true;
+#else
+            FILE *file = fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                return false;
+            }
+            fseek(file, 0, SEEK_END);
+            buffer.resize(ftell(file));
+            fseek(file, 0, SEEK_SET);
+            length = fread(buffer.data(), 1, buffer.size(), file);
+            fclose(file);
+            base = buffer.data();
+            return true;
+#endif
+        }
+
+        void MappedFile::close() {
+#ifndef _WIN32
+            if (base != nullptr) {
+                munmap((void *) base, length);
+            }
+#endif
+            base = nullptr;
+            length = 0;
+            vector<char>().swap(buffer);
+        }
+
+        void MappedFile::advise(size_t offset, size_t length, bool needed) const {
+#ifndef _WIN32
+            if (base == nullptr || offset >= this->length) {
+                return;
+            }
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t end = min(offset + length, this->length);
+            if (needed) {
+                // pages that overlap the range are read ahead
+                size_t begin = offset / page * page;
+                madvise((void *) (base + begin), end - begin, MADV_WILLNEED);
+            } else {
+                // only pages that are entirely in the range are released, the mapping is backed by the file
+                size_t begin = (offset + page - 1) / page * page;
+                end = end == this->length ? end : end / page * page;
+                if (begin < end) {
+                    madvise((void *) (base + begin), end - begin, MADV_DONTNEED);
+                }
+            }
+#endif
+        }
+
+        template<typename T>
+        void BasicColumnStore<T>::resize(int rows, int cols) {
+            resize(rows, cols, vector<unsigned long long>());
+        }
+
+        template<typename T>
+        void BasicColumnStore<T>::resize(int rows, int cols, const vector<unsigned long long> &used) {
+            dictionaries.clear();
+            dictionary_values.clear();
+            dictionary_codes.clear();
+
+            // 16 floats / 8 doubles = 64 bytes
+            const long align = 64 / sizeof(T);
+            this->rows = rows;
+            this->cols = cols;
+            this->stride = ((long) rows + align - 1) / align * align;
+
+            // the used columns in order, then the shared column of the unused ones, then the label
+            offsets.clear();
+            long allocated = cols;
+            if (!used.empty()) {
+                offsets.resize(cols + 1);
+                int used_num = 0;
+                for (int col = 0; col < cols; col++) {
+                    used_num += test_column(used, col);
+                }
+                for (int col = 0, slot = 0; col < cols; col++) {
+                    offsets[col] = (test_column(used, col) ? slot++ : used_num) * stride;
+                }
+                allocated = used_num + (used_num < cols);
+                offsets[cols] = allocated * stride;
+            }
+            size_t size = stride * (allocated + 1) + align;
+            if (size > capacity) {
+                // new T[] leaves the elements uninitialized, unlike vector::resize
+                buffer.reset();
+                buffer.reset(new T[size]);
+                capacity = size;
+            }
+            auto address = (size_t) buffer.get();
+            base = buffer.get() + ((64 - address % 64) % 64) / sizeof(T);
+        }
+
+        template<typename T>
+        int BasicColumnStore<T>::encode_dictionaries(int /*max_entries*/) {
+            // the dictionary values are floats
+            return 0;
+        }
+
+        /**
+         * dictionary-encode a float column if it has at most max_entries distinct values (and at least 4 rows
+         * per entry), the entries are sorted by bit pattern, so the encoding does not depend on the hash order
+         *
+         * @param column
+         * @param rows
+         * @param max_entries at most 65536
+         * @param index scratch table
+         * @param values
+         * @param codes
+         * @param dict refers to values and codes, code_bytes is 0 if the column is not encoded
+         * @return if or not the column is encoded
+         */
+        static bool encode_dictionary(const float *column, int rows, int max_entries,
+                                      unordered_map<uint32_t, int> &index, vector<float> &values,
+                                      vector<unsigned char> &codes, ColumnDictionary &dict) {
+            // distinct bit patterns, given up as soon as there are too many
+            index.clear();
+            bool low_cardinality = true;
+            for (int i = 0; i < rows && low_cardinality; i++) {
+                uint32_t bits;
+                memcpy(&bits, &column[i], sizeof(bits));
+                index.emplace(bits, 0);
+                low_cardinality = (int) index.size() <= max_entries;
+            }
+            int size = index.size();
+            if (!low_cardinality || size == 0 || (long) size * 4 > rows) {
+                return false;
+            }
+
+            vector<uint32_t> keys;
+            keys.reserve(size);
+            for (auto &entry: index) {
+                keys.push_back(entry.first);
+            }
+            std::sort(keys.begin(), keys.end());
+            values.resize(size);
+            for (int k = 0; k < size; k++) {
+                index[keys[k]] = k;
+                memcpy(&values[k], &keys[k], sizeof(float));
+            }
+
+            dict.code_bytes = size <= 256 ? 1 : 2;
+            codes.resize((size_t) rows * dict.code_bytes);
+            for (int i = 0; i < rows; i++) {
+                uint32_t bits;
+                memcpy(&bits, &column[i], sizeof(bits));
+                int code = index[bits];
+                if (dict.code_bytes == 1) {
+                    codes[i] = (uint8_t) code;
+                } else {
+                    uint16_t code16 = code;
+                    memcpy(&codes[i * 2], &code16, sizeof(code16));
+                }
+            }
+            dict.values = values.data();
+            dict.codes = codes.data();
+            dict.size = size;
+            return true;
+        }
+
+        template<>
+        int BasicColumnStore<float>::encode_dictionaries(int max_entries) {
+            max_entries = min(max_entries, 65536);
+            dictionaries.assign(cols, ColumnDictionary());
+            dictionary_values.assign(cols, vector<float>());
+            dictionary_codes.assign(cols, vector<unsigned char>());
+
+            int encoded = 0;
+            unordered_map<uint32_t, int> index;
+            for (int col = 0; col < cols; col++) {
+                encoded += encode_dictionary(this->column(col), rows, max_entries, index, dictionary_values[col],
+                                             dictionary_codes[col], dictionaries[col]);
+            }
+
+            if (encoded == 0) {
+                dictionaries.clear();
+                dictionary_values.clear();
+                dictionary_codes.clear();
+            }
+            return encoded;
+        }
+
+        template<typename T>
+        void BasicColumnStore<T>::truncate(int rows) {
+            this->rows = min(this->rows, rows);
+        }
+
+        template<typename T>
+        void BasicColumnStore<T>::clear() {
+            buffer.reset();
+            capacity = 0;
+            dictionaries.clear();
+            dictionary_values.clear();
+            dictionary_codes.clear();
+            base = nullptr;
+            rows = cols = 0;
+            stride = 0;
+            offsets.clear();
+        }
+
+        template<typename T>
+        void BasicColumnStore<T>::release_columns() {
+            buffer.reset();
+            capacity = 0;
+            base = nullptr;
+            offsets.clear();
+        }
+
+        template<typename T>
+        DataView BasicColumnStore<T>::dataset() const {
+            DataView view = make_view(base, rows, cols, 1, stride);
+            view.dictionaries = dictionaries.empty() ? nullptr : dictionaries.data();
+            view.col_offsets = offsets.empty() ? nullptr : offsets.data();
+            return view;
+        }
+
+        template<typename T>
+        DataView BasicColumnStore<T>::label() const {
+            return make_vector_view(column(cols), rows);
+        }
+
+        template class BasicColumnStore<float>;
+
+        template class BasicColumnStore<double>;
+
+        bool PackedStore::allocate(row_t rows, int cols, dtype_t dtype) {
+            if (dtype != dtype_t::float16 && dtype != dtype_t::bfloat16 && dtype != dtype_t::int16) {
+                cerr << "PackedStore: the element type is not a 16-bit type" << endl;
+                return false;
+            }
+            if (rows > INT_MAX) {
+                cerr << "PackedStore: too many rows for an in-memory store" << endl;
+                return false;
+            }
+
+            // 32 elements = 64 bytes
+            this->dtype = dtype;
+            this->rows = rows;
+            this->cols = cols;
+            this->stride = ((long) rows + 31) / 32 * 32;
+            buffer.resize(stride * (cols + 1) + 32);
+            auto address = (size_t) buffer.data();
+            base = buffer.data() + ((64 - address % 64) % 64) / sizeof(uint16_t);
+            scale.assign(cols + 1, 0);
+            offset.assign(cols + 1, 0);
+            dictionaries.clear();
+            dictionary_values.clear();
+            dictionary_codes.clear();
+            return true;
+        }
+
+        bool PackedStore::pack(const DataView &dataset, const DataView &label, dtype_t dtype) {
+            if (!allocate(dataset.rows, dataset.cols, dtype)) {
+                return false;
+            }
+            for (int col = 0; col < cols; col++) {
+                pack_column(dataset, col, col);
+            }
+            pack_column(label, 0, cols);
+            return true;
+        }
+
+        bool PackedStore::pack(const vector<vector<float>> &dataset, const vector<float> &label, dtype_t dtype,
+                               bool encode_dictionaries) {
+            assert(!dataset.empty() && dataset.size() == label.size());
+            if (!allocate(dataset.size(), dataset[0].size(), dtype)) {
+                return false;
+            }
+            if (encode_dictionaries) {
+                dictionaries.assign(cols, ColumnDictionary());
+                dictionary_values.assign(cols, vector<float>());
+                dictionary_codes.assign(cols, vector<unsigned char>());
+            }
+
+            int encoded = 0;
+            unordered_map<uint32_t, int> index;
+            vector<float> column(rows);
+            for (int col = 0; col < cols; col++) {
+                for (int i = 0; i < rows; i++) {
+                    column[i] = dataset[i][col];
+                }
+                if (encode_dictionaries) {
+                    encoded += encode_dictionary(column.data(), rows, DICTIONARY_MAX_ENTRIES, index,
+                                                 dictionary_values[col], dictionary_codes[col], dictionaries[col]);
+                }
+                pack_column(make_vector_view(column.data(), rows), 0, col);
+            }
+            pack_column(make_vector_view(label.data(), rows), 0, cols);
+
+            if (encoded == 0) {
+                dictionaries.clear();
+                dictionary_values.clear();
+                dictionary_codes.clear();
+            }
+            return true;
+        }
+
+        void PackedStore::pack_column(const DataView &view, int col, int dst_col) {
+            uint16_t *dst = base + dst_col * stride;
+            vector<float> block(min(rows, ROW_BLOCK_SIZE));
+
+            if (dtype == dtype_t::int16) {
+                // codes -32767..32767 span the range of the finite values
+                float min_value = INFINITY;
+                float max_value = -INFINITY;
+                for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                    int end = min(begin + ROW_BLOCK_SIZE, rows);
+                    read_column(view, col, begin, end, block.data());
+                    for (int i = 0; i < end - begin; i++) {
+                        if (std::isfinite(block[i])) {
+                            min_value = min(min_value, block[i]);
+                            max_value = max(max_value, block[i]);
+                        }
+                    }
+                }
+                if (min_value <= max_value) {
+                    offset[dst_col] = (float) (((double) min_value + max_value) / 2);
+                    scale[dst_col] = (float) (((double) max_value - min_value) / 65534);
+                }
+            }
+
+            for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                int end = min(begin + ROW_BLOCK_SIZE, rows);
+                read_column(view, col, begin, end, block.data());
+                for (int i = 0; i < end - begin; i++) {
+                    float value = block[i];
+                    if (dtype == dtype_t::float16) {
+                        dst[begin + i] = float_to_half(value);
+                    } else if (dtype == dtype_t::bfloat16) {
+                        dst[begin + i] = float_to_bfloat16(value);
+                    } else if (!std::isfinite(value)) {
+                        dst[begin + i] = (uint16_t) INT16_NAN_CODE;
+                    } else {
+                        double code = scale[dst_col] == 0 ? 0 : std::nearbyint(
+                                ((double) value - offset[dst_col]) / scale[dst_col]);
+                        dst[begin + i] = (uint16_t) (int16_t) max(-32767.0, min(32767.0, code));
+                    }
+                }
+            }
+        }
+
+        void PackedStore::clear() {
+            vector<uint16_t>().swap(buffer);
+            vector<float>().swap(scale);
+            vector<float>().swap(offset);
+            vector<ColumnDictionary>().swap(dictionaries);
+            vector<vector<float>>().swap(dictionary_values);
+            vector<vector<unsigned char>>().swap(dictionary_codes);
+            base = nullptr;
+            rows = cols = 0;
+            stride = 0;
+        }
+
+        DataView PackedStore::dataset() const {
+            DataView view = make_view((const float *) nullptr, rows, cols, 1, stride);
+            view.data = base;
+            view.dtype = dtype;
+            view.scale = scale.data();
+            view.offset = offset.data();
+            view.dictionaries = dictionaries.empty() ? nullptr : dictionaries.data();
+            return view;
+        }
+
+        DataView PackedStore::label() const {
+            DataView view = make_view((const float *) nullptr, rows, 1, 1, stride);
+            view.data = base + cols * stride;
+            view.dtype = dtype;
+            view.scale = scale.data() + cols;
+            view.offset = offset.data() + cols;
+            return view;
+        }
+
+        template<typename T>
+        BasicBlockReader<T>::BasicBlockReader(const DataView &dataset, const DataView &label, const DataView &weight)
+                : dataset(dataset), label_view(label), weight_view(weight) {
+            scratch.resize(dataset.cols);
+            loaded.assign(dataset.cols, -1);
+            direct = dataset.dtype == scalar_dtype<T>::value && (dataset.row_stride == 1 || dataset.rows <= 1);
+        }
+
+        template<typename T>
+        void BasicBlockReader<T>::seek(row_t begin, row_t end) {
+            this->begin = begin;
+            this->end = end;
+            this->stamp++;
+        }
+
+        template<typename T>
+        const T *BasicBlockReader<T>::column(int col) {
+            if (direct && dataset.dictionary(col) == nullptr) {
+                return (const T *) dataset.data + dataset.column_offset(col) + begin;
+            }
+
+            // transpose / decode the column of the block on the first request
+            if (loaded[col] != stamp) {
+                if (scratch[col].size() < end - begin) {
+                    scratch[col].resize(end - begin);
+                }
+                read_column(dataset, col, begin, end, scratch[col].data());
+                loaded[col] = stamp;
+            }
+            return scratch[col].data();
+        }
+
+        static const float *dictionary_table(const ColumnDictionary &dict, vector<float> & /*converted*/) {
+            return dict.values;
+        }
+
+        static const double *dictionary_table(const ColumnDictionary &dict, vector<double> &converted) {
+            if (converted.empty()) {
+                converted.assign(dict.values, dict.values + dict.size);
+            }
+            return converted.data();
+        }
+
+        template<typename T>
+        const T *BasicBlockReader<T>::dictionary_values(int col) {
+            if (dictionary_scratch.empty()) {
+                dictionary_scratch.resize(dataset.cols);
+            }
+            return dictionary_table(*dataset.dictionary(col), dictionary_scratch[col]);
+        }
+
+        template<typename T>
+        void BasicBlockReader<T>::gather(int col, const T *table, T *dst) const {
+            gather_dictionary(*dataset.dictionary(col), table, begin, end, dst);
+        }
+
+        template<typename T>
+        const T *BasicBlockReader<T>::label() {
+            if (label_view.is_column_major(scalar_dtype<T>::value)) {
+                return (const T *) label_view.data + begin;
+            }
+            if (label_scratch.size() < end - begin) {
+                label_scratch.resize(end - begin);
+            }
+            read_column(label_view, 0, begin, end, label_scratch.data());
+            return label_scratch.data();
+        }
+
+        template<typename T>
+        const T *BasicBlockReader<T>::weight() {
+            if (weight_view.rows == 0) {
+                return nullptr;
+            }
+            if (weight_view.is_column_major(scalar_dtype<T>::value)) {
+                return (const T *) weight_view.data + begin;
+            }
+            if (weight_scratch.size() < end - begin) {
+                weight_scratch.resize(end - begin);
+            }
+            read_column(weight_view, 0, begin, end, weight_scratch.data());
+            return weight_scratch.data();
+        }
+
+        template class BasicBlockReader<float>;
+
+        template class BasicBlockReader<double>;
+
+        static inline uint32_t float_bits(float value) {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+
+        static bool rows_equal(const DataView &dataset, const DataView &label, bool by_label, int i, int j) {
+            float a, b;
+            for (int col = 0; col < dataset.cols; col++) {
+                read_column(dataset, col, i, i + 1, &a);
+                read_column(dataset, col, j, j + 1, &b);
+                if (float_bits(a) != float_bits(b)) {
+                    return false;
+                }
+            }
+            if (by_label) {
+                read_column(label, 0, i, i + 1, &a);
+                read_column(label, 0, j, j + 1, &b);
+                return float_bits(a) == float_bits(b);
+            }
+            return true;
+        }
+
+        row_t collapse_rows(const DataView &dataset, const DataView &label, const DataView &weight, bool by_label,
+                            ColumnStore &store, vector<float> &row_weight, double &residual) {
+            if (dataset.rows > INT_MAX) {
+                return dataset.rows;
+            }
+            int rows = dataset.rows;
+            BlockReader reader(dataset, label, weight);
+
+            // hash of the bit patterns of each row
+            vector<uint64_t> hash(rows, 0x9e3779b97f4a7c15ULL);
+            for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, rows));
+                for (int col = 0; col <= dataset.cols; col++) {
+                    if (col == dataset.cols && !by_label) {
+                        break;
+                    }
+                    const float *values = col < dataset.cols ? reader.column(col) : reader.label();
+                    for (int r = 0; r < reader.block_size(); r++) {
+                        uint64_t h = (hash[begin + r] ^ float_bits(values[r])) * 0xbf58476d1ce4e5b9ULL;
+                        hash[begin + r] = h ^ (h >> 31);
+                    }
+                }
+            }
+
+            // rows with the same hash are compared, the first row of each group represents it
+            vector<int> order(rows);
+            for (int i = 0; i < rows; i++) {
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [&hash](int a, int b) {
+                return hash[a] != hash[b] ? hash[a] < hash[b] : a < b;
+            });
+            vector<int> group_of(rows);
+            vector<int> first_row;
+            for (int run = 0; run < rows;) {
+                int run_end = run;
+                while (run_end < rows && hash[order[run_end]] == hash[order[run]]) {
+                    run_end++;
+                }
+                int run_groups = first_row.size();
+                for (int k = run; k < run_end; k++) {
+                    int i = order[k];
+                    int g = run_groups;
+                    while (g < (int) first_row.size() && !rows_equal(dataset, label, by_label, first_row[g], i)) {
+                        g++;
+                    }
+                    if (g == (int) first_row.size()) {
+                        first_row.push_back(i);
+                    }
+                    group_of[i] = g;
+                }
+                run = run_end;
+            }
+
+            int groups = first_row.size();
+            if (groups == rows) {
+                return rows;
+            }
+
+            // number the groups in the order of their first rows
+            vector<int> rank(groups);
+            for (int g = 0; g < groups; g++) {
+                rank[g] = g;
+            }
+            std::sort(rank.begin(), rank.end(), [&first_row](int a, int b) { return first_row[a] < first_row[b]; });
+            vector<int> renumber(groups);
+            for (int g = 0; g < groups; g++) {
+                renumber[rank[g]] = g;
+            }
+            for (int i = 0; i < rows; i++) {
+                group_of[i] = renumber[group_of[i]];
+            }
+
+            store.resize(groups, dataset.cols);
+            row_weight.assign(groups, 0);
+            vector<double> weight_sum(groups, 0);
+            vector<double> label_sum(groups, 0);
+            float *unique_label = store.label_column();
+            for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, rows));
+                for (int col = 0; col < dataset.cols; col++) {
+                    const float *values = reader.column(col);
+                    float *column = store.column(col);
+                    for (int r = 0; r < reader.block_size(); r++) {
+                        column[group_of[begin + r]] = values[r];
+                    }
+                }
+                const float *y = reader.label();
+                const float *w = reader.weight();
+                for (int r = 0; r < reader.block_size(); r++) {
+                    int g = group_of[begin + r];
+                    double wr = w == nullptr ? 1.0 : w[r];
+                    weight_sum[g] += wr;
+                    label_sum[g] += wr * y[r];
+                    unique_label[g] = y[r];
+                }
+            }
+
+            residual = 0;
+            if (!by_label) {
+                vector<double> mean(groups);
+                for (int g = 0; g < groups; g++) {
+                    mean[g] = weight_sum[g] != 0 ? label_sum[g] / weight_sum[g] : unique_label[g];
+                    unique_label[g] = (float) mean[g];
+                }
+                for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                    reader.seek(begin, min(begin + ROW_BLOCK_SIZE, rows));
+                    const float *y = reader.label();
+                    const float *w = reader.weight();
+                    double block_residual = 0;
+                    for (int r = 0; r < reader.block_size(); r++) {
+                        double diff = y[r] - mean[group_of[begin + r]];
+                        block_residual += (w == nullptr ? 1.0 : w[r]) * diff * diff;
+                    }
+                    residual += block_residual;
+                }
+            }
+            for (int g = 0; g < groups; g++) {
+                row_weight[g] = (float) weight_sum[g];
+            }
+            return groups;
+        }
+    }
+}
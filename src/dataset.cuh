@@ -0,0 +1,578 @@
+#ifndef LUMINOCUGP_DATASET_CUH
+#define LUMINOCUGP_DATASET_CUH
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/**
+ * number of rows in a fixed row block of the CPU evaluator
+ * the loss of each block is reduced by a fixed-shape pairwise tree
+ */
+#define ROW_BLOCK_SIZE 4096
+
+/**
+ * max number of distinct values of a dictionary-encoded column
+ */
+#define DICTIONARY_MAX_ENTRIES 1024
+
+/**
+ * scaled int16 code of a non-finite value, it is decoded as NaN
+ */
+#define INT16_NAN_CODE (-32768)
+
+namespace cusr {
+    namespace data {
+
+        using namespace std;
+
+        /**
+         * row index and row count, a dataset may have more than 2^31 rows
+         */
+        typedef long long row_t;
+
+        typedef enum DataType {
+            float32,
+            float64,
+            float16,
+            bfloat16,
+            int16       // scaled, value = code * scale + offset of the column
+        } dtype_t;
+
+        /**
+         * IEEE half precision <-> float, rounded to nearest even
+         */
+        inline float half_to_float(uint16_t h) {
+            uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+            uint32_t exp = h >> 10 & 0x1f;
+            uint32_t mant = h & 0x3ff;
+            uint32_t bits;
+            if (exp == 0x1f) {
+                bits = sign | 0x7f800000 | mant << 13;
+            } else if (exp != 0) {
+                bits = sign | (exp + 112) << 23 | mant << 13;
+            } else {
+                // zero or subnormal, mant * 2^-24
+                float value = mant * 5.9604644775390625e-8f;
+                memcpy(&bits, &value, sizeof(bits));
+                bits |= sign;
+            }
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        inline uint16_t float_to_half(float value) {
+            uint32_t x;
+            memcpy(&x, &value, sizeof(x));
+            uint32_t sign = x >> 16 & 0x8000;
+            x &= 0x7fffffff;
+            if (x >= 0x7f800000) {
+                return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+            }
+            if (x >= 0x477ff000) {
+                return sign | 0x7c00;
+            }
+            if (x < 0x38800000) {
+                if (x < 0x33000000) {
+                    return sign;
+                }
+                uint32_t mant = (x & 0x7fffff) | 0x800000;
+                int shift = 126 - (int) (x >> 23);
+                uint32_t h = mant >> shift;
+                uint32_t rem = mant & ((1u << shift) - 1);
+                uint32_t half = 1u << (shift - 1);
+                h += rem > half || (rem == half && (h & 1));
+                return sign | h;
+            }
+            uint32_t h = (x >> 13) - (112 << 10);
+            uint32_t rem = x & 0x1fff;
+            h += rem > 0x1000 || (rem == 0x1000 && (h & 1));
+            return sign | h;
+        }
+
+        /**
+         * bfloat16 (the upper half of a float) <-> float, rounded to nearest even
+         */
+        inline float bfloat16_to_float(uint16_t h) {
+            uint32_t bits = (uint32_t) h << 16;
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        inline uint16_t float_to_bfloat16(float value) {
+            uint32_t x;
+            memcpy(&x, &value, sizeof(x));
+            if ((x & 0x7fffffff) > 0x7f800000) {
+                return x >> 16 | 0x40;
+            }
+            x += 0x7fff + (x >> 16 & 1);
+            return x >> 16;
+        }
+
+        /**
+         * dictionary encoding of a low-cardinality column
+         * the value of row r is values[codes[r]], codes are 8-bit if size <= 256 and 16-bit otherwise
+         */
+        struct ColumnDictionary {
+            const float *values = nullptr;
+            const void *codes = nullptr;
+            int size = 0;
+            int code_bytes = 0;     // 0 if the column is not encoded
+        };
+
+        /**
+         * map rows [begin, end) of an encoded column through a table indexed by the codes
+         *
+         * @param dict
+         * @param table values[] or any table with dict.size entries computed from it
+         * @param begin
+         * @param end
+         * @param dst
+         */
+        void gather_dictionary(const ColumnDictionary &dict, const float *table, row_t begin, row_t end, float *dst);
+
+        void gather_dictionary(const ColumnDictionary &dict, const double *table, row_t begin, row_t end, double *dst);
+
+        /**
+         * non-owning view of a caller-owned 2-D buffer
+         * element (row, col) is stored at data + row * row_stride + col * col_stride (in elements)
+         *
+         * row-major:    row_stride = cols, col_stride = 1
+         * column-major: row_stride = 1,    col_stride = rows
+         */
+        struct DataView {
+            const void *data = nullptr;
+            row_t rows = 0;
+            int cols = 0;
+            long row_stride = 0;
+            long col_stride = 0;
+            dtype_t dtype = dtype_t::float32;
+
+            /**
+             * optional dictionary encodings, one per column, the float data of an encoded column is not read
+             */
+            const ColumnDictionary *dictionaries = nullptr;
+
+            /**
+             * per-column scale and offset of a dtype_t::int16 view
+             */
+            const float *scale = nullptr;
+            const float *offset = nullptr;
+
+            /**
+             * optional offset (in elements) of each column from data, instead of col * col_stride
+             */
+            const long *col_offsets = nullptr;
+
+            /**
+             * if or not the columns can be read directly as contiguous float arrays
+             * @return
+             */
+            bool is_float_column_major() const {
+                return is_column_major(dtype_t::float32);
+            }
+
+            /**
+             * if or not the columns can be read directly as contiguous arrays of an element type
+             * @param type
+             * @return
+             */
+            bool is_column_major(dtype_t type) const {
+                return dtype == type && (row_stride == 1 || rows <= 1) && dictionaries == nullptr;
+            }
+
+            /**
+             * dictionary of a column, nullptr if the column is not encoded
+             * @param col
+             * @return
+             */
+            const ColumnDictionary *dictionary(int col) const {
+                return dictionaries != nullptr && dictionaries[col].code_bytes > 0 ? &dictionaries[col] : nullptr;
+            }
+
+            /**
+             * offset (in elements) of the first element of a column from data
+             * @param col
+             * @return
+             */
+            long column_offset(int col) const {
+                return col_offsets != nullptr ? col_offsets[col] : col * col_stride;
+            }
+
+            /**
+             * pointer to the first element of a column (valid if is_float_column_major)
+             * @param col
+             * @return
+             */
+            const float *column(int col) const {
+                return (const float *) data + column_offset(col);
+            }
+        };
+
+        /**
+         * view of a strided buffer
+         *
+         * @param data
+         * @param rows
+         * @param cols
+         * @param row_stride
+         * @param col_stride
+         * @return
+         */
+        DataView make_view(const float *data, row_t rows, int cols, long row_stride, long col_stride);
+
+        DataView make_view(const double *data, row_t rows, int cols, long row_stride, long col_stride);
+
+        /**
+         * view of a row-major buffer
+         */
+        DataView make_row_major_view(const float *data, row_t rows, int cols);
+
+        DataView make_row_major_view(const double *data, row_t rows, int cols);
+
+        /**
+         * view of a column-major buffer
+         */
+        DataView make_column_major_view(const float *data, row_t rows, int cols);
+
+        DataView make_column_major_view(const double *data, row_t rows, int cols);
+
+        /**
+         * view of a vector (e.g., the label), which is a single column
+         */
+        DataView make_vector_view(const float *data, row_t size);
+
+        DataView make_vector_view(const double *data, row_t size);
+
+        /**
+         * read rows [begin, end) of a column into dst as floats
+         *
+         * @param view
+         * @param col
+         * @param begin
+         * @param end
+         * @param dst
+         */
+        void read_column(const DataView &view, int col, row_t begin, row_t end, float *dst);
+
+        void read_column(const DataView &view, int col, row_t begin, row_t end, double *dst);
+
+        /**
+         * if or not column col is set in a bitset of columns (e.g., the variables referenced by a population)
+         * @param bits
+         * @param col
+         * @return
+         */
+        inline bool test_column(const vector<unsigned long long> &bits, int col) {
+            return (size_t) (col >> 6) < bits.size() && (bits[col >> 6] >> (col & 63) & 1ULL);
+        }
+
+        /**
+         * read-only mapping of a whole file
+         * the file is read into memory where mmap is unavailable
+         */
+        class MappedFile {
+        public:
+
+            MappedFile() = default;
+
+            ~MappedFile();
+
+            MappedFile(const MappedFile &) = delete;
+
+            MappedFile &operator=(const MappedFile &) = delete;
+
+            /**
+             * @param path
+             * @return if or not the file is mapped
+             */
+            bool open(const string &path);
+
+            void close();
+
+            const char *data() const { return base; }
+
+            size_t size() const { return length; }
+
+            /**
+             * hint that the bytes [offset, offset + length) will be needed soon, or can be dropped from memory
+             * @param offset
+             * @param length
+             * @param needed
+             */
+            void advise(size_t offset, size_t length, bool needed) const;
+
+        private:
+            const char *base = nullptr;
+            size_t length = 0;
+            vector<char> buffer;
+        };
+
+        /**
+         * dtype_t of a scalar type
+         */
+        template<typename T>
+        struct scalar_dtype {
+            static const dtype_t value = sizeof(T) == sizeof(double) ? dtype_t::float64 : dtype_t::float32;
+        };
+
+        /**
+         * owned column-major storage of a dataset and its label, T is float or double
+         * each column is 64-byte aligned, the label is stored after the last column.
+         * an in-memory store holds at most INT_MAX rows, larger datasets are read through views of
+         * memory-mapped files (ColumnarFile) or streamed in chunks (ChunkStream)
+         */
+        template<typename T>
+        class BasicColumnStore {
+        public:
+
+            /**
+             * allocate rows x cols features and a label column, the contents are undefined.
+             * the elements are not initialized, so the pages are first touched by the threads that fill them,
+             * and the allocation is reused if it is large enough
+             * @param rows
+             * @param cols
+             */
+            void resize(int rows, int cols);
+
+            /**
+             * allocate only the feature columns in the bitset and the label column,
+             * the other feature columns share one column of undefined contents
+             * @param rows
+             * @param cols
+             * @param used
+             */
+            void resize(int rows, int cols, const vector<unsigned long long> &used);
+
+            /**
+             * keep the first rows rows
+             * @param rows
+             */
+            void truncate(int rows);
+
+            /**
+             * release the storage
+             */
+            void clear();
+
+            /**
+             * release the feature and label columns, the dictionaries of the encoded columns are kept
+             */
+            void release_columns();
+
+            /**
+             * dictionary-encode the feature columns with at most max_entries distinct values
+             * (and at least 4 rows per entry), the views returned by dataset() then carry the dictionaries,
+             * the float columns are kept unchanged. double stores are not encoded
+             *
+             * @param max_entries
+             * @return number of encoded columns
+             */
+            int encode_dictionaries(int max_entries = DICTIONARY_MAX_ENTRIES);
+
+            T *column(int col) { return base + (offsets.empty() ? col * stride : offsets[col]); }
+
+            const T *column(int col) const { return base + (offsets.empty() ? col * stride : offsets[col]); }
+
+            T *label_column() { return column(cols); }
+
+            DataView dataset() const;
+
+            DataView label() const;
+
+            int rows = 0;
+            int cols = 0;
+
+        private:
+            unique_ptr<T[]> buffer;
+            size_t capacity = 0;
+            T *base = nullptr;
+            long stride = 0;
+            vector<long> offsets;   // offset of each column and the label if not all columns are allocated
+            vector<ColumnDictionary> dictionaries;
+            vector<vector<float>> dictionary_values;
+            vector<vector<unsigned char>> dictionary_codes;
+        };
+
+        typedef BasicColumnStore<float> ColumnStore;
+
+        typedef BasicColumnStore<double> DoubleColumnStore;
+
+        /**
+         * owned column-major storage of a dataset and its label in 16-bit elements
+         * (dtype_t::float16, dtype_t::bfloat16 or scaled dtype_t::int16), half the size of a ColumnStore.
+         * the BlockReader converts the columns of each row block to floats, so the evaluators read half the bytes
+         *
+         * PackedStore packed;
+         * packed.pack(store.dataset(), store.label(), dtype_t::bfloat16);
+         * store.clear();
+         * reg.fit(packed.dataset(), packed.label());
+         */
+        class PackedStore {
+        public:
+
+            /**
+             * convert a dataset and its label, int16 columns are scaled to the range of their finite values,
+             * non-finite values become NaN
+             *
+             * @param dataset
+             * @param label
+             * @param dtype
+             * @return false if dtype is not a 16-bit type or the dataset has more than INT_MAX rows
+             */
+            bool pack(const DataView &dataset, const DataView &label, dtype_t dtype);
+
+            /**
+             * convert a dataset of separately allocated rows and its label, one column at a time,
+             * so only one column is held in float32 besides the packed columns.
+             * low-cardinality columns are dictionary-encoded from the float values as by
+             * ColumnStore::encode_dictionaries, and the views returned by dataset() carry the dictionaries
+             *
+             * @param dataset rows of the same length
+             * @param label
+             * @param dtype
+             * @param encode_dictionaries
+             * @return false if dtype is not a 16-bit type or the dataset has more than INT_MAX rows
+             */
+            bool pack(const vector<vector<float>> &dataset, const vector<float> &label, dtype_t dtype,
+                      bool encode_dictionaries);
+
+            void clear();
+
+            DataView dataset() const;
+
+            DataView label() const;
+
+            int rows = 0;
+            int cols = 0;
+
+        private:
+            dtype_t dtype = dtype_t::float16;
+            vector<uint16_t> buffer;
+            uint16_t *base = nullptr;
+            long stride = 0;
+            vector<float> scale;
+            vector<float> offset;
+            vector<ColumnDictionary> dictionaries;
+            vector<vector<float>> dictionary_values;
+            vector<vector<unsigned char>> dictionary_codes;
+
+            bool allocate(row_t rows, int cols, dtype_t dtype);
+
+            void pack_column(const DataView &view, int col, int dst_col);
+        };
+
+        /**
+         * provides the columns of a row block as contiguous arrays of T (float or double)
+         * columns are read from the view directly if the layout and the element type are suitable,
+         * otherwise they are transposed / converted on demand into scratch buffers
+         */
+        template<typename T>
+        class BasicBlockReader {
+        public:
+
+            /**
+             * @param dataset
+             * @param label
+             * @param weight per-row weights, an empty view means every row has weight 1
+             */
+            BasicBlockReader(const DataView &dataset, const DataView &label, const DataView &weight = DataView());
+
+            /**
+             * move to rows [begin, end)
+             * @param begin
+             * @param end
+             */
+            void seek(row_t begin, row_t end);
+
+            /**
+             * column of the current block
+             * @param col
+             * @return
+             */
+            const T *column(int col);
+
+            /**
+             * dictionary of a column, nullptr if the column is not encoded
+             * @param col
+             * @return
+             */
+            const ColumnDictionary *dictionary(int col) const { return dataset.dictionary(col); }
+
+            /**
+             * values of the dictionary of a column as T
+             * @param col
+             * @return
+             */
+            const T *dictionary_values(int col);
+
+            /**
+             * map the rows of the current block through a table computed from the dictionary of a column
+             * @param col
+             * @param table
+             * @param dst
+             */
+            void gather(int col, const T *table, T *dst) const;
+
+            /**
+             * label of the current block
+             * @return
+             */
+            const T *label();
+
+            /**
+             * weights of the current block, nullptr if the rows are not weighted
+             * @return
+             */
+            const T *weight();
+
+            row_t block_begin() const { return begin; }
+
+            int block_size() const { return (int) (end - begin); }
+
+        private:
+            const DataView &dataset;
+            const DataView &label_view;
+            DataView weight_view;
+            row_t begin = 0;
+            row_t end = 0;
+            int stamp = 0;
+            bool direct = false;
+            vector<vector<T>> scratch;
+            vector<int> loaded;
+            vector<T> label_scratch;
+            vector<T> weight_scratch;
+            vector<vector<T>> dictionary_scratch;
+        };
+
+        typedef BasicBlockReader<float> BlockReader;
+
+        typedef BasicBlockReader<double> DoubleBlockReader;
+
+        /**
+         * collapse rows with identical features (and identical labels if by_label) into unique rows,
+         * in the order of their first occurrence, with the weight sum of the rows they replace.
+         * without by_label, the label of a unique row is the weighted mean of its labels,
+         * and residual is the weighted sum of squared deviations from those means, so that
+         * sum_i w_i * (f - y_i)^2 = sum_u w_u * (f - mean_u)^2 + residual
+         *
+         * @param dataset
+         * @param label
+         * @param weight per-row weights, an empty view means every row has weight 1
+         * @param by_label
+         * @param store unique rows and their labels
+         * @param row_weight weight of each unique row
+         * @param residual
+         * @return number of unique rows, the store is only filled if it is less than the number of rows
+         *         (datasets with more than INT_MAX rows are not collapsed)
+         */
+        row_t collapse_rows(const DataView &dataset, const DataView &label, const DataView &weight, bool by_label,
+                            ColumnStore &store, vector<float> &row_weight, double &residual);
+    }
+}
+#endif //LUMINOCUGP_DATASET_CUH
@@ -6,43 +6,94 @@ namespace cusr {
         using namespace program;
         using namespace std;
 
-        void copyDatasetAndLabel(GPUDataset *dataset_struct, vector<vector<float>> &dataset, vector<float> &label) {
-            dataset_struct->dataset_size = dataset.size();
-
-            // format dataset into column-major
-            int data_size = dataset.size();
-            int variable_num = dataset[0].size();
-
-            vector<float> device_dataset;
-
-            for (int i = 0; i < variable_num; i++) {
-                for (int j = 0; j < data_size; j++) {
-                    device_dataset.emplace_back(dataset[j][i]);
+        static float *copyVectorToDevice(const DataView &vec) {
+            row_t data_size = vec.rows;
+            float *device_arr;
+            cudaMalloc((void **) &device_arr, sizeof(float) * data_size);
+
+            if (vec.is_float_column_major()) {
+                cudaMemcpy(device_arr, vec.column(0), sizeof(float) * data_size, cudaMemcpyHostToDevice);
+            } else {
+                vector<float> staging(min(data_size, (row_t) STAGING_ROWS));
+                for (row_t begin = 0; begin < data_size; begin += STAGING_ROWS) {
+                    row_t end = min(begin + STAGING_ROWS, data_size);
+                    read_column(vec, 0, begin, end, staging.data());
+                    cudaMemcpy(device_arr + begin, staging.data(), sizeof(float) * (end - begin),
+                               cudaMemcpyHostToDevice);
                 }
             }
+            return device_arr;
+        }
+
+        void copyDatasetAndLabel(GPUDataset *dataset_struct, const DataView &dataset, const DataView &label,
+                                 const DataView &weight, double weightSum, double lossOffset) {
+            dataset_struct->dataset_size = dataset.rows;
+            dataset_struct->weight_sum = weightSum;
+            dataset_struct->loss_offset = lossOffset;
+
+            // dataset will be in column-major storage in the device side
+            row_t data_size = dataset.rows;
+            int variable_num = dataset.cols;
 
             // copy dataset
             float *device_dataset_arr;
             size_t dataset_pitch;
             cudaMallocPitch((void **) &device_dataset_arr, &dataset_pitch, sizeof(float) * data_size, variable_num);
-            cudaMemcpy2D(device_dataset_arr, dataset_pitch, thrust::raw_pointer_cast(device_dataset.data()),
-                         sizeof(float) * data_size, sizeof(float) * data_size, variable_num, cudaMemcpyHostToDevice);
+
+            if (dataset.is_float_column_major() && dataset.col_offsets == nullptr &&
+                (variable_num == 1 || dataset.col_stride >= data_size)) {
+                // the host buffer is already in the required layout
+                size_t host_pitch = variable_num == 1 ? sizeof(float) * data_size : sizeof(float) * dataset.col_stride;
+                cudaMemcpy2D(device_dataset_arr, dataset_pitch, dataset.column(0), host_pitch,
+                             sizeof(float) * data_size, variable_num, cudaMemcpyHostToDevice);
+            } else {
+                // transpose blocks of each column on the fly
+                vector<float> staging(min(data_size, (row_t) STAGING_ROWS));
+                for (int col = 0; col < variable_num; col++) {
+                    for (row_t begin = 0; begin < data_size; begin += STAGING_ROWS) {
+                        row_t end = min(begin + STAGING_ROWS, data_size);
+                        read_column(dataset, col, begin, end, staging.data());
+                        cudaMemcpy((char *) device_dataset_arr + col * dataset_pitch + sizeof(float) * begin,
+                                   staging.data(), sizeof(float) * (end - begin), cudaMemcpyHostToDevice);
+                    }
+                }
+            }
 
             dataset_struct->dataset_pitch = dataset_pitch;
             dataset_struct->dataset = device_dataset_arr;
 
-            // copy label set
-            float *device_label_arr;
-            cudaMalloc((void **) &device_label_arr, sizeof(float) * data_size);
-            cudaMemcpy(device_label_arr, thrust::raw_pointer_cast(label.data()), sizeof(float) * data_size,
-                       cudaMemcpyHostToDevice);
+            // weighted sums of the label and its square for linear scaling
+            PairwiseSum label_sum, label_square_sum;
+            vector<double> label_block(min(data_size, (row_t) ROW_BLOCK_SIZE));
+            vector<double> weight_block(weight.rows > 0 ? label_block.size() : 0);
+            for (row_t begin = 0; begin < data_size; begin += ROW_BLOCK_SIZE) {
+                row_t end = min(begin + ROW_BLOCK_SIZE, data_size);
+                read_column(label, 0, begin, end, label_block.data());
+                if (weight.rows > 0) {
+                    read_column(weight, 0, begin, end, weight_block.data());
+                }
+                double block_sum = 0;
+                double block_square_sum = 0;
+                for (int i = 0; i < end - begin; i++) {
+                    double w = weight.rows > 0 ? weight_block[i] : 1.0;
+                    block_sum += w * label_block[i];
+                    block_square_sum += w * label_block[i] * label_block[i];
+                }
+                label_sum.add(block_sum);
+                label_square_sum.add(block_square_sum);
+            }
+            dataset_struct->label_sum = label_sum.result();
+            dataset_struct->label_square_sum = label_square_sum.result();
 
-            dataset_struct->label = device_label_arr;
+            // copy label set and weights
+            dataset_struct->label = copyVectorToDevice(label);
+            dataset_struct->weight = weight.rows > 0 ? copyVectorToDevice(weight) : nullptr;
         }
 
         void freeDataSetAndLabel(GPUDataset *dataset_struct) {
             cudaFree(dataset_struct->dataset);
             cudaFree(dataset_struct->label);
+            cudaFree(dataset_struct->weight);
         }
 
         __constant__ float d_nodeValue[MAX_PREFIX_LEN];
@@ -51,15 +102,14 @@ namespace cusr {
 #define S_OFF THREAD_PER_BLOCK * (DEPTH + 1) * blockIdx.x + top * THREAD_PER_BLOCK + threadIdx.x
 
         __global__ void
-        calFitnessGPU_MSE(int len, float *ds, int dsPitch, float *label, float *stack, float *result,
-                          int dataset_size) {
-            extern __shared__ float shared[];
-            shared[threadIdx.x] = 0;
-
-            // each thread is responsible for one datapoint
-            int dataset_no = blockIdx.x * THREAD_PER_BLOCK + threadIdx.x;
-
-            if (dataset_no < dataset_size) {
+        calFitnessGPU_MSE(int len, float *ds, size_t dsPitch, float *label, float *weight, float *stack,
+                          double *result, long long dataset_size) {
+            extern __shared__ double loss_shared[];
+
+            // each thread is responsible for every (gridDim.x * THREAD_PER_BLOCK)-th datapoint
+            double thread_loss = 0;
+            for (long long dataset_no = blockIdx.x * (long long) THREAD_PER_BLOCK + threadIdx.x;
+                 dataset_no < dataset_size; dataset_no += (long long) gridDim.x * THREAD_PER_BLOCK) {
                 int top = 0;
 
                 // do stack operation according to the type of each node
@@ -139,44 +189,31 @@ namespace cusr {
                 float label_value = label[dataset_no];
                 float loss = prefix_value - label_value;
                 float fitness = loss * loss;
-                shared[threadIdx.x] = fitness;
+                thread_loss += weight == nullptr ? fitness : weight[dataset_no] * fitness;
             }
+            loss_shared[threadIdx.x] = thread_loss;
 
             __syncthreads();
 
-            // do parallel reduction
-#if THREAD_PER_BLOCK >= 1024
-            if (threadIdx.x < 512) { shared[threadIdx.x] += shared[threadIdx.x + 512]; }
-            __syncthreads();
-#endif
-#if THREAD_PER_BLOCK >= 512
-            if (threadIdx.x < 256) { shared[threadIdx.x] += shared[threadIdx.x + 256]; }
-            __syncthreads();
-#endif
-            if (threadIdx.x < 128) { shared[threadIdx.x] += shared[threadIdx.x + 128]; }
-            __syncthreads();
-            if (threadIdx.x < 64) { shared[threadIdx.x] += shared[threadIdx.x + 64]; }
-            __syncthreads();
-            if (threadIdx.x < 32) { shared[threadIdx.x] += shared[threadIdx.x + 32]; }
-            if (threadIdx.x < 16) { shared[threadIdx.x] += shared[threadIdx.x + 16]; }
-            if (threadIdx.x < 8) { shared[threadIdx.x] += shared[threadIdx.x + 8]; }
-            if (threadIdx.x < 4) { shared[threadIdx.x] += shared[threadIdx.x + 4]; }
-            if (threadIdx.x < 2) { shared[threadIdx.x] += shared[threadIdx.x + 2]; }
-            if (threadIdx.x < 1) {
-                shared[threadIdx.x] += shared[threadIdx.x + 1];
-//                result[blockIdx.x] = shared[0] / THREAD_PER_BLOCK;
-                result[blockIdx.x] = shared[0];
+            // do parallel reduction in double, the partial sums of the blocks are reduced on the host
+            for (int width = THREAD_PER_BLOCK / 2; width > 0; width /= 2) {
+                if (threadIdx.x < width) {
+                    loss_shared[threadIdx.x] += loss_shared[threadIdx.x + width];
+                }
+                __syncthreads();
+            }
+            if (threadIdx.x == 0) {
+                result[blockIdx.x] = loss_shared[0];
             }
         }
 
         __global__ void
-        calFitnessGPU_MAE(int len, float *ds, int dsPitch, float *label, float *stack, float *result,
-                          int dataset_size) {
-            extern __shared__ float shared[];
-            shared[threadIdx.x] = 0;
-            int dataset_no = blockIdx.x * THREAD_PER_BLOCK + threadIdx.x;
-
-            if (dataset_no < dataset_size) {
+        calFitnessGPU_MAE(int len, float *ds, size_t dsPitch, float *label, float *weight, float *stack,
+                          double *result, long long dataset_size) {
+            extern __shared__ double loss_shared[];
+            double thread_loss = 0;
+            for (long long dataset_no = blockIdx.x * (long long) THREAD_PER_BLOCK + threadIdx.x;
+                 dataset_no < dataset_size; dataset_no += (long long) gridDim.x * THREAD_PER_BLOCK) {
                 int top = 0;
 
                 // do stack operation according to the type of the node
@@ -255,34 +292,135 @@ namespace cusr {
                 float label_value = label[dataset_no];
                 float loss = prefix_value - label_value;
                 float fitness = loss >= 0 ? loss : -loss;
-                shared[threadIdx.x] = fitness;
+                thread_loss += weight == nullptr ? fitness : weight[dataset_no] * fitness;
             }
+            loss_shared[threadIdx.x] = thread_loss;
 
             __syncthreads();
 
-            // do parallel reduction
-#if THREAD_PER_BLOCK >= 1024
-            if (threadIdx.x < 512) { shared[threadIdx.x] += shared[threadIdx.x + 512]; }
-            __syncthreads();
-#endif
+            // do parallel reduction in double, the partial sums of the blocks are reduced on the host
+            for (int width = THREAD_PER_BLOCK / 2; width > 0; width /= 2) {
+                if (threadIdx.x < width) {
+                    loss_shared[threadIdx.x] += loss_shared[threadIdx.x + width];
+                }
+                __syncthreads();
+            }
+            if (threadIdx.x == 0) {
+                result[blockIdx.x] = loss_shared[0];
+            }
+        }
 
-#if THREAD_PER_BLOCK >= 512
-            if (threadIdx.x < 256) { shared[threadIdx.x] += shared[threadIdx.x + 256]; }
-            __syncthreads();
-#endif
+        __global__ void
+        calMomentsGPU(int len, float *ds, size_t dsPitch, float *label, float *weight, float *stack,
+                      double *result, long long dataset_size) {
+            extern __shared__ double moment_shared[];
+
+            // weighted sums of f, f * f and f * y, the sums of the labels are known on the host
+            double thread_f = 0;
+            double thread_ff = 0;
+            double thread_fy = 0;
+            for (long long dataset_no = blockIdx.x * (long long) THREAD_PER_BLOCK + threadIdx.x;
+                 dataset_no < dataset_size; dataset_no += (long long) gridDim.x * THREAD_PER_BLOCK) {
+                int top = 0;
+
+                // do stack operation according to the type of the node
+                for (int i = len - 1; i >= 0; i--) {
+                    int node_type = d_nodeType[i];
+                    float node_value = d_nodeValue[i];
+
+                    if (node_type == NodeType::CONST) {
+                        stack[S_OFF] = node_value;
+                        top++;
+                    } else if (node_type == NodeType::VAR) {
+                        int var_num = node_value;
+                        stack[S_OFF] = ((float *) ((char *) ds + var_num * dsPitch))[dataset_no];
+                        top++;
+                    } else if (node_type == NodeType::UFUNC) {
+                        int function = node_value;
+                        top--;
+                        float var1 = stack[S_OFF];
+                        if (function == Function::SIN) {
+                            stack[S_OFF] = std::sin(var1);
+                            top++;
+                        } else if (function == Function::COS) {
+                            stack[S_OFF] = std::cos(var1);
+                            top++;
+                        } else if (function == Function::TAN) {
+                            stack[S_OFF] = std::tan(var1);
+                            top++;
+                        } else if (function == Function::LOG) {
+                            if (var1 <= 0) {
+                                stack[S_OFF] = -1.0f;
+                                top++;
+                            } else {
+                                stack[S_OFF] = std::log(var1);
+                                top++;
+                            }
+                        } else if (function == Function::INV) {
+                            if (var1 == 0) {
+                                var1 = DELTA;
+                            }
+                            stack[S_OFF] = 1.0f / var1;
+                            top++;
+                        }
+                    } else {
+                        int function = node_value;
+                        top--;
+                        float var1 = stack[S_OFF];
+                        top--;
+                        float var2 = stack[S_OFF];
+                        if (function == Function::ADD) {
+                            stack[S_OFF] = var1 + var2;
+                            top++;
+                        } else if (function == Function::SUB) {
+                            stack[S_OFF] = var1 - var2;
+                            top++;
+                        } else if (function == Function::MUL) {
+                            stack[S_OFF] = var1 * var2;
+                            top++;
+                        } else if (function == Function::DIV) {
+                            if (var2 == 0) {
+                                var2 = DELTA;
+                            }
+                            stack[S_OFF] = var1 / var2;
+                            top++;
+                        } else if (function == Function::MAX) {
+                            stack[S_OFF] = var1 >= var2 ? var1 : var2;
+                            top++;
+                        } else if (function == Function::MIN) {
+                            stack[S_OFF] = var1 <= var2 ? var1 : var2;
+                            top++;
+                        }
+                    }
+                }
+
+                top--;
+                double f = stack[S_OFF];
+                double w = weight == nullptr ? 1.0 : weight[dataset_no];
+                thread_f += w * f;
+                thread_ff += w * f * f;
+                thread_fy += w * f * label[dataset_no];
+            }
+            moment_shared[threadIdx.x] = thread_f;
+            moment_shared[THREAD_PER_BLOCK + threadIdx.x] = thread_ff;
+            moment_shared[2 * THREAD_PER_BLOCK + threadIdx.x] = thread_fy;
 
-            if (threadIdx.x < 128) { shared[threadIdx.x] += shared[threadIdx.x + 128]; }
-            __syncthreads();
-            if (threadIdx.x < 64) { shared[threadIdx.x] += shared[threadIdx.x + 64]; }
             __syncthreads();
-            if (threadIdx.x < 32) { shared[threadIdx.x] += shared[threadIdx.x + 32]; }
-            if (threadIdx.x < 16) { shared[threadIdx.x] += shared[threadIdx.x + 16]; }
-            if (threadIdx.x < 8) { shared[threadIdx.x] += shared[threadIdx.x + 8]; }
-            if (threadIdx.x < 4) { shared[threadIdx.x] += shared[threadIdx.x + 4]; }
-            if (threadIdx.x < 2) { shared[threadIdx.x] += shared[threadIdx.x + 2]; }
-            if (threadIdx.x < 1) {
-                shared[threadIdx.x] += shared[threadIdx.x + 1];
-                result[blockIdx.x] = shared[0];
+
+            // do parallel reduction of the three sums
+            for (int width = THREAD_PER_BLOCK / 2; width > 0; width /= 2) {
+                if (threadIdx.x < width) {
+                    for (int k = 0; k < 3; k++) {
+                        moment_shared[k * THREAD_PER_BLOCK + threadIdx.x] +=
+                                moment_shared[k * THREAD_PER_BLOCK + threadIdx.x + width];
+                    }
+                }
+                __syncthreads();
+            }
+            if (threadIdx.x == 0) {
+                for (int k = 0; k < 3; k++) {
+                    result[3 * blockIdx.x + k] = moment_shared[k * THREAD_PER_BLOCK];
+                }
             }
         }
 
@@ -296,7 +434,8 @@ namespace cusr {
         }
 
         void calSingleProgram(GPUDataset &dataset, int blockNum, Program &program,
-                              float *stack, float *result, float *h_res, metric_t metric) {
+                              float *stack, double *result, double *h_res, metric_t metric,
+                              double *moments, double *h_moments) {
 
             // --------- restrict the length of prefix ---------
             assert(program.length < MAX_PREFIX_LEN);
@@ -322,54 +461,84 @@ namespace cusr {
             cudaMemcpyToSymbol(d_nodeType, h_nodeType, sizeof(float) * program.length);
 
             // -------- calculation and synchronization --------
+            if (moments != nullptr) {
+                calMomentsGPU<<<blockNum, THREAD_PER_BLOCK, sizeof(double) * 3 * THREAD_PER_BLOCK>>>
+                        (program.length, dataset.dataset, dataset.dataset_pitch, dataset.label, dataset.weight,
+                         stack, moments, dataset.dataset_size);
+                cudaDeviceSynchronize();
+
+                cudaMemcpy(h_moments, moments, sizeof(double) * 3 * blockNum, cudaMemcpyDeviceToHost);
+                PairwiseSum f, ff, fy;
+                for (int i = 0; i < blockNum; i++) {
+                    f.add(h_moments[3 * i]);
+                    ff.add(h_moments[3 * i + 1]);
+                    fy.add(h_moments[3 * i + 2]);
+                }
+                ScalingMoments total;
+                total.w = dataset.weight_sum;
+                total.f = f.result();
+                total.ff = ff.result();
+                total.fy = fy.result();
+                total.y = dataset.label_sum;
+                total.yy = dataset.label_square_sum;
+                double loss = linear_scaling_loss(total, program);
+                program.fitness = loss_to_fitness(loss + dataset.loss_offset, dataset.weight_sum, metric);
+                return;
+            }
+
             if (metric == metric_t::mean_absolute_error) {
-                calFitnessGPU_MAE<<<blockNum, THREAD_PER_BLOCK, sizeof(float) * THREAD_PER_BLOCK>>>
-                        (program.length, dataset.dataset, dataset.dataset_pitch, dataset.label, stack, result,
-                         dataset.dataset_size);
+                calFitnessGPU_MAE<<<blockNum, THREAD_PER_BLOCK, sizeof(double) * THREAD_PER_BLOCK>>>
+                        (program.length, dataset.dataset, dataset.dataset_pitch, dataset.label, dataset.weight,
+                         stack, result, dataset.dataset_size);
                 cudaDeviceSynchronize();
             } else if (metric == metric_t::mean_square_error || metric == metric_t::root_mean_square_error) {
-                calFitnessGPU_MSE<<<blockNum, THREAD_PER_BLOCK, sizeof(float) * THREAD_PER_BLOCK >>>
-                        (program.length, dataset.dataset, dataset.dataset_pitch, dataset.label, stack, result,
-                         dataset.dataset_size);
+                calFitnessGPU_MSE<<<blockNum, THREAD_PER_BLOCK, sizeof(double) * THREAD_PER_BLOCK>>>
+                        (program.length, dataset.dataset, dataset.dataset_pitch, dataset.label, dataset.weight,
+                         stack, result, dataset.dataset_size);
                 cudaDeviceSynchronize();
             }
 
             // -------- reduction on the result --------
-            cudaMemcpy(h_res, result, sizeof(float) * blockNum, cudaMemcpyDeviceToHost);
-            float ans = 0;
+            cudaMemcpy(h_res, result, sizeof(double) * blockNum, cudaMemcpyDeviceToHost);
+            PairwiseSum total;
 
             for (int i = 0; i < blockNum; i++) {
-                ans += h_res[i];
-            }
-
-            if (metric == metric_t::mean_absolute_error || metric == metric_t::mean_square_error) {
-                program.fitness = ans / (float) dataset.dataset_size;
-            } else if (metric == metric_t::root_mean_square_error) {
-                program.fitness = std::sqrt(ans / (float) dataset.dataset_size);
+                total.add(h_res[i]);
             }
+            program.fitness = loss_to_fitness(total.result() + dataset.loss_offset, dataset.weight_sum, metric);
         }
 
-        void
-        calculatePopulationFitness(GPUDataset &dataset, int blockNum, vector<Program> &population, metric_t metric) {
+        void calculatePopulationFitness(GPUDataset &dataset, int blockNum, vector<Program> &population,
+                                        metric_t metric, bool linearScaling) {
             // allocate space for result
-            float *result;
-            cudaMalloc((void **) &result, sizeof(float) * blockNum);
+            double *result;
+            cudaMalloc((void **) &result, sizeof(double) * blockNum);
+
+            // per-block scaling moments
+            double *moments = nullptr;
+            double *h_moments = nullptr;
+            if (linearScaling) {
+                cudaMalloc((void **) &moments, sizeof(double) * 3 * blockNum);
+                h_moments = new double[3 * blockNum];
+            }
 
             // allocate stack space
             float *stack = mallocStack(blockNum);
 
             // save result and do CPU side reduction
-            float *h_res = new float[blockNum];
+            double *h_res = new double[blockNum];
 
             // evaluate fitness for each program in the population
             for (int i = 0; i < population.size(); i++) {
-                calSingleProgram(dataset, blockNum, population[i], stack, result, h_res, metric);
+                calSingleProgram(dataset, blockNum, population[i], stack, result, h_res, metric, moments, h_moments);
             }
 
             // free memory space
             cudaFree(result);
             cudaFree(stack);
+            cudaFree(moments);
             delete[] h_res;
+            delete[] h_moments;
         }
     }
 }
\ No newline at end of file
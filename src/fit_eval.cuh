@@ -14,6 +14,17 @@
 #define MAX_PREFIX_LEN 2048
 #define DEPTH 18
 
+/**
+ * number of rows per host-to-device copy when the host dataset has to be transposed
+ */
+#define STAGING_ROWS (1 << 20)
+
+/**
+ * max number of thread blocks of a fitness kernel, each thread evaluates every (blocks * THREAD_PER_BLOCK)-th row
+ * beyond this, so the stack space does not grow with the number of rows
+ */
+#define MAX_GRID_BLOCKS 4096
+
 namespace cusr {
     namespace fit {
 
@@ -25,24 +36,31 @@ namespace cusr {
             float *dataset;
             size_t dataset_pitch;
             float *label;
-            int dataset_size;
+            float *weight;          // nullptr if the rows are not weighted
+            long long dataset_size;
+            double weight_sum;      // the fitness is (loss sum + loss_offset) / weight_sum
+            double loss_offset;
+            double label_sum;       // weighted sums of the label and its square
+            double label_square_sum;
         };
 
         /**
          * copy dataset from host side to device side
-         * host side dataset:  x0, x1, .., xn
-         *                     x0, x1, .., xn
-         *                     .., .., .., ..
-         *                     x0, x1, .., xn
+         * host side dataset:  a view of any layout (see DataView)
          *
          * predicted value:    y0, y1, .., ym
          * the length of predicted value equals to the length of dataset
-         * dataset will be in column-major storage in the device side to perform coalesced memory access
+         * dataset will be in column-major storage in the device side to perform coalesced memory access,
+         * a float column-major host buffer is copied directly, other layouts are transposed block by block
          * @param dsStruct
          * @param dataset
          * @param label
+         * @param weight per-row weights, an empty view if the rows are not weighted
+         * @param weightSum number of rows, or the sum of the weights of the original rows
+         * @param lossOffset constant loss of the rows that are collapsed into the dataset
          */
-        void copyDatasetAndLabel(GPUDataset *dsStruct, vector<vector<float>> &dataset, vector<float> &label);
+        void copyDatasetAndLabel(GPUDataset *dsStruct, const DataView &dataset, const DataView &label,
+                                 const DataView &weight, double weightSum, double lossOffset);
 
         /**
          * free data structure on the device side.
@@ -56,9 +74,10 @@ namespace cusr {
          * @param blockNum
          * @param population
          * @param metric
+         * @param linearScaling if or not the fitness is the squared error of the linearly scaled output
          */
-        void
-        calculatePopulationFitness(GPUDataset &dataset, int blockNum, vector<Program> &population, metric_t metric);
+        void calculatePopulationFitness(GPUDataset &dataset, int blockNum, vector<Program> &population,
+                                        metric_t metric, bool linearScaling = false);
     }
 }
 #endif //LUMINOCUGP_FIT_EVAL_CUH
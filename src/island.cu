@@ -0,0 +1,281 @@
+#include "island.cuh"
+#include "socket.cuh"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <unistd.h>
+
+namespace cusr {
+    namespace program {
+
+        using namespace net;
+
+        /**
+         * message types between island processes and the coordinator
+         */
+        typedef enum MigrationMessage {
+            MIGRANT = 1,   // an encoded program, both directions
+            STOP = 2,      // an island reached the stopping criteria, both directions
+            LEAVE = 3      // island to coordinator, with the encoded final best program of the island
+        } migration_message_t;
+
+        MigrationNetwork::MigrationNetwork(int islands, topology_t topology, int capacity)
+                : islands(islands), topology(topology), queues((size_t) islands * islands) {
+            assert(islands > 1 && capacity > 0);
+            for (int from = 0; from < islands; from++) {
+                for (int to = 0; to < islands; to++) {
+                    bool is_edge = topology == Topology::ring ? to == (from + 1) % islands : to != from;
+                    if (is_edge) {
+                        queues[(size_t) from * islands + to].reset(new SpscQueue<Program>(capacity));
+                    }
+                }
+            }
+        }
+
+        bool MigrationNetwork::send(int from, const Program &program) {
+            int to;
+            if (topology == Topology::ring) {
+                to = (from + 1) % islands;
+            } else {
+                to = gen_rand_int(0, islands - 2);
+                to += to >= from;
+            }
+            return queues[(size_t) from * islands + to]->push(program);
+        }
+
+        bool MigrationNetwork::receive(int to, Program &program) {
+            if (topology == Topology::ring) {
+                return queues[(size_t) ((to + islands - 1) % islands) * islands + to]->pop(program);
+            }
+            for (int from = 0; from < islands; from++) {
+                if (from != to && queues[(size_t) from * islands + to]->pop(program)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void MigrationNetwork::stop() {
+            stop_flag.store(true, memory_order_relaxed);
+        }
+
+        bool MigrationNetwork::stopped() const {
+            return stop_flag.load(memory_order_relaxed);
+        }
+
+        RemoteMigration::~RemoteMigration() {
+            disconnect();
+        }
+
+        bool RemoteMigration::connect(const string &address) {
+            disconnect();
+            this->fd = connect_socket(address);
+            return fd >= 0;
+        }
+
+        void RemoteMigration::disconnect() {
+            close_socket(fd);
+            this->fd = -1;
+        }
+
+        bool RemoteMigration::send(int /*from*/, const Program &program) {
+            if (fd < 0) {
+                return false;
+            }
+            string payload;
+            encode_program(program, payload);
+            if (!send_message(fd, MigrationMessage::MIGRANT, payload)) {
+                cerr << "> lost the connection to the migration coordinator, the island evolves alone" << endl;
+                disconnect();
+                return false;
+            }
+            return true;
+        }
+
+        bool RemoteMigration::receive(int /*to*/, Program &program) {
+            uint8_t type;
+            string payload;
+            while (fd >= 0 && wait_readable(fd, 0)) {
+                if (!receive_message(fd, type, payload)) {
+                    cerr << "> lost the connection to the migration coordinator, the island evolves alone" << endl;
+                    disconnect();
+                    return false;
+                }
+                size_t pos = 0;
+                if (type == MigrationMessage::STOP) {
+                    this->stop_flag = true;
+                } else if (type == MigrationMessage::MIGRANT) {
+                    if (decode_program(payload, pos, program, variable_num)) {
+                        return true;
+                    }
+                    cerr << "> invalid migrant from the migration coordinator, dropped" << endl;
+                }
+            }
+            return false;
+        }
+
+        void RemoteMigration::stop() {
+            this->stop_flag = true;
+            if (fd >= 0 && !stop_sent) {
+                this->stop_sent = true;
+                send_message(fd, MigrationMessage::STOP, string());
+            }
+        }
+
+        bool RemoteMigration::stopped() const {
+            return stop_flag;
+        }
+
+        void RemoteMigration::leave(const Program &best) {
+            if (fd >= 0) {
+                string payload;
+                encode_program(best, payload);
+                send_message(fd, MigrationMessage::LEAVE, payload);
+            }
+            disconnect();
+        }
+
+        MigrationCoordinator::MigrationCoordinator(topology_t topology, unsigned long long seed)
+                : topology(topology), state(seed) {
+            best_program.fitness = HUGE_VAL;
+        }
+
+        MigrationCoordinator::~MigrationCoordinator() {
+            close();
+        }
+
+        bool MigrationCoordinator::open(const string &address) {
+            close();
+            this->listener = listen_socket(address);
+            if (address.compare(0, 5, "unix:") == 0) {
+                this->unix_path = address.substr(5);
+            }
+            return listener >= 0;
+        }
+
+        void MigrationCoordinator::close() {
+            for (auto &peer: peers) {
+                close_socket(peer.fd);
+            }
+            peers.clear();
+            if (listener >= 0) {
+                close_socket(listener);
+                if (!unix_path.empty()) {
+                    unlink(unix_path.c_str());
+                }
+            }
+            this->listener = -1;
+            this->unix_path.clear();
+        }
+
+        void MigrationCoordinator::run(int min_islands) {
+            assert(listener >= 0);
+            vector<int> fds;
+            vector<char> readable;
+            while (islands_joined < min_islands || !peers.empty()) {
+                fds.assign(1, listener);
+                for (auto &peer: peers) {
+                    fds.push_back(peer.fd);
+                }
+                if (!wait_readable(fds, -1, readable)) {
+                    continue;
+                }
+
+                if (readable[0]) {
+                    int fd = accept_socket(listener);
+                    if (fd >= 0) {
+                        set_send_timeout(fd, send_timeout_ms);
+                        peers.push_back({fd, islands_joined++});
+                        cout << "> island " << peers.back().island << " joined" << endl;
+                        if (stopping) {
+                            send_to(peers.back(), MigrationMessage::STOP, string());
+                        }
+                    }
+                }
+
+                // the peers of this round, a lost peer is marked by fd -1 and removed after the round
+                uint8_t type;
+                string payload;
+                for (int i = 0; i + 1 < fds.size(); i++) {
+                    if (!readable[i + 1] || peers[i].fd < 0) {
+                        continue;
+                    }
+                    if (receive_message(peers[i].fd, type, payload)) {
+                        handle_message(i, type, payload);
+                    } else {
+                        drop(peers[i]);
+                    }
+                }
+                peers.erase(remove_if(peers.begin(), peers.end(), [](const Peer &peer) { return peer.fd < 0; }),
+                            peers.end());
+            }
+        }
+
+        void MigrationCoordinator::handle_message(int index, uint8_t type, const string &payload) {
+            Peer &sender = peers[index];
+            if (type == MigrationMessage::MIGRANT) {
+                update_best(payload, sender.island);
+
+                // the live islands in the order they joined, excluding lost ones of this round
+                vector<int> targets;
+                for (int i = 1; i < peers.size(); i++) {
+                    int j = (index + i) % (int) peers.size();
+                    if (peers[j].fd >= 0) {
+                        targets.push_back(j);
+                    }
+                }
+                if (targets.empty()) {
+                    return;
+                }
+                int target = topology == Topology::ring ? targets[0] : targets[splitmix64(state) % targets.size()];
+                if (send_to(peers[target], MigrationMessage::MIGRANT, payload)) {
+                    this->migrants_relayed++;
+                }
+            } else if (type == MigrationMessage::STOP) {
+                if (!stopping) {
+                    cout << "> island " << sender.island << " reached the stopping criteria" << endl;
+                }
+                this->stopping = true;
+                for (auto &peer: peers) {
+                    if (peer.fd >= 0 && &peer != &sender) {
+                        send_to(peer, MigrationMessage::STOP, string());
+                    }
+                }
+            } else if (type == MigrationMessage::LEAVE) {
+                update_best(payload, sender.island);
+                cout << "> island " << sender.island << " left" << endl;
+                close_socket(sender.fd);
+                sender.fd = -1;
+            }
+        }
+
+        bool MigrationCoordinator::send_to(Peer &peer, uint8_t type, const string &payload) {
+            // a partly sent message cannot be completed, the peer is dropped
+            if (!send_message(peer.fd, type, payload)) {
+                drop(peer);
+                return false;
+            }
+            return true;
+        }
+
+        void MigrationCoordinator::drop(Peer &peer) {
+            cout << "> island " << peer.island << " died" << endl;
+            this->islands_died++;
+            close_socket(peer.fd);
+            peer.fd = -1;
+        }
+
+        void MigrationCoordinator::update_best(const string &payload, int island) {
+            Program program;
+            size_t pos = 0;
+            if (!decode_program(payload, pos, program)) {
+                cerr << "> invalid program from island " << island << endl;
+                return;
+            }
+            if (program.fitness < best_program.fitness) {
+                cout << "> best fitness " << program.fitness << " from island " << island << endl;
+                this->best_program = std::move(program);
+            }
+        }
+    }
+}
@@ -0,0 +1,283 @@
+#ifndef LUMINOCUGP_ISLAND_CUH
+#define LUMINOCUGP_ISLAND_CUH
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include "program.cuh"
+
+/**
+ * bytes between the indices of a queue, so that the producer and the consumer do not share a cache line
+ */
+#define CACHE_LINE_SIZE 64
+
+namespace cusr {
+    namespace program {
+
+        using namespace std;
+
+        typedef enum Topology {
+            ring,           // island i sends its migrants to island i + 1
+            random_island   // each migrant is sent to a random other island
+        } topology_t;
+
+        /**
+         * bounded lock-free queue with a single producer thread and a single consumer thread
+         */
+        template<typename T>
+        class SpscQueue {
+        public:
+            explicit SpscQueue(int capacity) : slots(capacity + 1) {}
+
+            /**
+             * @param value
+             * @return false if the queue is full, the value is not added
+             */
+            bool push(const T &value) {
+                size_t tail = this->tail.load(memory_order_relaxed);
+                size_t next = tail + 1 == slots.size() ? 0 : tail + 1;
+                if (next == head.load(memory_order_acquire)) {
+                    return false;
+                }
+                slots[tail] = value;
+                this->tail.store(next, memory_order_release);
+                return true;
+            }
+
+            /**
+             * @param value
+             * @return false if the queue is empty
+             */
+            bool pop(T &value) {
+                size_t head = this->head.load(memory_order_relaxed);
+                if (head == tail.load(memory_order_acquire)) {
+                    return false;
+                }
+                value = std::move(slots[head]);
+                this->head.store(head + 1 == slots.size() ? 0 : head + 1, memory_order_release);
+                return true;
+            }
+
+        private:
+            vector<T> slots;
+            atomic<size_t> head{0};
+            char padding[CACHE_LINE_SIZE];
+            atomic<size_t> tail{0};
+        };
+
+        /**
+         * routes the migrants of islands
+         */
+        class Migration {
+        public:
+            virtual ~Migration() = default;
+
+            /**
+             * send a copy of a program to a neighbour of an island
+             *
+             * @param from
+             * @param program
+             * @return false if the program is dropped
+             */
+            virtual bool send(int from, const Program &program) = 0;
+
+            /**
+             * @param to
+             * @param program the next program waiting for an island
+             * @return false if no program is waiting
+             */
+            virtual bool receive(int to, Program &program) = 0;
+
+            /**
+             * ask all islands to stop after their current generation
+             */
+            virtual void stop() = 0;
+
+            virtual bool stopped() const = 0;
+        };
+
+        /**
+         * migration routes between islands which evolve on separate threads.
+         * each directed edge of the topology is a SpscQueue, so islands exchange programs without locks
+         * and without waiting for each other
+         */
+        class MigrationNetwork : public Migration {
+        public:
+            /**
+             * @param islands
+             * @param topology
+             * @param capacity max number of programs waiting on an edge
+             */
+            MigrationNetwork(int islands, topology_t topology, int capacity);
+
+            /**
+             * random neighbours are drawn from the current random stream
+             *
+             * @param from
+             * @param program
+             * @return false if the queue is full, the program is dropped
+             */
+            bool send(int from, const Program &program) override;
+
+            bool receive(int to, Program &program) override;
+
+            void stop() override;
+
+            bool stopped() const override;
+
+        private:
+            int islands;
+            topology_t topology;
+            vector<unique_ptr<SpscQueue<Program>>> queues; // queues[from * islands + to]
+            atomic<bool> stop_flag{false};
+        };
+
+        /**
+         * the side of an island process in a multi-process island model,
+         * the migrants are exchanged in the encoding of encode_program through a MigrationCoordinator.
+         * if the coordinator is unreachable or dies, the island evolves alone
+         */
+        class RemoteMigration : public Migration {
+        public:
+            RemoteMigration() = default;
+
+            ~RemoteMigration() override;
+
+            RemoteMigration(const RemoteMigration &) = delete;
+
+            RemoteMigration &operator=(const RemoteMigration &) = delete;
+
+            /**
+             * @param address address of the coordinator, "unix:<path>" or "tcp:<host>:<port>"
+             * @return if or not the island joined the model
+             */
+            bool connect(const string &address);
+
+            /**
+             * the coordinator picks the neighbour
+             *
+             * @param from
+             * @param program
+             * @return false if the island is not connected
+             */
+            bool send(int from, const Program &program) override;
+
+            /**
+             * does not wait, the programs which have already arrived are returned
+             *
+             * @param to
+             * @param program
+             * @return
+             */
+            bool receive(int to, Program &program) override;
+
+            void stop() override;
+
+            bool stopped() const override;
+
+            /**
+             * report the final best program of the island to the coordinator and leave the model
+             *
+             * @param best
+             */
+            void leave(const Program &best);
+
+            /**
+             * number of variables of the dataset of the island, migrants which reference other variables are dropped
+             */
+            int variable_num = INT_MAX;
+
+        private:
+            int fd = -1;
+            bool stop_flag = false;
+            bool stop_sent = false;
+
+            void disconnect();
+        };
+
+        /**
+         * the coordinator of a multi-process island model.
+         * island processes (RegressionEngine with migration_address) connect to it at any time,
+         * it relays their migrants to the next island in the order they joined (ring) or to a random island,
+         * tracks the global best program, drops islands whose connection is lost or which stop reading,
+         * and broadcasts a stop once an island reaches the stopping criteria
+         *
+         * MigrationCoordinator coordinator;
+         * if (coordinator.open("unix:/tmp/cusr.sock")) {
+         *     coordinator.run(4);   // start 4 island processes which connect to the address
+         * }
+         */
+        class MigrationCoordinator {
+        public:
+            /**
+             * @param topology
+             * @param seed seed of the random routes
+             */
+            explicit MigrationCoordinator(topology_t topology = Topology::ring, unsigned long long seed = 0);
+
+            ~MigrationCoordinator();
+
+            MigrationCoordinator(const MigrationCoordinator &) = delete;
+
+            MigrationCoordinator &operator=(const MigrationCoordinator &) = delete;
+
+            /**
+             * @param address "unix:<path>" or "tcp:<host>:<port>"
+             * @return if or not the coordinator listens on the address
+             */
+            bool open(const string &address);
+
+            /**
+             * relay migrants until at least min_islands islands have joined and all of them have left or died
+             *
+             * @param min_islands
+             */
+            void run(int min_islands = 1);
+
+            void close();
+
+            /**
+             * the best program of all migrants and final programs, its prefix is empty if no island reported one
+             */
+            Program best_program;
+
+            /**
+             * an island which does not accept a message for this long is dropped as if it died,
+             * so a stalled island cannot block the relay of the others
+             */
+            int send_timeout_ms = 5000;
+
+            int islands_joined = 0;
+            int islands_died = 0;
+            long long migrants_relayed = 0;
+
+        private:
+            struct Peer {
+                int fd;
+                int island;
+            };
+
+            topology_t topology;
+            unsigned long long state;
+            int listener = -1;
+            string unix_path;
+            vector<Peer> peers;   // live islands in the order they joined
+            bool stopping = false;
+
+            void handle_message(int index, uint8_t type, const string &payload);
+
+            /**
+             * @param peer
+             * @param type
+             * @param payload
+             * @return false if the peer is lost, it is closed and marked by fd -1
+             */
+            bool send_to(Peer &peer, uint8_t type, const string &payload);
+
+            void drop(Peer &peer);
+
+            void update_best(const string &payload, int island);
+        };
+    }
+}
+#endif //LUMINOCUGP_ISLAND_CUH
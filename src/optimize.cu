@@ -0,0 +1,622 @@
+#include "optimize.cuh"
+#include <cassert>
+
+/**
+ * lower bound of |r| when the rows are reweighted by 1 / |r| for the absolute error
+ */
+#define IRLS_MIN_RESIDUAL 1e-6
+
+namespace cusr {
+    namespace program {
+
+        int count_constants(const Program &program) {
+            int ret = 0;
+            for (auto &node: program.prefix) {
+                if (node.node_type == NodeType::CONST) {
+                    ret++;
+                }
+            }
+            return ret;
+        }
+
+        /**
+         * stack of the forward-mode evaluation
+         * level l holds the values of a subtree on the rows of the block, and the tangents of the constants
+         * in the subtree. the constants are numbered in prefix order, so the constants of a subtree are a range
+         * [lo, hi) of the numbers, and the ranges of the two operands of a binary function are adjacent
+         */
+        struct DualStack {
+            int constants = 0;
+            vector<double> value;
+            vector<double> tangent;
+            vector<int> lo;
+            vector<int> hi;
+            vector<int> constants_before;   // number of constants before each position of the prefix
+            vector<double> d1;
+            vector<double> d2;
+
+            void reset(const Program &program) {
+                int levels = program.depth + 1;
+                constants_before.resize(program.length + 1);
+                constants_before[0] = 0;
+                for (int i = 0; i < program.length; i++) {
+                    bool is_constant = program.prefix[i].node_type == NodeType::CONST;
+                    constants_before[i + 1] = constants_before[i] + is_constant;
+                }
+                constants = constants_before[program.length];
+                value.resize((size_t) levels * DUAL_BLOCK_SIZE);
+                tangent.resize((size_t) levels * constants * DUAL_BLOCK_SIZE);
+                lo.resize(levels);
+                hi.resize(levels);
+                d1.resize(DUAL_BLOCK_SIZE);
+                d2.resize(DUAL_BLOCK_SIZE);
+            }
+
+            double *values(int level) { return &value[(size_t) level * DUAL_BLOCK_SIZE]; }
+
+            double *tangents(int level, int k) {
+                return &tangent[((size_t) level * constants + k) * DUAL_BLOCK_SIZE];
+            }
+        };
+
+        /**
+         * derivatives of the protected functions with respect to their operands
+         */
+        static void unary_derivative(Function function, const double *var1, double *d1, int n) {
+            for (int r = 0; r < n; r++) {
+                double v = var1[r];
+                if (function == Function::SIN) {
+                    d1[r] = std::cos(v);
+                } else if (function == Function::COS) {
+                    d1[r] = -std::sin(v);
+                } else if (function == Function::TAN) {
+                    double t = std::tan(v);
+                    d1[r] = 1 + t * t;
+                } else if (function == Function::LOG) {
+                    d1[r] = v <= 0 ? 0 : 1 / v;
+                } else if (function == Function::INV) {
+                    d1[r] = v == 0 ? 0 : -1 / (v * v);
+                } else {
+                    d1[r] = 0;
+                }
+            }
+        }
+
+        static void binary_derivative(Function function, const double *var1, const double *var2, double *d1,
+                                      double *d2, int n) {
+            for (int r = 0; r < n; r++) {
+                double v1 = var1[r];
+                double v2 = var2[r];
+                if (function == Function::ADD) {
+                    d1[r] = 1;
+                    d2[r] = 1;
+                } else if (function == Function::SUB) {
+                    d1[r] = 1;
+                    d2[r] = -1;
+                } else if (function == Function::MUL) {
+                    d1[r] = v2;
+                    d2[r] = v1;
+                } else if (function == Function::DIV) {
+                    double den = v2 == 0 ? DELTA : v2;
+                    d1[r] = 1 / den;
+                    d2[r] = v2 == 0 ? 0 : -v1 / (den * den);
+                } else if (function == Function::MAX) {
+                    d1[r] = v1 >= v2;
+                    d2[r] = !(v1 >= v2);
+                } else if (function == Function::MIN) {
+                    d1[r] = v1 <= v2;
+                    d2[r] = !(v1 <= v2);
+                } else {
+                    d1[r] = 0;
+                    d2[r] = 0;
+                }
+            }
+        }
+
+        static double apply_unary(Function function, double v) {
+            if (function == Function::SIN) {
+                return std::sin(v);
+            } else if (function == Function::COS) {
+                return std::cos(v);
+            } else if (function == Function::TAN) {
+                return std::tan(v);
+            } else if (function == Function::LOG) {
+                return v <= 0 ? -1 : std::log(v);
+            } else if (function == Function::INV) {
+                return 1 / (v == 0 ? DELTA : v);
+            }
+            return v;
+        }
+
+        static double apply_binary(Function function, double v1, double v2) {
+            if (function == Function::ADD) {
+                return v1 + v2;
+            } else if (function == Function::SUB) {
+                return v1 - v2;
+            } else if (function == Function::MUL) {
+                return v1 * v2;
+            } else if (function == Function::DIV) {
+                return v1 / (v2 == 0 ? DELTA : v2);
+            } else if (function == Function::MAX) {
+                return v1 >= v2 ? v1 : v2;
+            } else if (function == Function::MIN) {
+                return v1 <= v2 ? v1 : v2;
+            }
+            return v1;
+        }
+
+        /**
+         * evaluate a program and, if with_tangents, the tangents of all its constants on the current block
+         * the values of the root are in stack.values(0), its tangents in stack.tangents(0, k)
+         */
+        static void eval_dual(const Program &program, DoubleBlockReader &reader, DualStack &stack,
+                              bool with_tangents) {
+            int n = reader.block_size();
+            int top = 0;
+            for (int i = program.length - 1; i >= 0; i--) {
+                auto &node = program.prefix[i];
+                double *out = stack.values(top);
+                if (node.node_type == NodeType::CONST) {
+                    int k = stack.constants_before[i];
+                    std::fill(out, out + n, node.constant);
+                    if (with_tangents) {
+                        double *t = stack.tangents(top, k);
+                        std::fill(t, t + n, 1.0);
+                    }
+                    stack.lo[top] = k;
+                    stack.hi[top] = k + 1;
+                    top++;
+                } else if (node.node_type == NodeType::VAR) {
+                    const double *column = reader.column(node.variable);
+                    std::copy(column, column + n, out);
+                    stack.lo[top] = stack.hi[top] = stack.constants_before[i];
+                    top++;
+                } else if (node.node_type == NodeType::UFUNC) {
+                    top--;
+                    out = stack.values(top);
+                    if (with_tangents && stack.lo[top] < stack.hi[top]) {
+                        unary_derivative(node.function, out, stack.d1.data(), n);
+                        for (int k = stack.lo[top]; k < stack.hi[top]; k++) {
+                            double *t = stack.tangents(top, k);
+                            for (int r = 0; r < n; r++) { t[r] *= stack.d1[r]; }
+                        }
+                    }
+                    for (int r = 0; r < n; r++) { out[r] = apply_unary(node.function, out[r]); }
+                    top++;
+                } else {
+                    // var1 (the first operand) is on level top - 1, var2 on level top - 2, the result replaces var2
+                    int level1 = top - 1;
+                    int level2 = top - 2;
+                    const double *var1 = stack.values(level1);
+                    out = stack.values(level2);
+                    if (with_tangents && stack.lo[level1] < stack.hi[level2]) {
+                        binary_derivative(node.function, var1, out, stack.d1.data(), stack.d2.data(), n);
+                        for (int k = stack.lo[level2]; k < stack.hi[level2]; k++) {
+                            double *t = stack.tangents(level2, k);
+                            for (int r = 0; r < n; r++) { t[r] *= stack.d2[r]; }
+                        }
+                        for (int k = stack.lo[level1]; k < stack.hi[level1]; k++) {
+                            const double *t1 = stack.tangents(level1, k);
+                            double *t = stack.tangents(level2, k);
+                            for (int r = 0; r < n; r++) { t[r] = stack.d1[r] * t1[r]; }
+                        }
+                    }
+                    for (int r = 0; r < n; r++) { out[r] = apply_binary(node.function, var1[r], out[r]); }
+                    stack.lo[level2] = stack.lo[level1];
+                    top--;
+                }
+            }
+        }
+
+        /**
+         * loss of a program on the rows [begin, end), and if jtj != nullptr, the Gauss-Newton system
+         * jtj (lower triangle) and jtr of its constants
+         */
+        static double batch_pass(const Program &program, DoubleBlockReader &reader, row_t begin, row_t end,
+                                 metric_t metric, DualStack &stack, double *jtj, double *jtr) {
+            int constants = stack.constants;
+            if (jtj != nullptr) {
+                std::fill(jtj, jtj + constants * constants, 0.0);
+                std::fill(jtr, jtr + constants, 0.0);
+            }
+
+            PairwiseSum total_loss;
+            vector<double> &jacobian = stack.d1;  // reused after the evaluation, one row at a time
+            jacobian.resize(max(DUAL_BLOCK_SIZE, constants));
+            for (row_t block = begin; block < end; block += DUAL_BLOCK_SIZE) {
+                reader.seek(block, min(block + DUAL_BLOCK_SIZE, end));
+                eval_dual(program, reader, stack, jtj != nullptr);
+
+                int n = reader.block_size();
+                const double *predict = stack.values(0);
+                const double *real_value = reader.label();
+                const double *weight = reader.weight();
+                double block_loss = 0;
+                for (int r = 0; r < n; r++) {
+                    double w = weight == nullptr ? 1.0 : weight[r];
+                    double residual = program.slope * predict[r] + program.intercept - real_value[r];
+                    double h = w;
+                    if (metric == metric_t::mean_absolute_error) {
+                        block_loss += w * std::fabs(residual);
+                        h = w / max(std::fabs(residual), IRLS_MIN_RESIDUAL);
+                    } else {
+                        block_loss += w * residual * residual;
+                    }
+                    if (jtj == nullptr) {
+                        continue;
+                    }
+                    for (int k = 0; k < constants; k++) {
+                        jacobian[k] = program.slope * stack.tangents(0, k)[r];
+                    }
+                    for (int k = 0; k < constants; k++) {
+                        double hj = h * jacobian[k];
+                        jtr[k] += hj * residual;
+                        for (int j = 0; j <= k; j++) {
+                            jtj[k * constants + j] += hj * jacobian[j];
+                        }
+                    }
+                }
+                total_loss.add(block_loss);
+            }
+            return total_loss.result();
+        }
+
+        /**
+         * solve (jtj + lambda * diag(jtj)) delta = -jtr by Cholesky decomposition
+         * @return false if the damped system is not positive definite
+         */
+        static bool solve_damped(const vector<double> &jtj, const vector<double> &jtr, double lambda, int k,
+                                 vector<double> &factor, vector<double> &delta) {
+            double max_diagonal = 0;
+            for (int i = 0; i < k; i++) {
+                max_diagonal = max(max_diagonal, jtj[i * k + i]);
+            }
+            if (!(max_diagonal > 0) || !std::isfinite(max_diagonal)) {
+                return false;
+            }
+
+            factor.assign(k * k, 0.0);
+            for (int i = 0; i < k; i++) {
+                for (int j = 0; j <= i; j++) {
+                    double sum = jtj[i * k + j];
+                    if (i == j) {
+                        sum += lambda * jtj[i * k + i] + 1e-12 * max_diagonal;
+                    }
+                    for (int p = 0; p < j; p++) {
+                        sum -= factor[i * k + p] * factor[j * k + p];
+                    }
+                    if (i == j) {
+                        if (!(sum > 0)) {
+                            return false;
+                        }
+                        factor[i * k + i] = std::sqrt(sum);
+                    } else {
+                        factor[i * k + j] = sum / factor[j * k + j];
+                    }
+                }
+            }
+
+            // forward and backward substitution
+            delta.resize(k);
+            for (int i = 0; i < k; i++) {
+                double sum = -jtr[i];
+                for (int p = 0; p < i; p++) {
+                    sum -= factor[i * k + p] * delta[p];
+                }
+                delta[i] = sum / factor[i * k + i];
+            }
+            for (int i = k - 1; i >= 0; i--) {
+                double sum = delta[i];
+                for (int p = i + 1; p < k; p++) {
+                    sum -= factor[p * k + i] * delta[p];
+                }
+                delta[i] = sum / factor[i * k + i];
+            }
+            return true;
+        }
+
+        static void get_constants(const Program &program, vector<double> &constants) {
+            constants.clear();
+            for (auto &node: program.prefix) {
+                if (node.node_type == NodeType::CONST) {
+                    constants.push_back(node.constant);
+                }
+            }
+        }
+
+        static void set_constants(Program &program, const vector<double> &constants, const double *delta) {
+            int k = 0;
+            for (auto &node: program.prefix) {
+                if (node.node_type == NodeType::CONST) {
+                    node.constant = constants[k] + (delta == nullptr ? 0 : delta[k]);
+                    k++;
+                }
+            }
+        }
+
+        long long optimize_constants(Program &program, const DataView &dataset, const DataView &label,
+                                     const DataView &weight, row_t begin, row_t end, metric_t metric,
+                                     int iterations, long long budget) {
+            static thread_local DualStack stack;
+            stack.reset(program);
+            int k = stack.constants;
+            long long rows = end - begin;
+            long long pass_cost = rows * (1 + k);
+            if (k == 0 || begin >= end || (budget > 0 && pass_cost > budget)) {
+                return 0;
+            }
+
+            DoubleBlockReader reader(dataset, label, weight);
+            long long cost = 0;
+
+            vector<double> jtj(k * k), jtr(k), trial_jtj(k * k), trial_jtr(k), factor, delta, constants;
+            double loss = batch_pass(program, reader, begin, end, metric, stack, jtj.data(), jtr.data());
+            cost += pass_cost;
+            if (!std::isfinite(loss)) {
+                return cost;
+            }
+
+            double lambda = 1e-3;
+            for (int it = 0; it < iterations && lambda < 1e10; it++) {
+                if (budget > 0 && cost + pass_cost > budget) {
+                    break;
+                }
+                if (!solve_damped(jtj, jtr, lambda, k, factor, delta)) {
+                    lambda *= 10;
+                    continue;
+                }
+
+                // the trial pass also computes the system of the next step, in case the step is kept
+                get_constants(program, constants);
+                set_constants(program, constants, delta.data());
+                double trial = batch_pass(program, reader, begin, end, metric, stack, trial_jtj.data(),
+                                          trial_jtr.data());
+                cost += pass_cost;
+                if (trial < loss) {
+                    double improvement = loss - trial;
+                    loss = trial;
+                    jtj.swap(trial_jtj);
+                    jtr.swap(trial_jtr);
+                    lambda = max(lambda / 3, 1e-9);
+                    if (improvement <= 1e-12 * loss) {
+                        break;
+                    }
+                } else {
+                    set_constants(program, constants, nullptr);
+                    lambda *= 4;
+                }
+            }
+            return cost;
+        }
+
+        /**
+         * stack of the lane evaluation, level l holds the values of a subtree in one of the layouts
+         * ROWS : the subtree has no constant, one value per row, shared by the lanes
+         * LANES: one value per row and lane, value[r * PERTURB_LANES + lane]
+         * CONSTANTS: the subtree has no variable, one value per lane
+         * the value of (row r, lane l) is value[r * row_stride + l * lane_stride]
+         */
+        struct LaneStack {
+            enum Layout { ROWS, LANES, CONSTANTS };
+            vector<double> value;
+            vector<Layout> layout;
+            vector<int> constants_before;
+
+            void reset(const Program &program) {
+                int levels = program.depth + 1;
+                constants_before.resize(program.length + 1);
+                constants_before[0] = 0;
+                for (int i = 0; i < program.length; i++) {
+                    bool is_constant = program.prefix[i].node_type == NodeType::CONST;
+                    constants_before[i + 1] = constants_before[i] + is_constant;
+                }
+                value.resize((size_t) levels * DUAL_BLOCK_SIZE * PERTURB_LANES);
+                layout.resize(levels);
+            }
+
+            double *values(int level) { return &value[(size_t) level * DUAL_BLOCK_SIZE * PERTURB_LANES]; }
+
+            int row_stride(int level) const {
+                return layout[level] == ROWS ? 1 : layout[level] == LANES ? PERTURB_LANES : 0;
+            }
+
+            int lane_stride(int level) const { return layout[level] == ROWS ? 0 : 1; }
+
+            int size(int level, int n) const {
+                return layout[level] == ROWS ? n : layout[level] == LANES ? n * PERTURB_LANES : PERTURB_LANES;
+            }
+        };
+
+        template<typename F>
+        static void unary_values(F op, double *values, int size) {
+            for (int e = 0; e < size; e++) { values[e] = op(values[e]); }
+        }
+
+        static void unary_values(Function function, double *values, int size) {
+            if (function == Function::SIN) {
+                unary_values([](double v) { return std::sin(v); }, values, size);
+            } else if (function == Function::COS) {
+                unary_values([](double v) { return std::cos(v); }, values, size);
+            } else if (function == Function::TAN) {
+                unary_values([](double v) { return std::tan(v); }, values, size);
+            } else if (function == Function::LOG) {
+                unary_values([](double v) { return v <= 0 ? -1 : std::log(v); }, values, size);
+            } else if (function == Function::INV) {
+                unary_values([](double v) { return 1 / (v == 0 ? DELTA : v); }, values, size);
+            }
+        }
+
+        /**
+         * out = op(var1, out) on rows [0, n) of a ROWS result (LANE_COUNT == 1), on the lanes of a CONSTANTS
+         * result (n == 1), or on (row, lane) of a LANES result. var2 (out) is read before the row is written,
+         * and the rows are visited from the last one, so a ROWS / CONSTANTS var2 is expanded in place
+         */
+        template<int LANE_STRIDE1, int LANE_STRIDE2, int LANE_COUNT, typename F>
+        static void binary_values(F op, const double *var1, int row_stride1, double *out, int row_stride2, int n) {
+            for (int r = n - 1; r >= 0; r--) {
+                double operand2[LANE_COUNT];
+                for (int lane = 0; lane < LANE_COUNT; lane++) {
+                    operand2[lane] = out[r * row_stride2 + lane * LANE_STRIDE2];
+                }
+                for (int lane = 0; lane < LANE_COUNT; lane++) {
+                    out[r * LANE_COUNT + lane] = op(var1[r * row_stride1 + lane * LANE_STRIDE1], operand2[lane]);
+                }
+            }
+        }
+
+        template<typename F>
+        static void binary_values(F op, const double *var1, int row_stride1, int lane_stride1, double *out,
+                                  int row_stride2, int lane_stride2, int n, int lanes) {
+            if (lanes == 1) {
+                binary_values<0, 0, 1>(op, var1, row_stride1, out, row_stride2, n);
+            } else if (lane_stride1 == 1 && lane_stride2 == 1) {
+                binary_values<1, 1, PERTURB_LANES>(op, var1, row_stride1, out, row_stride2, n);
+            } else if (lane_stride1 == 1) {
+                binary_values<1, 0, PERTURB_LANES>(op, var1, row_stride1, out, row_stride2, n);
+            } else {
+                binary_values<0, 1, PERTURB_LANES>(op, var1, row_stride1, out, row_stride2, n);
+            }
+        }
+
+        static void binary_values(Function function, const double *var1, int row_stride1, int lane_stride1,
+                                  double *out, int row_stride2, int lane_stride2, int n, int lanes) {
+            if (function == Function::ADD) {
+                binary_values([](double a, double b) { return a + b; }, var1, row_stride1, lane_stride1,
+                              out, row_stride2, lane_stride2, n, lanes);
+            } else if (function == Function::SUB) {
+                binary_values([](double a, double b) { return a - b; }, var1, row_stride1, lane_stride1,
+                              out, row_stride2, lane_stride2, n, lanes);
+            } else if (function == Function::MUL) {
+                binary_values([](double a, double b) { return a * b; }, var1, row_stride1, lane_stride1,
+                              out, row_stride2, lane_stride2, n, lanes);
+            } else if (function == Function::DIV) {
+                binary_values([](double a, double b) { return a / (b == 0 ? DELTA : b); }, var1, row_stride1,
+                              lane_stride1, out, row_stride2, lane_stride2, n, lanes);
+            } else if (function == Function::MAX) {
+                binary_values([](double a, double b) { return a >= b ? a : b; }, var1, row_stride1, lane_stride1,
+                              out, row_stride2, lane_stride2, n, lanes);
+            } else if (function == Function::MIN) {
+                binary_values([](double a, double b) { return a <= b ? a : b; }, var1, row_stride1, lane_stride1,
+                              out, row_stride2, lane_stride2, n, lanes);
+            }
+        }
+
+        static void eval_lanes(const Program &program, const vector<double> &constants, DoubleBlockReader &reader,
+                               LaneStack &stack) {
+            typedef LaneStack::Layout Layout;
+            int n = reader.block_size();
+            int count = stack.constants_before[program.length];
+            int top = 0;
+            for (int i = program.length - 1; i >= 0; i--) {
+                auto &node = program.prefix[i];
+                if (node.node_type == NodeType::CONST) {
+                    double *out = stack.values(top);
+                    for (int lane = 0; lane < PERTURB_LANES; lane++) {
+                        out[lane] = constants[lane * count + stack.constants_before[i]];
+                    }
+                    stack.layout[top++] = Layout::CONSTANTS;
+                } else if (node.node_type == NodeType::VAR) {
+                    const double *column = reader.column(node.variable);
+                    std::copy(column, column + n, stack.values(top));
+                    stack.layout[top++] = Layout::ROWS;
+                } else if (node.node_type == NodeType::UFUNC) {
+                    unary_values(node.function, stack.values(top - 1), stack.size(top - 1, n));
+                } else {
+                    // the result replaces var2 on level top - 2
+                    Layout layout1 = stack.layout[top - 1];
+                    Layout layout2 = stack.layout[top - 2];
+                    Layout result = layout1 == layout2 ? layout1 : Layout::LANES;
+                    int rows = result == Layout::CONSTANTS ? 1 : n;
+                    int lanes = result == Layout::ROWS ? 1 : PERTURB_LANES;
+                    binary_values(node.function, stack.values(top - 1), stack.row_stride(top - 1),
+                                  stack.lane_stride(top - 1), stack.values(top - 2), stack.row_stride(top - 2),
+                                  stack.lane_stride(top - 2), rows, lanes);
+                    stack.layout[top - 2] = result;
+                    top--;
+                }
+            }
+        }
+
+        void calculate_lane_losses(const Program &program, const vector<double> &constants, const DataView &dataset,
+                                   const DataView &label, const DataView &weight, row_t begin, row_t end,
+                                   metric_t metric, double *losses) {
+            static thread_local LaneStack stack;
+            stack.reset(program);
+            assert(constants.size() == (size_t) stack.constants_before[program.length] * PERTURB_LANES);
+
+            DoubleBlockReader reader(dataset, label, weight);
+            PairwiseSum total_loss[PERTURB_LANES];
+            for (row_t block = begin; block < end; block += DUAL_BLOCK_SIZE) {
+                reader.seek(block, min(block + DUAL_BLOCK_SIZE, end));
+                eval_lanes(program, constants, reader, stack);
+
+                int n = reader.block_size();
+                const double *predict = stack.values(0);
+                int stride = stack.row_stride(0);
+                int step = stack.lane_stride(0);
+                const double *real_value = reader.label();
+                const double *weight_value = reader.weight();
+                double block_loss[PERTURB_LANES] = {};
+                bool absolute = metric == metric_t::mean_absolute_error;
+                for (int r = 0; r < n; r++) {
+                    double w = weight_value == nullptr ? 1.0 : weight_value[r];
+                    for (int lane = 0; lane < PERTURB_LANES; lane++) {
+                        double f = predict[r * stride + lane * step];
+                        double residual = program.slope * f + program.intercept - real_value[r];
+                        block_loss[lane] += w * (absolute ? std::fabs(residual) : residual * residual);
+                    }
+                }
+                for (int lane = 0; lane < PERTURB_LANES; lane++) {
+                    total_loss[lane].add(block_loss[lane]);
+                }
+            }
+            for (int lane = 0; lane < PERTURB_LANES; lane++) {
+                losses[lane] = total_loss[lane].result();
+            }
+        }
+
+        long long perturb_constants(Program &program, const DataView &dataset, const DataView &label,
+                                    const DataView &weight, row_t begin, row_t end, metric_t metric,
+                                    int iterations, long long budget) {
+            vector<double> current;
+            get_constants(program, current);
+            int count = current.size();
+            if (count == 0 || begin >= end) {
+                return 0;
+            }
+
+            // lane 0 keeps the current constants, so the loss of a step never increases
+            vector<double> constants(count * PERTURB_LANES);
+            double losses[PERTURB_LANES];
+            double sigma = 0.1;
+            long long cost = 0;
+            long long pass_cost = (end - begin) * PERTURB_LANES;
+            for (int it = 0; it < iterations && (budget == 0 || cost + pass_cost <= budget); it++) {
+                for (int lane = 0; lane < PERTURB_LANES; lane++) {
+                    for (int k = 0; k < count; k++) {
+                        double step = lane == 0 ? 0 : sigma * max(std::fabs(current[k]), 1.0) *
+                                                      gen_rand_float(-1, 1);
+                        constants[lane * count + k] = current[k] + step;
+                    }
+                }
+                calculate_lane_losses(program, constants, dataset, label, weight, begin, end, metric, losses);
+                cost += pass_cost;
+
+                int best = 0;
+                for (int lane = 1; lane < PERTURB_LANES; lane++) {
+                    if (losses[lane] < losses[best]) {
+                        best = lane;
+                    }
+                }
+                if (best != 0) {
+                    std::copy(&constants[best * count], &constants[best * count] + count, current.begin());
+                    sigma = min(sigma * 1.5, 1.0);
+                } else {
+                    sigma *= 0.5;
+                }
+            }
+            set_constants(program, current, nullptr);
+            return cost;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef LUMINOCUGP_OPTIMIZE_CUH
+#define LUMINOCUGP_OPTIMIZE_CUH
+
+#include "program.cuh"
+
+/**
+ * number of rows evaluated together by the forward-mode pass,
+ * each level of the stack keeps a value and a tangent per constant for each of them
+ */
+#define DUAL_BLOCK_SIZE 256
+
+/**
+ * number of constant vectors of a program evaluated together in one pass over the rows
+ */
+#define PERTURB_LANES 8
+
+namespace cusr {
+    namespace program {
+
+        using namespace std;
+
+        typedef enum ConstOptimizer {
+            levenberg_marquardt,   // gradient-based, forward-mode derivatives
+            hill_climbing          // derivative-free, batched perturbations of the constants
+        } const_optimizer_t;
+
+        /**
+         * number of CONST nodes of a program
+         *
+         * @param program
+         * @return
+         */
+        int count_constants(const Program &program);
+
+        /**
+         * tune the constants of a program by Levenberg-Marquardt on the rows [begin, end) of a dataset.
+         *
+         * the output f and its gradients with respect to all constants are computed in one forward-mode pass
+         * (dual numbers, one tangent per constant), which accumulates the Gauss-Newton system J^T W J, J^T W r
+         * of the residuals r = slope * f + intercept - y. slope and intercept of the program are kept fixed.
+         * mean_absolute_error is handled by reweighting the rows by 1 / |r| (IRLS).
+         * a step is kept only if it lowers the loss on the rows, the constants are unchanged otherwise
+         *
+         * @param program
+         * @param dataset
+         * @param label
+         * @param weight per-row weights, an empty view if the rows are not weighted
+         * @param begin
+         * @param end
+         * @param metric
+         * @param iterations max number of steps, a rejected step counts as an iteration
+         * @param budget max number of row evaluations, 0 refers to no limit. a pass which would exceed it is not done
+         * @return number of row evaluations, a row of a pass with gradients counts as 1 + number of constants
+         */
+        long long optimize_constants(Program &program, const DataView &dataset, const DataView &label,
+                                     const DataView &weight, row_t begin, row_t end, metric_t metric,
+                                     int iterations, long long budget = 0);
+
+        /**
+         * loss sums of PERTURB_LANES variants of a program, which only differ in their constants,
+         * on the rows [begin, end) of a dataset in one pass.
+         * the program is decoded once and each row is evaluated for all the variants as lanes,
+         * subtrees without constants are evaluated once for all the lanes
+         *
+         * @param program
+         * @param constants constants of lane l in prefix order are constants[l * count_constants(program), ..]
+         * @param dataset
+         * @param label
+         * @param weight per-row weights, an empty view if the rows are not weighted
+         * @param begin
+         * @param end
+         * @param metric
+         * @param losses loss sum of each lane (PERTURB_LANES elements), using slope and intercept of the program
+         */
+        void calculate_lane_losses(const Program &program, const vector<double> &constants, const DataView &dataset,
+                                   const DataView &label, const DataView &weight, row_t begin, row_t end,
+                                   metric_t metric, double *losses);
+
+        /**
+         * tune the constants of a program by a (1 + (PERTURB_LANES - 1)) hill climbing on the rows [begin, end),
+         * for function sets without useful derivatives (MAX, MIN, protected DIV).
+         * each step evaluates the current constants and PERTURB_LANES - 1 random perturbations of them in one pass,
+         * keeps the best, and adapts the step size by the success of the step.
+         * random numbers are drawn from the current random stream
+         *
+         * @param program
+         * @param dataset
+         * @param label
+         * @param weight per-row weights, an empty view if the rows are not weighted
+         * @param begin
+         * @param end
+         * @param metric
+         * @param iterations number of steps
+         * @param budget max number of row evaluations, 0 refers to no limit. a step which would exceed it is not done
+         * @return number of row evaluations, a row of a pass counts as PERTURB_LANES
+         */
+        long long perturb_constants(Program &program, const DataView &dataset, const DataView &label,
+                                    const DataView &weight, row_t begin, row_t end, metric_t metric,
+                                    int iterations, long long budget = 0);
+    }
+}
+#endif //LUMINOCUGP_OPTIMIZE_CUH
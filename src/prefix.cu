@@ -15,15 +15,41 @@ namespace cusr {
 
         static int seed_count = seed_using_times;
 
+        /**
+         * In deterministic mode, each thread draws from its own counter-based stream,
+         * which only depends on (seed, generation, index). The mode is set per thread.
+         */
+        static thread_local bool deterministic_mode = false;
+
+        static thread_local unsigned long long stream_state = 0;
+
+        static thread_local bool is_first_rand = true;
+
         void set_seed_using_times(int time) {
             seed_using_times = time;
         }
 
+        void set_deterministic(bool deterministic) {
+            deterministic_mode = deterministic;
+        }
+
+        void set_rand_stream(unsigned long long seed, int generation, int index) {
+            unsigned long long state = seed;
+            state = splitmix64(state) + (unsigned int) generation;
+            state = splitmix64(state) + (unsigned int) index;
+            stream_state = splitmix64(state);
+            is_first_rand = true;
+        }
+
         void set_constant_prob(float p_const) {
             constant_prob = p_const;
         }
 
         int gen_rand_int(int loBound, int upBound) {
+            if (deterministic_mode) {
+                unsigned long long bound_width = upBound - loBound + 1;
+                return (int) (splitmix64(stream_state) % bound_width) + loBound;
+            }
             if (seed_count-- <= 0) {
                 seed_count = seed_using_times;
                 std::random_device rd;
@@ -36,6 +62,11 @@ namespace cusr {
         }
 
         float gen_rand_float(float loBound, float upBound) {
+            if (deterministic_mode) {
+                // 24 random bits --> [0, 1)
+                float rd = (float) (splitmix64(stream_state) >> 40) * (1.0f / 16777216.0f);
+                return loBound + rd * (upBound - loBound);
+            }
             if (seed_count-- <= 0) {
                 seed_count = seed_using_times;
                 std::random_device rd;
@@ -70,41 +101,32 @@ namespace cusr {
         int rand_roulette_pos(prefix_t &prefix, bool allow_terminal) {
             int len = prefix.size();
 
-            auto *weights = new float[len];
-            float total = 0;
+            // the weights only take two values, so select the class first, then a node of the class uniformly
+            int function_num = 0;
             for (int i = 0; i < len; i++) {
                 if (prefix[i].node_type == NodeType::BFUNC || prefix[i].node_type == NodeType::UFUNC) {
-                    weights[i] = FUNCTION_WEIGHTS;
-                    total += FUNCTION_WEIGHTS;
-                } else {
-                    weights[i] = TERMINAL_WEIGHTS;
-                    total += TERMINAL_WEIGHTS;
+                    function_num++;
                 }
             }
-            for (int i = 0; i < len; i++) {
-                weights[i] /= total;
-            }
-            for (int i = 1; i < len; i++) {
-                weights[i] += weights[i - 1];
+            int terminal_num = len - function_num;
+
+            bool choose_function;
+            if (function_num == 0 || terminal_num == 0 || !allow_terminal) {
+                choose_function = function_num > 0;
+            } else {
+                float function_total = FUNCTION_WEIGHTS * function_num;
+                float total = function_total + TERMINAL_WEIGHTS * terminal_num;
+                choose_function = gen_rand_float(0, 1) * total < function_total;
             }
-            float rand_float = gen_rand_float(0, 1);
 
-            int pos;
-            while (true) {
-                pos = 0;
-                for (; pos < len; pos++) {
-                    if (rand_float <= weights[pos] || pos == len - 1) {
-                        break;
-                    }
+            int target = choose_function ? gen_rand_int(0, function_num - 1) : gen_rand_int(0, terminal_num - 1);
+            for (int pos = 0; pos < len; pos++) {
+                bool is_function = prefix[pos].node_type == NodeType::BFUNC || prefix[pos].node_type == NodeType::UFUNC;
+                if (is_function == choose_function && target-- == 0) {
+                    return pos;
                 }
-                if (!allow_terminal && (prefix[pos].node_type == NodeType::VAR || prefix[pos].node_type == NodeType::CONST)) {
-                    rand_float = gen_rand_float(0, 1);
-                    continue;
-                }
-                break;
             }
-            delete[] weights;
-            return pos;
+            return len - 1;
         }
 
         pair<int, int> rand_subtree_index_roulette(prefix_t &prefix, bool allow_terminal) {
@@ -161,9 +183,7 @@ namespace cusr {
             int rand_int = gen_rand_int(0, len - 1);
             func_t rand_func = function_set[rand_int];
             node.function = rand_func;
-            if (rand_func == Function::ADD || rand_func == Function::SUB ||
-                rand_func == Function::MUL || rand_func == Function::DIV ||
-                rand_func == Function::MAX || rand_func == Function::MIN) {
+            if (is_binary_function(rand_func)) {
                 node.node_type = NodeType::BFUNC;
             } else /** if (rand_func == Function::SIN || rand_func == Function::COS || rand_func == Function::TAN ||
         rand_func == Function::LOG || rand_func == Function::INV) */
@@ -172,6 +192,59 @@ namespace cusr {
             }
         }
 
+        void build_function_table(FunctionTable &table, vector<Function> &function_set) {
+            table.unary.clear();
+            table.binary.clear();
+            for (auto function: function_set) {
+                if (is_binary_function(function)) {
+                    table.binary.push_back(function);
+                } else {
+                    table.unary.push_back(function);
+                }
+            }
+        }
+
+        void rand_different_function(Node &node, FunctionTable &table) {
+            auto &functions = node.node_type == NodeType::BFUNC ? table.binary : table.unary;
+            int len = functions.size();
+            int cur = std::find(functions.begin(), functions.end(), node.function) - functions.begin();
+            if (cur == len) {
+                node.function = functions[gen_rand_int(0, len - 1)];
+                return;
+            }
+            if (len <= 1) {
+                return;
+            }
+            // skip over the current function
+            int rand_int = gen_rand_int(0, len - 2);
+            node.function = functions[rand_int >= cur ? rand_int + 1 : rand_int];
+        }
+
+        void rand_different_terminal(Node &node, pair<float, float> &range, int variable_num) {
+            if (node.node_type == NodeType::CONST) {
+                rand_terminal(node, range, variable_num);
+                return;
+            }
+
+            // a constant is the only different terminal
+            if (variable_num <= 1) {
+                rand_constant(node, range);
+                return;
+            }
+
+            // drawing the same variable is rejected, so P(constant) = p / (1 - (1 - p) / n)
+            float p_accept = 1 - (1 - constant_prob) / (float) variable_num;
+            if (p_accept <= 0) {
+                return;
+            }
+            if (gen_rand_float(0, 1) * p_accept < constant_prob) {
+                rand_constant(node, range);
+                return;
+            }
+            int rand_int = gen_rand_int(0, variable_num - 2);
+            node.variable = rand_int >= node.variable ? rand_int + 1 : rand_int;
+        }
+
         TreeNode *
         gen_full_init_tree(int depth, pair<float, float> &range, vector<Function> &func_set, int variable_num) {
             if (depth == 1) {
@@ -190,8 +263,6 @@ namespace cusr {
             return tree_node;
         }
 
-        static bool is_first_rand = true;
-
 #define RETURN_RATE 0.1
 
         TreeNode *
@@ -228,6 +299,49 @@ namespace cusr {
             return tree_node;
         }
 
+        void gen_full_init_prefix(prefix_t &prefix, int depth, pair<float, float> &range, vector<Function> &func_set,
+                                  int variable_num) {
+            prefix.emplace_back();
+            if (depth == 1) {
+                rand_terminal(prefix.back(), range, variable_num);
+                return;
+            }
+            rand_function(prefix.back(), func_set);
+            bool is_binary = prefix.back().node_type == NodeType::BFUNC;
+            gen_full_init_prefix(prefix, depth - 1, range, func_set, variable_num);
+            if (is_binary) {
+                gen_full_init_prefix(prefix, depth - 1, range, func_set, variable_num);
+            }
+        }
+
+        void gen_growth_init_prefix(prefix_t &prefix, int depth, pair<float, float> &range, vector<Function> &func_set,
+                                    int variable_num) {
+            prefix.emplace_back();
+            if (depth == 1) {
+                rand_terminal(prefix.back(), range, variable_num);
+                return;
+            }
+
+            float rand_float = gen_rand_float(0, 1);
+
+            if (!is_first_rand) {
+                if (rand_float <= RETURN_RATE) // if return now
+                {
+                    rand_terminal(prefix.back(), range, variable_num);
+                    return;
+                }
+            }
+
+            is_first_rand = false;
+
+            rand_function(prefix.back(), func_set);
+            bool is_binary = prefix.back().node_type == NodeType::BFUNC;
+            gen_growth_init_prefix(prefix, depth - 1, range, func_set, variable_num);
+            if (is_binary) {
+                gen_growth_init_prefix(prefix, depth - 1, range, func_set, variable_num);
+            }
+        }
+
         void get_init_prefix(prefix_t &prefix, TreeNode *tree_node) {
             if (tree_node == nullptr) {
                 return;
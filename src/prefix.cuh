@@ -8,6 +8,8 @@
 #include <string>
 #include <sstream>
 #include <utility>
+#include <vector>
+#include <algorithm>
 
 /**
  * weights in finding cutting point
@@ -47,15 +49,30 @@ namespace cusr {
             full
         } init_t;
 
+        /**
+         * only the member of the node type is defined, so a node with a double constant still takes 16 bytes
+         */
         struct Node {
-            ntype_t node_type;  // type of the node
-            float constant;     // value of constant
-            int variable;       // the number of variable (e.g., 0 refers to x0; 1 refers to x1).
-            func_t function;    // type of function
+            ntype_t node_type;      // type of the node
+            union {
+                double constant;    // value of constant, rounded to the scalar type of the evaluator
+                int variable;       // the number of variable (e.g., 0 refers to x0; 1 refers to x1).
+                func_t function;    // type of function
+            };
         };
 
         typedef std::vector<Node> prefix_t;
 
+        /**
+         * @param function
+         * @return if or not the function takes two operands
+         */
+        inline bool is_binary_function(Function function) {
+            return function == Function::ADD || function == Function::SUB ||
+                   function == Function::MUL || function == Function::DIV ||
+                   function == Function::MAX || function == Function::MIN;
+        }
+
         /**
          * random integer
          *
@@ -142,6 +159,42 @@ namespace cusr {
          */
         void rand_function(Node &node, vector<Function> &function_set);
 
+        /**
+         * function set partitioned by arity
+         */
+        struct FunctionTable {
+            vector<Function> unary;
+            vector<Function> binary;
+        };
+
+        /**
+         * partition the function set by arity
+         *
+         * @param table
+         * @param function_set
+         */
+        void build_function_table(FunctionTable &table, vector<Function> &function_set);
+
+        /**
+         * replace the function of a node by a different function of the same arity in O(1)
+         * the node is unchanged if there is no other function of that arity
+         *
+         * @param node
+         * @param table
+         */
+        void rand_different_function(Node &node, FunctionTable &table);
+
+        /**
+         * replace a terminal by a different terminal in O(1)
+         * the distribution is the same as drawing rand_terminal until the result differs,
+         * a variable is always replaced by a constant if there is only one variable
+         *
+         * @param node
+         * @param range
+         * @param variable_num
+         */
+        void rand_different_terminal(Node &node, pair<float, float> &range, int variable_num);
+
         struct TreeNode {
             TreeNode() : left(nullptr), right(nullptr) {}
 
@@ -174,6 +227,30 @@ namespace cusr {
         TreeNode *
         gen_growth_init_tree(int depth, pair<float, float> &range, vector<Function> &func_set, int variable_num);
 
+        /**
+         * full initialization, nodes are appended to the prefix directly without building the tree
+         *
+         * @param prefix
+         * @param depth
+         * @param range
+         * @param func_set
+         * @param variable_num
+         */
+        void gen_full_init_prefix(prefix_t &prefix, int depth, pair<float, float> &range, vector<Function> &func_set,
+                                  int variable_num);
+
+        /**
+         * growth initialization, nodes are appended to the prefix directly without building the tree
+         *
+         * @param prefix
+         * @param depth
+         * @param range
+         * @param func_set
+         * @param variable_num
+         */
+        void gen_growth_init_prefix(prefix_t &prefix, int depth, pair<float, float> &range, vector<Function> &func_set,
+                                    int variable_num);
+
         /**
          * convert an expression tree to a prefix
          *
@@ -220,6 +297,35 @@ namespace cusr {
          * @param n
          */
         void set_seed_using_times(int n);
+
+        /**
+         * switch the random engine of the calling thread into the deterministic mode
+         * in deterministic mode, random numbers are drawn from the stream of the calling thread,
+         * which is specified by set_rand_stream, instead of the global random engine
+         * @param deterministic
+         */
+        void set_deterministic(bool deterministic);
+
+        /**
+         * derive the random stream of the calling thread from (seed, generation, index)
+         * the same triple always produces the same sequence of random numbers
+         * @param seed
+         * @param generation
+         * @param index index of the individual
+         */
+        void set_rand_stream(unsigned long long seed, int generation, int index);
+
+        /**
+         * counter-based generator of the random streams, advances the state and returns the next number
+         * @param state
+         * @return
+         */
+        inline unsigned long long splitmix64(unsigned long long &state) {
+            unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
     }
 }
 #endif //LUMINOCUGP_PREFIX_CUH
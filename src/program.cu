@@ -1,186 +1,648 @@
 #include "program.cuh"
+#include <climits>
+#include <cstring>
+
+/**
+ * tag bytes of the program encoding
+ */
+#define TAG_FUNCTION 0x00        // + function
+#define TAG_FLOAT 0x20           // 4-byte constant
+#define TAG_DOUBLE 0x21          // 8-byte constant
+#define TAG_VARIABLE 0x22        // varint variable
+#define TAG_SHORT_VARIABLE 0x40  // + variable below 192
+
 namespace cusr {
     namespace program {
 
-        Program crossover_mutation(Program &parent, Program &donor) {
-            Program ret;
-            auto donor_index = rand_subtree_index_roulette(donor.prefix, true);
-            auto parent_index = rand_subtree_index_roulette(parent.prefix, true);
-
-            int length =
-                    parent.length - parent_index.second + parent_index.first + donor_index.second - donor_index.first;
-            ret.prefix.resize(length);
-            if (parent_index.first > 0) {
-                std::copy(parent.prefix.begin(), parent.prefix.begin() + parent_index.first, ret.prefix.begin());
+        void update_var_bits(Program &program) {
+            program.var_bits.clear();
+            for (auto &node: program.prefix) {
+                if (node.node_type == NodeType::VAR) {
+                    int word = node.variable >> 6;
+                    if (word >= program.var_bits.size()) {
+                        program.var_bits.resize(word + 1, 0);
+                    }
+                    program.var_bits[word] |= 1ULL << (node.variable & 63);
+                }
             }
-            std::copy(donor.prefix.begin() + donor_index.first, donor.prefix.begin() + donor_index.second,
-                      ret.prefix.begin() + parent_index.first);
-            int tmp_start_pos = length - ((int) parent.prefix.size() - parent_index.second);
-            std::copy(parent.prefix.begin() + parent_index.second, parent.prefix.end(),
-                      ret.prefix.begin() + tmp_start_pos);
-            ret.length = length;
-            ret.depth = get_depth_of_prefix(ret.prefix);
-            return ret;
         }
 
-        Program
-        point_mutation(Program &program, vector<Function> &function_set, pair<float, float> &range, int variable_num) {
-            Program ret;
-            ret.prefix.assign(program.prefix.begin(), program.prefix.end());
-            int pos = gen_rand_int(0, program.length - 1);
+        void update_program_info(Program &program) {
+            int len = program.prefix.size();
+            program.subtree_size.resize(len);
+            program.height.resize(len);
+            program.node_depth.resize(len);
+            program.var_bits.clear();
+            program.function_pos.clear();
+            program.terminal_pos.clear();
 
-            if (ret.prefix[pos].node_type == NodeType::BFUNC) {
-                auto pre_func = ret.prefix[pos].function;
-                rand_function(ret.prefix[pos], function_set);
-                while (ret.prefix[pos].function == pre_func || ret.prefix[pos].node_type == NodeType::UFUNC) {
-                    rand_function(ret.prefix[pos], function_set);
-                }
-            } else if (ret.prefix[pos].node_type == NodeType::UFUNC) {
-                auto pre_func = ret.prefix[pos].function;
-                rand_function(ret.prefix[pos], function_set);
-                while (ret.prefix[pos].function == pre_func || ret.prefix[pos].node_type == NodeType::BFUNC) {
-                    rand_function(ret.prefix[pos], function_set);
+            // children of node i are (i + 1) and (i + 1 + subtree_size[i + 1]), which are visited before i
+            for (int i = len - 1; i >= 0; i--) {
+                Node &node = program.prefix[i];
+                if (node.node_type == NodeType::BFUNC) {
+                    int left = i + 1;
+                    int right = left + program.subtree_size[left];
+                    program.subtree_size[i] = 1 + program.subtree_size[left] + program.subtree_size[right];
+                    program.height[i] = 1 + max(program.height[left], program.height[right]);
+                } else if (node.node_type == NodeType::UFUNC) {
+                    program.subtree_size[i] = 1 + program.subtree_size[i + 1];
+                    program.height[i] = 1 + program.height[i + 1];
+                } else {
+                    program.subtree_size[i] = 1;
+                    program.height[i] = 1;
+                    if (node.node_type == NodeType::VAR) {
+                        int word = node.variable >> 6;
+                        if (word >= program.var_bits.size()) {
+                            program.var_bits.resize(word + 1, 0);
+                        }
+                        program.var_bits[word] |= 1ULL << (node.variable & 63);
+                    }
                 }
-            } else if (ret.prefix[pos].node_type == NodeType::VAR) {
-                int pre_var = ret.prefix[pos].variable;
-                rand_terminal(ret.prefix[pos], range, variable_num);
-                while (ret.prefix[pos].node_type == NodeType::VAR && ret.prefix[pos].variable == pre_var) {
-                    rand_terminal(ret.prefix[pos], range, variable_num);
+            }
+
+            if (len > 0) {
+                program.node_depth[0] = 1;
+            }
+            for (int i = 0; i < len; i++) {
+                Node &node = program.prefix[i];
+                if (node.node_type == NodeType::BFUNC) {
+                    program.node_depth[i + 1] = program.node_depth[i] + 1;
+                    program.node_depth[i + 1 + program.subtree_size[i + 1]] = program.node_depth[i] + 1;
+                    program.function_pos.push_back(i);
+                } else if (node.node_type == NodeType::UFUNC) {
+                    program.node_depth[i + 1] = program.node_depth[i] + 1;
+                    program.function_pos.push_back(i);
+                } else {
+                    program.terminal_pos.push_back(i);
                 }
+            }
+
+            program.length = len;
+            program.depth = len > 0 ? program.height[0] : 0;
+        }
+
+        /**
+         * select a node class by its total weight, then a node uniformly in the class
+         *
+         * @param program
+         * @param function_begin range [function_begin, function_end) of program.function_pos
+         * @param function_end
+         * @param terminal_begin range [terminal_begin, terminal_end) of program.terminal_pos
+         * @param terminal_end
+         * @param allow_terminal
+         * @return
+         */
+        static int rand_roulette_pos_in(Program &program, int function_begin, int function_end, int terminal_begin,
+                                        int terminal_end, bool allow_terminal) {
+            int function_num = function_end - function_begin;
+            int terminal_num = terminal_end - terminal_begin;
+
+            bool choose_function;
+            if (function_num == 0 || terminal_num == 0 || !allow_terminal) {
+                choose_function = function_num > 0;
             } else {
-                float pre_const = ret.prefix[pos].constant;
-                rand_terminal(ret.prefix[pos], range, variable_num);
-                while (ret.prefix[pos].node_type == NodeType::CONST && ret.prefix[pos].constant == pre_const) {
-                    rand_terminal(ret.prefix[pos], range, variable_num);
-                }
+                float function_total = FUNCTION_WEIGHTS * function_num;
+                float total = function_total + TERMINAL_WEIGHTS * terminal_num;
+                choose_function = gen_rand_float(0, 1) * total < function_total;
+            }
+
+            if (choose_function) {
+                return program.function_pos[function_begin + gen_rand_int(0, function_num - 1)];
             }
+            return program.terminal_pos[terminal_begin + gen_rand_int(0, terminal_num - 1)];
+        }
 
-            ret.length = program.length;
-            ret.depth = program.depth;
-            return ret;
+        int rand_roulette_pos(Program &program, int begin, int end, bool allow_terminal) {
+            auto &function_pos = program.function_pos;
+            auto &terminal_pos = program.terminal_pos;
+            int function_begin = std::lower_bound(function_pos.begin(), function_pos.end(), begin) -
+                                 function_pos.begin();
+            int function_end = std::lower_bound(function_pos.begin(), function_pos.end(), end) - function_pos.begin();
+            int terminal_begin = std::lower_bound(terminal_pos.begin(), terminal_pos.end(), begin) -
+                                 terminal_pos.begin();
+            int terminal_end = std::lower_bound(terminal_pos.begin(), terminal_pos.end(), end) - terminal_pos.begin();
+            return rand_roulette_pos_in(program, function_begin, function_end, terminal_begin, terminal_end,
+                                        allow_terminal);
         }
 
-        Program hoist_mutation(Program &program) {
-            if (program.prefix.size() <= 6) {
-                return program;
+        int rand_roulette_pos(Program &program, bool allow_terminal) {
+            // the whole prefix covers the whole position lists, no search is needed
+            return rand_roulette_pos_in(program, 0, (int) program.function_pos.size(), 0,
+                                        (int) program.terminal_pos.size(), allow_terminal);
+        }
+
+        pair<int, int> rand_subtree_index_roulette(Program &program, bool allow_terminal) {
+            int pos = rand_roulette_pos(program, allow_terminal);
+            return get_subtree_index(program, pos);
+        }
+
+        /**
+         * append the positions of pos_list in [begin, end) to ret_list, shifted by offset
+         */
+        static void splice_pos(const vector<int> &pos_list, int begin, int end, int offset, vector<int> &ret_list) {
+            auto first = std::lower_bound(pos_list.begin(), pos_list.end(), begin);
+            auto last = std::lower_bound(first, pos_list.end(), end);
+            for (auto it = first; it != last; ++it) {
+                ret_list.push_back(*it + offset);
             }
+        }
 
-            auto subtree_index_1 = rand_subtree_index_roulette(program.prefix, false);
-            prefix_t tmp(program.prefix.begin() + subtree_index_1.first,
-                         program.prefix.begin() + subtree_index_1.second);
+        /**
+         * replace the subtree parent_index of the parent by the subtree donor_index of the donor
+         * the metadata of the offspring is derived from those of the parent and the donor,
+         * only the ancestors of the replaced subtree are updated
+         *
+         * @param parent
+         * @param parent_index
+         * @param donor
+         * @param donor_index
+         * @param ret
+         */
+        static void replace_subtree(const Program &parent, pair<int, int> parent_index,
+                                    const Program &donor, pair<int, int> donor_index, Program &ret) {
+            int donor_len = donor_index.second - donor_index.first;
+            int delta = donor_len - (parent_index.second - parent_index.first);
+            int length = parent.length + delta;
+            int depth_offset = parent.node_depth[parent_index.first] - donor.node_depth[donor_index.first];
 
-            auto subtree_index_2 = rand_subtree_index_roulette(tmp, true);
+            ret.prefix.resize(length);
+            ret.subtree_size.resize(length);
+            ret.height.resize(length);
+            ret.node_depth.resize(length);
+
+            // nodes before the replaced subtree
+            std::copy(parent.prefix.begin(), parent.prefix.begin() + parent_index.first, ret.prefix.begin());
+            std::copy(parent.subtree_size.begin(), parent.subtree_size.begin() + parent_index.first,
+                      ret.subtree_size.begin());
+            std::copy(parent.height.begin(), parent.height.begin() + parent_index.first, ret.height.begin());
+            std::copy(parent.node_depth.begin(), parent.node_depth.begin() + parent_index.first,
+                      ret.node_depth.begin());
+
+            // nodes of the donor subtree
+            int pos = parent_index.first;
+            std::copy(donor.prefix.begin() + donor_index.first, donor.prefix.begin() + donor_index.second,
+                      ret.prefix.begin() + pos);
+            std::copy(donor.subtree_size.begin() + donor_index.first, donor.subtree_size.begin() + donor_index.second,
+                      ret.subtree_size.begin() + pos);
+            std::copy(donor.height.begin() + donor_index.first, donor.height.begin() + donor_index.second,
+                      ret.height.begin() + pos);
+            for (int i = 0; i < donor_len; i++) {
+                ret.node_depth[pos + i] = donor.node_depth[donor_index.first + i] + depth_offset;
+            }
+
+            // nodes after the replaced subtree
+            pos += donor_len;
+            std::copy(parent.prefix.begin() + parent_index.second, parent.prefix.end(), ret.prefix.begin() + pos);
+            std::copy(parent.subtree_size.begin() + parent_index.second, parent.subtree_size.end(),
+                      ret.subtree_size.begin() + pos);
+            std::copy(parent.height.begin() + parent_index.second, parent.height.end(), ret.height.begin() + pos);
+            std::copy(parent.node_depth.begin() + parent_index.second, parent.node_depth.end(),
+                      ret.node_depth.begin() + pos);
+
+            // ancestors of the replaced subtree, from the root
+            static thread_local vector<int> path;
+            path.clear();
+            for (int node = 0; node != parent_index.first;) {
+                path.push_back(node);
+                int left = node + 1;
+                if (parent.prefix[node].node_type == NodeType::BFUNC &&
+                    parent_index.first >= left + parent.subtree_size[left]) {
+                    node = left + parent.subtree_size[left];
+                } else {
+                    node = left;
+                }
+            }
 
-            while (subtree_index_2.first == 0) {
-                subtree_index_2 = rand_subtree_index_roulette(tmp, true);
+            // update ancestors bottom-up
+            for (int i = (int) path.size() - 1; i >= 0; i--) {
+                int node = path[i];
+                int left = node + 1;
+                ret.subtree_size[node] += delta;
+                if (ret.prefix[node].node_type == NodeType::BFUNC) {
+                    int right = left + ret.subtree_size[left];
+                    ret.height[node] = 1 + max(ret.height[left], ret.height[right]);
+                } else {
+                    ret.height[node] = 1 + ret.height[left];
+                }
             }
 
-            Program ret;
+            // node positions of each class
+            ret.function_pos.clear();
+            ret.terminal_pos.clear();
+            int donor_offset = parent_index.first - donor_index.first;
+            splice_pos(parent.function_pos, 0, parent_index.first, 0, ret.function_pos);
+            splice_pos(donor.function_pos, donor_index.first, donor_index.second, donor_offset, ret.function_pos);
+            splice_pos(parent.function_pos, parent_index.second, parent.length, delta, ret.function_pos);
+            splice_pos(parent.terminal_pos, 0, parent_index.first, 0, ret.terminal_pos);
+            splice_pos(donor.terminal_pos, donor_index.first, donor_index.second, donor_offset, ret.terminal_pos);
+            splice_pos(parent.terminal_pos, parent_index.second, parent.length, delta, ret.terminal_pos);
+
+            ret.length = length;
+            ret.depth = ret.height[0];
+            update_var_bits(ret);
+        }
+
+#define DONOR_SAMPLE_TIMES 8
 
-            if (subtree_index_1.first > 0) {
-                ret.prefix.assign(program.prefix.begin(), program.prefix.begin() + subtree_index_1.first);
+        /**
+         * find the root of a donor subtree by roulette, the height and the length of which are restricted
+         * a terminal always satisfies the restriction if max_height >= 1 and max_length >= 1
+         *
+         * @param donor
+         * @param max_height
+         * @param max_length
+         * @return
+         */
+        static int rand_donor_pos(Program &donor, int max_height, int max_length) {
+            // most of the draws satisfy the restriction, try the O(1) roulette first
+            for (int i = 0; i < DONOR_SAMPLE_TIMES; i++) {
+                int pos = rand_roulette_pos(donor, true);
+                if (donor.height[pos] <= max_height && donor.subtree_size[pos] <= max_length) {
+                    return pos;
+                }
             }
-            for (int i = subtree_index_2.first; i < subtree_index_2.second; i++) {
-                ret.prefix.emplace_back(tmp[i]);
+
+            // roulette over the legal nodes only
+            int function_num = 0;
+            for (int pos: donor.function_pos) {
+                if (donor.height[pos] <= max_height && donor.subtree_size[pos] <= max_length) {
+                    function_num++;
+                }
+            }
+            int terminal_num = donor.terminal_pos.size();
+
+            double total_weight = FUNCTION_WEIGHTS * function_num + TERMINAL_WEIGHTS * terminal_num;
+            bool choose_function = function_num > 0 &&
+                                   gen_rand_float(0, 1) * total_weight < FUNCTION_WEIGHTS * function_num;
+            if (!choose_function) {
+                return donor.terminal_pos[gen_rand_int(0, terminal_num - 1)];
             }
 
-            if (subtree_index_1.second < program.prefix.size()) {
-                for (int i = subtree_index_1.second; i < program.prefix.size(); i++) {
-                    ret.prefix.emplace_back(program.prefix[i]);
+            int target = gen_rand_int(0, function_num - 1);
+            for (int pos: donor.function_pos) {
+                if (donor.height[pos] <= max_height && donor.subtree_size[pos] <= max_length && target-- == 0) {
+                    return pos;
                 }
             }
+            return donor.terminal_pos[0];
+        }
+
+        void crossover_mutation(Program &parent, Program &donor, Program &ret, int max_depth, int max_length) {
+            auto parent_index = rand_subtree_index_roulette(parent, true);
+
+            // the donor subtree must fit in the depth and the length left by the replaced subtree
+            int max_height = max_depth - parent.node_depth[parent_index.first] + 1;
+            int max_subtree_length = max_length - (parent.length - parent.subtree_size[parent_index.first]);
+            auto donor_index = get_subtree_index(donor, rand_donor_pos(donor, max_height, max_subtree_length));
+
+            replace_subtree(parent, parent_index, donor, donor_index, ret);
+        }
+
+        /**
+         * mutate a node to a different node of the same kind
+         */
+        static void mutate_node(Node &node, FunctionTable &function_table, pair<float, float> &range,
+                                int variable_num) {
+            if (node.node_type == NodeType::BFUNC || node.node_type == NodeType::UFUNC) {
+                rand_different_function(node, function_table);
+            } else {
+                rand_different_terminal(node, range, variable_num);
+            }
+        }
+
+        void point_mutation(Program &program, FunctionTable &function_table, pair<float, float> &range,
+                            int variable_num) {
+            int pos = gen_rand_int(0, program.length - 1);
+            auto pre_type = program.prefix[pos].node_type;
+            mutate_node(program.prefix[pos], function_table, range, variable_num);
+            if (pre_type == NodeType::VAR || program.prefix[pos].node_type == NodeType::VAR) {
+                update_var_bits(program);
+            }
+        }
+
+        void hoist_mutation(Program &program) {
+            if (program.prefix.size() <= 6) {
+                return;
+            }
 
-            ret.length = ret.prefix.size();
-            ret.depth = get_depth_of_prefix(ret.prefix);
-            return ret;
+            // subtree B is selected from the nodes of subtree A except its root
+            auto subtree_index_1 = rand_subtree_index_roulette(program, false);
+            int pos = rand_roulette_pos(program, subtree_index_1.first + 1, subtree_index_1.second, true);
+            auto subtree_index_2 = get_subtree_index(program, pos);
+
+            // build into a reusable buffer, then exchange the buffers
+            static thread_local Program ret;
+            replace_subtree(program, subtree_index_1, program, subtree_index_2, ret);
+            std::swap(program, ret);
         }
 
-        Program subtree_mutation(Program &program, int depth_of_rand_tree,
-                                 pair<float, float> &range, vector<Function> &func_set, int variable_num) {
-            prefix_t rand_prefix;
+        void subtree_mutation(Program &program, Program &ret, int depth_of_rand_tree,
+                              pair<float, float> &range, vector<Function> &func_set, int variable_num,
+                              int max_depth, int max_length) {
+            static thread_local Program temp;
+            temp.prefix.clear();
             if (gen_rand_float(0, 1) < 0.5) {
-                get_init_prefix(rand_prefix, gen_full_init_tree(depth_of_rand_tree, range, func_set, variable_num));
+                gen_full_init_prefix(temp.prefix, depth_of_rand_tree, range, func_set, variable_num);
             } else {
-                get_init_prefix(rand_prefix, gen_growth_init_tree(depth_of_rand_tree, range, func_set, variable_num));
-            }
-
-            Program temp;
-            temp.prefix = rand_prefix;
-            return crossover_mutation(program, temp);
-        }
-
-        void
-        calculate_fitness_cpu(Program *program, const vector<vector<float>> &dataset,
-                              const vector<float> &real_value, int data_size,
-                              metric_t metric_type) {
-            float total_fitness = 0;
-            auto *stack = new float[program->depth + 1];
-
-            for (int row = 0; row < data_size; row++) {
-                int top = 0;
-                for (int i = program->length - 1; i >= 0; i--) {
-                    auto &node = program->prefix[i];
-                    if (node.node_type == NodeType::CONST) {
-                        stack[top++] = node.constant;
-                    } else if (node.node_type == NodeType::VAR) {
-                        stack[top++] = dataset[row][node.variable];
-                    } else if (node.node_type == NodeType::UFUNC) {
-                        float var1 = stack[--top];
-                        if (node.function == Function::SIN) {
-                            stack[top++] = std::sin(var1);
-                        } else if (node.function == Function::COS) {
-                            stack[top++] = std::cos(var1);
-                        } else if (node.function == Function::TAN) {
-                            stack[top++] = std::tan(var1);
-                        } else if (node.function == Function::LOG) {
-                            if (var1 <= 0) {
-                                stack[top++] = -1.0f;
-                            } else {
-                                stack[top++] = std::log(var1);
-                            }
-                        } else if (node.function == Function::INV) {
-                            if (var1 == 0) {
-                                var1 = DELTA;
-                            }
-                            stack[top++] = 1.0f / var1;
-                        }
+                gen_growth_init_prefix(temp.prefix, depth_of_rand_tree, range, func_set, variable_num);
+            }
+            update_program_info(temp);
+            crossover_mutation(program, temp, ret, max_depth, max_length);
+        }
+
+        template<typename T>
+        static void unary_op(Function function, const T *var1, T *out, int n) {
+            if (function == Function::SIN) {
+                for (int r = 0; r < n; r++) { out[r] = std::sin(var1[r]); }
+            } else if (function == Function::COS) {
+                for (int r = 0; r < n; r++) { out[r] = std::cos(var1[r]); }
+            } else if (function == Function::TAN) {
+                for (int r = 0; r < n; r++) { out[r] = std::tan(var1[r]); }
+            } else if (function == Function::LOG) {
+                for (int r = 0; r < n; r++) { out[r] = var1[r] <= 0 ? (T) -1 : std::log(var1[r]); }
+            } else if (function == Function::INV) {
+                for (int r = 0; r < n; r++) { out[r] = (T) 1 / (var1[r] == 0 ? (T) DELTA : var1[r]); }
+            }
+        }
+
+        template<typename T>
+        static void binary_op(Function function, const T *var1, const T *var2, T *out, int n) {
+            if (function == Function::ADD) {
+                for (int r = 0; r < n; r++) { out[r] = var1[r] + var2[r]; }
+            } else if (function == Function::SUB) {
+                for (int r = 0; r < n; r++) { out[r] = var1[r] - var2[r]; }
+            } else if (function == Function::MUL) {
+                for (int r = 0; r < n; r++) { out[r] = var1[r] * var2[r]; }
+            } else if (function == Function::DIV) {
+                for (int r = 0; r < n; r++) { out[r] = var1[r] / (var2[r] == 0 ? (T) DELTA : var2[r]); }
+            } else if (function == Function::MAX) {
+                for (int r = 0; r < n; r++) { out[r] = var1[r] >= var2[r] ? var1[r] : var2[r]; }
+            } else if (function == Function::MIN) {
+                for (int r = 0; r < n; r++) { out[r] = var1[r] <= var2[r] ? var1[r] : var2[r]; }
+            }
+        }
+
+        /**
+         * value of a subtree during the evaluation of a block
+         * ROWS  : one value per row
+         * SCALAR: the subtree has no variable
+         * TABLE : the subtree only depends on a dictionary-encoded variable, one value per dictionary entry
+         */
+        template<typename T>
+        struct BlockOperand {
+            enum { ROWS, SCALAR, TABLE } type;
+            const T *data;
+            T scalar;
+            int variable;
+            int size;
+        };
+
+        /**
+         * values of an operand as an array of n elements (rows, or entries of the same table)
+         */
+        template<typename T>
+        static const T *expand_operand(const BlockOperand<T> &operand, BasicBlockReader<T> &reader, int n, T *tmp,
+                                       bool to_rows) {
+            if (operand.type == BlockOperand<T>::SCALAR) {
+                std::fill(tmp, tmp + n, operand.scalar);
+                return tmp;
+            }
+            if (operand.type == BlockOperand<T>::TABLE && to_rows) {
+                reader.gather(operand.variable, operand.data, tmp);
+                return tmp;
+            }
+            return operand.data;
+        }
+
+        template<typename T>
+        static const T *eval_block(Program &program, BasicBlockReader<T> &reader) {
+            typedef BlockOperand<T> Operand;
+            int n = reader.block_size();
+
+            // each level of the stack owns a buffer of the block, a variable is pushed as its column directly
+            static thread_local vector<T> buffer;
+            static thread_local vector<T> expanded;
+            static thread_local vector<Operand> stack;
+            size_t levels = program.depth + 1;
+            if (buffer.size() < levels * n) {
+                buffer.resize(levels * n);
+            }
+            if (expanded.size() < 2 * n) {
+                expanded.resize(2 * n);
+            }
+            if (stack.size() < levels) {
+                stack.resize(levels);
+            }
+
+            // subtrees of a single dictionary-encoded variable are computed once per dictionary entry,
+            // the rows are gathered when the subtree meets another variable
+            int top = 0;
+            for (int i = program.length - 1; i >= 0; i--) {
+                auto &node = program.prefix[i];
+                if (node.node_type == NodeType::CONST) {
+                    stack[top++] = {Operand::SCALAR, nullptr, (T) node.constant, -1, 1};
+                } else if (node.node_type == NodeType::VAR) {
+                    const ColumnDictionary *dict = reader.dictionary(node.variable);
+                    if (dict != nullptr && dict->size * 4 <= n) {
+                        stack[top++] = {Operand::TABLE, reader.dictionary_values(node.variable), 0, node.variable,
+                                        dict->size};
+                    } else {
+                        stack[top++] = {Operand::ROWS, reader.column(node.variable), 0, node.variable, n};
+                    }
+                } else if (node.node_type == NodeType::UFUNC) {
+                    Operand var1 = stack[--top];
+                    if (var1.type == Operand::SCALAR) {
+                        unary_op(node.function, &var1.scalar, &var1.scalar, 1);
+                    } else {
+                        T *out = &buffer[top * n];
+                        unary_op(node.function, var1.data, out, var1.size);
+                        var1.data = out;
+                    }
+                    stack[top++] = var1;
+                } else {
+                    Operand var1 = stack[--top];
+                    Operand var2 = stack[--top];
+                    Operand result;
+                    if (var1.type == Operand::SCALAR && var2.type == Operand::SCALAR) {
+                        result = var1;
+                        binary_op(node.function, &var1.scalar, &var2.scalar, &result.scalar, 1);
                     } else {
-                        float var1 = stack[--top];
-                        float var2 = stack[--top];
-                        if (node.function == Function::ADD) {
-                            stack[top++] = var1 + var2;
-                        } else if (node.function == Function::SUB) {
-                            stack[top++] = var1 - var2;
-                        } else if (node.function == Function::MUL) {
-                            stack[top++] = var1 * var2;
-                        } else if (node.function == Function::DIV) {
-                            if (var2 == 0) {
-                                var2 = DELTA;
-                            }
-                            stack[top++] = var1 / var2;
-                        } else if (node.function == Function::MAX) {
-                            stack[top++] = var1 >= var2 ? var1 : var2;
-                        } else if (node.function == Function::MIN) {
-                            stack[top++] = var1 <= var2 ? var1 : var2;
+                        bool same_table = var1.type != Operand::ROWS && var2.type != Operand::ROWS &&
+                                          (var1.type == Operand::SCALAR || var2.type == Operand::SCALAR ||
+                                           var1.variable == var2.variable);
+                        result = var1.type == Operand::SCALAR ? var2 : var1;
+                        if (!same_table) {
+                            result.type = Operand::ROWS;
+                            result.size = n;
                         }
+                        const T *data1 = expand_operand(var1, reader, result.size, &expanded[0], !same_table);
+                        const T *data2 = expand_operand(var2, reader, result.size, &expanded[n], !same_table);
+                        T *out = &buffer[top * n];
+                        binary_op(node.function, data1, data2, out, result.size);
+                        result.data = out;
                     }
+                    stack[top++] = result;
                 }
+            }
+            return expand_operand(stack[0], reader, n, &expanded[0], true);
+        }
 
-                float metric = stack[top - 1] - real_value[row];
-                if (metric_type == metric_t::mean_square_error || metric_type == metric_t::root_mean_square_error) {
-                    total_fitness += metric * metric;
-                } else {
-                    total_fitness += metric > 0 ? metric : -metric;
+        const float *eval_block_cpu(Program &program, BlockReader &reader) {
+            return eval_block(program, reader);
+        }
+
+        const double *eval_block_cpu(Program &program, DoubleBlockReader &reader) {
+            return eval_block(program, reader);
+        }
+
+        /**
+         * sum of loss(r) over the rows of a block, each row is added to one of LOSS_LANES double lanes,
+         * the lanes have no serial dependency and are kept in vector registers, and they are summed pairwise.
+         * the error of the sum does not grow with the number of rows
+         */
+        template<typename F>
+        static double accumulate_loss(int n, F loss) {
+            double lane[LOSS_LANES] = {};
+            int r = 0;
+            for (; r + LOSS_LANES <= n; r += LOSS_LANES) {
+                for (int j = 0; j < LOSS_LANES; j++) {
+                    lane[j] += loss(r + j);
+                }
+            }
+            for (int j = 0; r < n; r++, j++) {
+                lane[j] += loss(r);
+            }
+            for (int width = LOSS_LANES / 2; width > 0; width /= 2) {
+                for (int j = 0; j < width; j++) {
+                    lane[j] += lane[j + width];
                 }
             }
+            return lane[0];
+        }
+
+        template<typename T>
+        static double block_loss(Program &program, BasicBlockReader<T> &reader, metric_t metric_type) {
+            int n = reader.block_size();
+            const T *predict = eval_block(program, reader);
+            const T *real_value = reader.label();
+            const T *weight = reader.weight();
+
+            if (metric_type == metric_t::mean_square_error || metric_type == metric_t::root_mean_square_error) {
+                if (weight == nullptr) {
+                    return accumulate_loss(n, [=](int r) {
+                        T metric = predict[r] - real_value[r];
+                        return metric * metric;
+                    });
+                }
+                return accumulate_loss(n, [=](int r) {
+                    T metric = predict[r] - real_value[r];
+                    return weight[r] * metric * metric;
+                });
+            }
+            if (weight == nullptr) {
+                return accumulate_loss(n, [=](int r) {
+                    return std::fabs(predict[r] - real_value[r]);
+                });
+            }
+            return accumulate_loss(n, [=](int r) {
+                return weight[r] * std::fabs(predict[r] - real_value[r]);
+            });
+        }
+
+        double calculate_block_loss_cpu(Program &program, BlockReader &reader, metric_t metric_type) {
+            return block_loss(program, reader, metric_type);
+        }
+
+        double calculate_block_loss_cpu(Program &program, DoubleBlockReader &reader, metric_t metric_type) {
+            return block_loss(program, reader, metric_type);
+        }
 
-            delete[] stack;
+        template<typename T>
+        static ScalingMoments block_moments(Program &program, BasicBlockReader<T> &reader) {
+            int n = reader.block_size();
+            const T *predict = eval_block(program, reader);
+            const T *real_value = reader.label();
+            const T *weight = reader.weight();
 
+            // like accumulate_loss, the rows are spread over independent lanes
+            ScalingMoments lane[LOSS_LANES];
+            for (int r = 0; r < n; r++) {
+                ScalingMoments &m = lane[r % LOSS_LANES];
+                double w = weight == nullptr ? 1.0 : (double) weight[r];
+                double f = predict[r];
+                double y = real_value[r];
+                m.w += w;
+                m.f += w * f;
+                m.ff += w * f * f;
+                m.fy += w * f * y;
+                m.y += w * y;
+                m.yy += w * y * y;
+            }
+            for (int width = LOSS_LANES / 2; width > 0; width /= 2) {
+                for (int j = 0; j < width; j++) {
+                    lane[j] += lane[j + width];
+                }
+            }
+            return lane[0];
+        }
+
+        ScalingMoments calculate_block_moments_cpu(Program &program, BlockReader &reader) {
+            return block_moments(program, reader);
+        }
+
+        ScalingMoments calculate_block_moments_cpu(Program &program, DoubleBlockReader &reader) {
+            return block_moments(program, reader);
+        }
+
+        double linear_scaling_loss(const ScalingMoments &moments, Program &program) {
+            program.slope = 1;
+            program.intercept = 0;
+            if (moments.w <= 0) {
+                return 0;
+            }
+
+            // centered sums of squares and products
+            double mean_f = moments.f / moments.w;
+            double mean_y = moments.y / moments.w;
+            double var_f = moments.ff - moments.f * mean_f;
+            double cov = moments.fy - moments.f * mean_y;
+            double var_y = moments.yy - moments.y * mean_y;
+            if (!std::isfinite(var_f) || !std::isfinite(cov)) {
+                return std::numeric_limits<double>::infinity();
+            }
+
+            double slope = var_f > SCALING_MIN_VARIANCE * moments.ff ? cov / var_f : 0;
+            program.slope = slope;
+            program.intercept = mean_y - slope * mean_f;
+            return std::max(var_y - slope * cov, 0.0);
+        }
+
+        double loss_to_fitness(double total_loss, double weight_sum, metric_t metric_type) {
+            double fitness = total_loss / weight_sum;
             if (metric_type == root_mean_square_error) {
-                program->fitness = std::sqrt(total_fitness / (float) data_size);
-            } else {
-                program->fitness = total_fitness / (float) data_size;
+                return std::sqrt(fitness);
             }
+            return fitness;
+        }
+
+        template<typename T>
+        static double dataset_loss(Program &program, const DataView &dataset, const DataView &real_value,
+                                   metric_t metric_type) {
+            BasicBlockReader<T> reader(dataset, real_value);
+            PairwiseSum total_loss;
+            for (row_t begin = 0; begin < dataset.rows; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, dataset.rows));
+                total_loss.add(block_loss(program, reader, metric_type));
+            }
+            return total_loss.result();
+        }
+
+        void calculate_fitness_cpu(Program *program, const DataView &dataset, const DataView &real_value,
+                                   metric_t metric_type, dtype_t precision) {
+            double total_loss = precision == dtype_t::float64
+                                ? dataset_loss<double>(*program, dataset, real_value, metric_type)
+                                : dataset_loss<float>(*program, dataset, real_value, metric_type);
+            program->fitness = loss_to_fitness(total_loss, dataset.rows, metric_type);
         }
 
         int tournament_selection_cpu(vector<Program> &population, int tournament_size, float parsimony_coefficient) {
@@ -202,8 +664,7 @@ namespace cusr {
         gen_full_init_program(int depth, pair<float, float> &range, vector<Function> &func_set, int variable_num) {
             auto *program = new Program();
             get_init_prefix(program->prefix, gen_full_init_tree(depth, range, func_set, variable_num));
-            program->length = program->prefix.size();
-            program->depth = get_depth_of_prefix(program->prefix);
+            update_program_info(*program);
             return program;
         }
 
@@ -213,8 +674,7 @@ namespace cusr {
 
             while (true) {
                 get_init_prefix(program->prefix, gen_growth_init_tree(depth, range, func_set, variable_num));
-                program->length = program->prefix.size();
-                program->depth = get_depth_of_prefix(program->prefix);
+                update_program_info(*program);
                 if (program->length != 1) {
                     break;
                 } else {
@@ -226,44 +686,129 @@ namespace cusr {
             return program;
         }
 
-        Program point_replace_mutation(Program &program, vector<Function> &function_set, pair<float, float> &range,
-                                       int variable_num) {
-            Program ret;
-            ret.prefix.assign(program.prefix.begin(), program.prefix.end());
-
+        void point_replace_mutation(Program &program, FunctionTable &function_table, pair<float, float> &range,
+                                    int variable_num) {
             for (int pos = 0; pos < program.length; pos++) {
-                if (ret.prefix[pos].node_type == NodeType::BFUNC) {
-                    auto pre_func = ret.prefix[pos].function;
-                    rand_function(ret.prefix[pos], function_set);
-                    while (ret.prefix[pos].function == pre_func || ret.prefix[pos].node_type == NodeType::UFUNC) {
-                        rand_function(ret.prefix[pos], function_set);
+                mutate_node(program.prefix[pos], function_table, range, variable_num);
+            }
+            update_var_bits(program);
+        }
+
+        template<typename T>
+        static void put(string &buffer, T value) {
+            buffer.append((const char *) &value, sizeof(T));
+        }
+
+        template<typename T>
+        static bool get(const string &buffer, size_t &pos, T &value) {
+            if (buffer.size() - pos < sizeof(T)) {
+                return false;
+            }
+            memcpy(&value, buffer.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return true;
+        }
+
+        static void put_varint(string &buffer, unsigned long long value) {
+            while (value >= 0x80) {
+                buffer.push_back((char) ((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back((char) value);
+        }
+
+        static bool get_varint(const string &buffer, size_t &pos, unsigned long long &value) {
+            value = 0;
+            for (int shift = 0; shift < 64 && pos < buffer.size(); shift += 7) {
+                unsigned char byte = buffer[pos++];
+                value |= (unsigned long long) (byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void encode_program(const Program &program, string &buffer) {
+            put_varint(buffer, program.prefix.size());
+            put(buffer, program.fitness);
+            put(buffer, program.slope);
+            put(buffer, program.intercept);
+            for (auto &node: program.prefix) {
+                if (node.node_type == NodeType::UFUNC || node.node_type == NodeType::BFUNC) {
+                    buffer.push_back((char) (TAG_FUNCTION + node.function));
+                } else if (node.node_type == NodeType::CONST) {
+                    if ((double) (float) node.constant == node.constant) {
+                        buffer.push_back((char) TAG_FLOAT);
+                        put(buffer, (float) node.constant);
+                    } else {
+                        buffer.push_back((char) TAG_DOUBLE);
+                        put(buffer, node.constant);
+                    }
+                } else if (node.variable < 0x100 - TAG_SHORT_VARIABLE) {
+                    buffer.push_back((char) (TAG_SHORT_VARIABLE + node.variable));
+                } else {
+                    buffer.push_back((char) TAG_VARIABLE);
+                    put_varint(buffer, node.variable);
+                }
+            }
+        }
+
+        bool decode_program(const string &buffer, size_t &pos, Program &program, int variable_num) {
+            unsigned long long length;
+            if (!get_varint(buffer, pos, length) || length == 0 || length > buffer.size() - pos ||
+                !get(buffer, pos, program.fitness) || !get(buffer, pos, program.slope) ||
+                !get(buffer, pos, program.intercept)) {
+                return false;
+            }
+
+            // a valid prefix has one more terminal than binary functions, and is complete at its last node only
+            program.prefix.resize(length);
+            long long open = 1;
+            for (auto &node: program.prefix) {
+                if (open <= 0 || pos >= buffer.size()) {
+                    return false;
+                }
+                unsigned char tag = buffer[pos++];
+                node = Node();
+                if (tag >= TAG_SHORT_VARIABLE) {
+                    node.node_type = NodeType::VAR;
+                    node.variable = tag - TAG_SHORT_VARIABLE;
+                    if (node.variable >= variable_num) {
+                        return false;
                     }
-                } else if (ret.prefix[pos].node_type == NodeType::UFUNC) {
-                    auto pre_func = ret.prefix[pos].function;
-                    rand_function(ret.prefix[pos], function_set);
-                    while (ret.prefix[pos].function == pre_func || ret.prefix[pos].node_type == NodeType::BFUNC) {
-                        rand_function(ret.prefix[pos], function_set);
+                    open--;
+                } else if (tag == TAG_VARIABLE) {
+                    unsigned long long variable;
+                    if (!get_varint(buffer, pos, variable) || variable >= (unsigned long long) variable_num) {
+                        return false;
                     }
-                } else if (ret.prefix[pos].node_type == NodeType::VAR) {
-                    int pre_var = ret.prefix[pos].variable;
-                    rand_terminal(ret.prefix[pos], range, variable_num);
-                    // make sure that the variable is different
-                    while (ret.prefix[pos].node_type == NodeType::VAR && ret.prefix[pos].variable == pre_var) {
-                        rand_terminal(ret.prefix[pos], range, variable_num);
+                    node.node_type = NodeType::VAR;
+                    node.variable = (int) variable;
+                    open--;
+                } else if (tag == TAG_FLOAT || tag == TAG_DOUBLE) {
+                    float value;
+                    node.node_type = NodeType::CONST;
+                    if (tag == TAG_FLOAT ? !get(buffer, pos, value) : !get(buffer, pos, node.constant)) {
+                        return false;
                     }
-                } else {
-                    float pre_const = ret.prefix[pos].constant;
-                    rand_terminal(ret.prefix[pos], range, variable_num);
-                    // make sure that constant is different
-                    while (ret.prefix[pos].node_type == NodeType::CONST && ret.prefix[pos].constant == pre_const) {
-                        rand_terminal(ret.prefix[pos], range, variable_num);
+                    if (tag == TAG_FLOAT) {
+                        node.constant = value;
                     }
+                    open--;
+                } else if (tag - TAG_FUNCTION <= Function::INV) {
+                    node.function = (func_t) (tag - TAG_FUNCTION);
+                    node.node_type = is_binary_function(node.function) ? NodeType::BFUNC : NodeType::UFUNC;
+                    open += node.node_type == NodeType::BFUNC;
+                } else {
+                    return false;
                 }
             }
-
-            ret.length = program.length;
-            ret.depth = program.depth;
-            return ret;
+            if (open != 0) {
+                return false;
+            }
+            update_program_info(program);
+            return true;
         }
     }
 }
\ No newline at end of file
@@ -3,15 +3,32 @@
 #define LUMINOCUGP_PROGRAM_CUH
 
 #include "prefix.cuh"
+#include "dataset.cuh"
 #include <cmath>
 #include <memory>
+#include <algorithm>
+#include <limits>
+#include <climits>
 
 #define DELTA 0.01f
 
+/**
+ * number of independent accumulators of the loss of a row block on the CPU
+ */
+#define LOSS_LANES 8
+
+/**
+ * the output of a program is taken as constant under linear scaling
+ * if its variance is below this fraction of its mean square
+ */
+#define SCALING_MIN_VARIANCE 1e-12
+
 namespace cusr {
 
     namespace program {
 
+        using namespace data;
+
         typedef enum Metric {
             mean_absolute_error,
             mean_square_error,
@@ -23,62 +40,318 @@ namespace cusr {
             prefix_t prefix;
             int depth{};
             int length{};
-            float fitness{};
+            double fitness{};
+
+            /**
+             * linear scaling of the output, the prediction is slope * f(x) + intercept
+             * (1 and 0 unless the program is evaluated with linear scaling)
+             */
+            double slope{1};
+            double intercept{};
+
+            /**
+             * per-node metadata, built by update_program_info in a linear pass
+             * and updated incrementally by the variation operators
+             *
+             * subtree_size[i] : length of the subtree rooted at node i
+             * height[i]       : depth of the subtree rooted at node i (a terminal is 1)
+             * node_depth[i]   : depth of node i in the expression tree (the root is 1)
+             * var_bits        : bitset of the variables referenced by the program
+             * function_pos    : positions of function nodes in ascending order
+             * terminal_pos    : positions of terminal nodes in ascending order
+             */
+            vector<int> subtree_size;
+            vector<int> height;
+            vector<int> node_depth;
+            vector<unsigned long long> var_bits;
+            vector<int> function_pos;
+            vector<int> terminal_pos;
+        };
+
+        /**
+         * weighted sums of the output f of a program and the label y over a set of rows,
+         * the least-squares fit slope * f + intercept of y and its squared error follow from them in closed form
+         */
+        struct ScalingMoments {
+            double w = 0;
+            double f = 0;
+            double ff = 0;
+            double fy = 0;
+            double y = 0;
+            double yy = 0;
+
+            ScalingMoments &operator+=(const ScalingMoments &other) {
+                w += other.w;
+                f += other.f;
+                ff += other.ff;
+                fy += other.fy;
+                y += other.y;
+                yy += other.yy;
+                return *this;
+            }
+
+            ScalingMoments operator+(const ScalingMoments &other) const {
+                ScalingMoments ret = *this;
+                return ret += other;
+            }
+        };
+
+        /**
+         * fixed-shape pairwise reduction over a sequence of partial sums
+         * the shape of the reduction tree only depends on the number of partials (like a binary counter),
+         * so the result is bit-identical no matter how the partials are produced
+         */
+        template<typename V>
+        struct BasicPairwiseSum {
+            V partial[64];
+            int level[64];
+            int top = 0;
+
+            void add(const V &value) {
+                partial[top] = value;
+                level[top++] = 0;
+                while (top >= 2 && level[top - 1] == level[top - 2]) {
+                    partial[top - 2] += partial[top - 1];
+                    level[top - 2]++;
+                    top--;
+                }
+            }
+
+            V result() const {
+                V ret{};
+                for (int i = top - 1; i >= 0; i--) {
+                    ret = partial[i] + ret;
+                }
+                return ret;
+            }
         };
 
+        typedef BasicPairwiseSum<double> PairwiseSum;
+        typedef BasicPairwiseSum<ScalingMoments> MomentSum;
+
+
+        /**
+         * build the per-node metadata of a program, and update its length and depth
+         *
+         * @param program
+         */
+        void update_program_info(Program &program);
+
+        /**
+         * rebuild the variable bitset of a program
+         *
+         * @param program
+         */
+        void update_var_bits(Program &program);
+
+        /**
+         * if or not the program references variable x_{variable}
+         *
+         * @param program
+         * @param variable
+         * @return
+         */
+        inline bool uses_variable(const Program &program, int variable) {
+            int word = variable >> 6;
+            return word < program.var_bits.size() && (program.var_bits[word] >> (variable & 63) & 1ULL);
+        }
+
+        /**
+         * get the index {start pos, end_pos + 1} of the subtree rooted at start_pos in O(1)
+         *
+         * @param program
+         * @param start_pos
+         * @return
+         */
+        inline pair<int, int> get_subtree_index(const Program &program, int start_pos) {
+            return {start_pos, start_pos + program.subtree_size[start_pos]};
+        }
+
+        /**
+         * find rand cutting point by roulette in O(1)
+         * a node class (function or terminal) is selected by its total weight, then a node uniformly in the class,
+         * which gives the same distribution as the roulette over all nodes
+         *
+         * @param program
+         * @param allow_terminal
+         * @return
+         */
+        int rand_roulette_pos(Program &program, bool allow_terminal);
+
+        /**
+         * find rand cutting point by roulette in the range [begin, end) of the prefix in O(log n),
+         * the class ranges are found by binary search in the sorted position lists
+         *
+         * @param program
+         * @param begin
+         * @param end
+         * @param allow_terminal
+         * @return
+         */
+        int rand_roulette_pos(Program &program, int begin, int end, bool allow_terminal);
+
+        /**
+         * get the index of a random subtree, the root of which is selected by roulette
+         *
+         * @param program
+         * @param allow_terminal
+         * @return
+         */
+        pair<int, int> rand_subtree_index_roulette(Program &program, bool allow_terminal);
 
         /**
          * crossover mutation
+         * the donor subtree is selected such that the offspring satisfies max_depth and max_length,
+         * provided that the parent does
          *
          * @param parent
          * @param donor
-         * @return
+         * @param ret the offspring, its buffers are reused
+         * @param max_depth
+         * @param max_length
          */
-        Program crossover_mutation(Program &parent, Program &donor);
+        void crossover_mutation(Program &parent, Program &donor, Program &ret, int max_depth, int max_length);
 
         /**
-         * mutate a node of the program correspond to its type
+         * mutate a node of the program correspond to its type in place
          * unary function --> unary function
          * binary function --> binary function
          * terminal --> terminal
          *
          * @param program
-         * @param function_set
+         * @param function_table
          * @param range
          * @param variable_num
-         * @return
          */
-        Program
-        point_mutation(Program &program, vector<Function> &function_set, pair<float, float> &range, int variable_num);
+        void point_mutation(Program &program, FunctionTable &function_table, pair<float, float> &range,
+                            int variable_num);
 
         /**
-         * hoist mutation
+         * hoist mutation in place
          * select subtree A from a program, subtree B from A, replace A from B
          * @param program
-         * @return
          */
-        Program hoist_mutation(Program &program);
+        void hoist_mutation(Program &program);
 
         /**
-         * do point replace mutation for a program
+         * do point replace mutation for a program in place
          *
          * @param program
-         * @return
+         * @param function_table
+         * @param range
+         * @param variable_num
          */
-        Program point_replace_mutation(Program &program, vector<Function> &function_set, pair<float, float> &range,
-                                       int variable_num);
+        void point_replace_mutation(Program &program, FunctionTable &function_table, pair<float, float> &range,
+                                    int variable_num);
 
         /**
          * do subtree mutation for a parent tree
          * @param program
+         * @param ret the offspring, its buffers are reused
          * @param depth_of_rand_tree
          * @param range
          * @param func_set
          * @param variable_num
+         * @param max_depth
+         * @param max_length
+         */
+        void subtree_mutation(Program &program, Program &ret, int depth_of_rand_tree,
+                              pair<float, float> &range, vector<Function> &func_set, int variable_num,
+                              int max_depth, int max_length);
+
+        /**
+         * evaluate a program on the current row block of the reader, in the scalar type of the reader
+         * returns the predicted values of the block, which are valid until the next call
+         *
+         * @param program
+         * @param reader
+         * @return
+         */
+        const float *eval_block_cpu(Program &program, BlockReader &reader);
+
+        const double *eval_block_cpu(Program &program, DoubleBlockReader &reader);
+
+        /**
+         * loss sum of a program on the current row block of the reader, weighted if the reader has weights,
+         * the losses of the rows are accumulated in double
+         *
+         * @param program
+         * @param reader
+         * @param metric
          * @return
          */
-        Program subtree_mutation(Program &program, int depth_of_rand_tree,
-                                 pair<float, float> &range, vector<Function> &func_set, int variable_num);
+        double calculate_block_loss_cpu(Program &program, BlockReader &reader, metric_t metric);
+
+        double calculate_block_loss_cpu(Program &program, DoubleBlockReader &reader, metric_t metric);
+
+        /**
+         * scaling moments of a program on the current row block of the reader, in the same pass as its evaluation
+         *
+         * @param program
+         * @param reader
+         * @return
+         */
+        ScalingMoments calculate_block_moments_cpu(Program &program, BlockReader &reader);
+
+        ScalingMoments calculate_block_moments_cpu(Program &program, DoubleBlockReader &reader);
+
+        template<typename T>
+        inline void add_block_total(Program &program, BasicBlockReader<T> &reader, metric_t metric,
+                                    PairwiseSum &total) {
+            total.add(calculate_block_loss_cpu(program, reader, metric));
+        }
+
+        template<typename T>
+        inline void add_block_total(Program &program, BasicBlockReader<T> &reader, metric_t /*metric*/,
+                                    MomentSum &total) {
+            total.add(calculate_block_moments_cpu(program, reader));
+        }
+
+        /**
+         * add the loss sums (PairwiseSum) or the linear scaling moments (MomentSum) of the programs
+         * over the rows of a dataset to their totals, in scalar type T.
+         * each row block is read (and transposed if needed) once for all programs
+         *
+         * @param programs
+         * @param evaluated programs[i] is skipped if evaluated[i] is set
+         * @param dataset
+         * @param label
+         * @param weight per-row weights, an empty view if the rows are not weighted
+         * @param metric
+         * @param totals
+         */
+        template<typename T, typename S>
+        void add_block_losses(vector<Program> &programs, const vector<char> &evaluated, const DataView &dataset,
+                              const DataView &label, const DataView &weight, metric_t metric, vector<S> &totals) {
+            BasicBlockReader<T> reader(dataset, label, weight);
+            for (row_t begin = 0; begin < dataset.rows; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, dataset.rows));
+                for (int i = 0; i < programs.size(); i++) {
+                    if (!evaluated[i]) {
+                        add_block_total(programs[i], reader, metric, totals[i]);
+                    }
+                }
+            }
+        }
+
+        /**
+         * fit slope * f + intercept to the label by least squares, and store slope and intercept in the program
+         *
+         * @param moments scaling moments of the program over the dataset
+         * @param program
+         * @return the sum of the squared errors of the scaled output, infinity if f is not finite
+         */
+        double linear_scaling_loss(const ScalingMoments &moments, Program &program);
+
+        /**
+         * convert the loss sum over the dataset to the fitness
+         *
+         * @param total_loss
+         * @param weight_sum number of rows, or the sum of the weights of weighted rows
+         * @param metric
+         * @return
+         */
+        double loss_to_fitness(double total_loss, double weight_sum, metric_t metric);
 
         /**
          * evaluation fitness for a single program on the CPU
@@ -86,13 +359,11 @@ namespace cusr {
          * @param program
          * @param dataset
          * @param real_value
-         * @param data_size
-         * @param parsimony_coefficient
+         * @param metric
+         * @param precision dtype_t::float32 or dtype_t::float64, the scalar type of the evaluation
          */
-        void
-        calculate_fitness_cpu(Program *program, const vector<vector<float>> &dataset, const vector<float> &real_value,
-                              int data_size,
-                              metric_t metric);
+        void calculate_fitness_cpu(Program *program, const DataView &dataset, const DataView &real_value,
+                                   metric_t metric, dtype_t precision = dtype_t::float32);
 
         /**
          * tournament selection performed on the CPU
@@ -126,6 +397,29 @@ namespace cusr {
         Program *
         gen_growth_init_program(int depth, pair<float, float> &range, vector<Function> &func_set, int variable_num);
 
+        /**
+         * append the compact binary encoding of a program to a buffer, to send it to another process.
+         * the encoding is the number of nodes, fitness, slope and intercept, followed by one tag byte per node:
+         * a function and a variable below 192 are their tag, other variables and constants follow their tag
+         * (a constant takes 4 bytes if it is exact in float). numbers are in the byte order of the host
+         *
+         * @param program
+         * @param buffer
+         */
+        void encode_program(const Program &program, string &buffer);
+
+        /**
+         * decode a program encoded by encode_program and build its metadata
+         *
+         * @param buffer
+         * @param pos position of the encoding in the buffer, moved past it
+         * @param program
+         * @param variable_num number of variables of the dataset the program is evaluated on
+         * @return false if the encoding is truncated, does not describe a valid prefix,
+         *         or references a variable not below variable_num
+         */
+        bool decode_program(const string &buffer, size_t &pos, Program &program, int variable_num = INT_MAX);
+
     }
 }
 #endif //LUMINOCUGP_PROGRAM_CUH
@@ -0,0 +1,291 @@
+#include "projection.cuh"
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+
+namespace cusr {
+    namespace program {
+
+        using namespace std;
+
+        struct TupleKey {
+            uint32_t bits[PROJECTION_MAX_VARIABLES];
+
+            bool operator==(const TupleKey &other) const {
+                return memcmp(bits, other.bits, sizeof(bits)) == 0;
+            }
+        };
+
+        struct TupleHash {
+            size_t operator()(const TupleKey &key) const {
+                uint64_t hash = 0x9e3779b97f4a7c15ULL;
+                for (uint32_t word: key.bits) {
+                    hash = (hash ^ word) * 0xbf58476d1ce4e5b9ULL;
+                    hash ^= hash >> 31;
+                }
+                return hash;
+            }
+        };
+
+        void ProjectionCache::reset(const DataView &dataset, const DataView &label, const DataView &weight,
+                                    metric_t metric) {
+            clear();
+            this->dataset = dataset;
+            this->label = label;
+            this->weight = weight;
+            this->metric = metric;
+            // the rows are indexed with int, larger datasets are not projected
+            this->max_groups = dataset.rows > INT_MAX ? 0
+                                                      : (int) min((row_t) PROJECTION_MAX_GROUPS, dataset.rows / 8);
+        }
+
+        void ProjectionCache::clear() {
+            cache.clear();
+        }
+
+        Projection *ProjectionCache::find_projection(const vector<int> &variables) {
+            auto it = cache.find(variables);
+            if (it != cache.end()) {
+                return it->second.get();
+            }
+            if (max_groups == 0 || cache.size() >= PROJECTION_MAX_TABLES) {
+                return nullptr;
+            }
+            auto &entry = cache[variables];
+            entry = build_projection(variables);
+            return entry.get();
+        }
+
+        unique_ptr<Projection> ProjectionCache::build_projection(const vector<int> &variables) {
+            int k = variables.size();
+            int rows = dataset.rows;
+            BlockReader reader(dataset, label, weight);
+
+            // group id of each row, given up as soon as there are too many groups
+            unordered_map<TupleKey, int, TupleHash> index;
+            vector<float> tuple_values;
+            vector<int> group_of(rows);
+            vector<const float *> columns(k);
+            for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, rows));
+                for (int j = 0; j < k; j++) {
+                    columns[j] = reader.column(variables[j]);
+                }
+                for (int r = 0; r < reader.block_size(); r++) {
+                    TupleKey key{};
+                    for (int j = 0; j < k; j++) {
+                        memcpy(&key.bits[j], &columns[j][r], sizeof(uint32_t));
+                    }
+                    auto inserted = index.emplace(key, (int) index.size());
+                    if (inserted.second) {
+                        if ((int) index.size() > max_groups) {
+                            return nullptr;
+                        }
+                        for (int j = 0; j < k; j++) {
+                            tuple_values.push_back(columns[j][r]);
+                        }
+                    }
+                    group_of[begin + r] = inserted.first->second;
+                }
+            }
+
+            int groups = index.size();
+            unique_ptr<Projection> projection(new Projection());
+            projection->variables = variables;
+            projection->tuples.resize(groups, k);
+            for (int j = 0; j < k; j++) {
+                float *column = projection->tuples.column(j);
+                for (int g = 0; g < groups; g++) {
+                    column[g] = tuple_values[g * k + j];
+                }
+            }
+            vector<int> count(groups, 0);
+            for (int r = 0; r < rows; r++) {
+                count[group_of[r]]++;
+            }
+            projection->weight.assign(groups, 0);
+            for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, rows));
+                const float *w = reader.weight();
+                for (int r = 0; r < reader.block_size(); r++) {
+                    projection->weight[group_of[begin + r]] += w == nullptr ? 1.0 : w[r];
+                }
+            }
+
+            if (metric != metric_t::mean_absolute_error) {
+                // mean and sum of squared deviations of each group, in two passes
+                auto &mean = projection->mean;
+                auto &ss = projection->ss;
+                mean.assign(groups, 0);
+                ss.assign(groups, 0);
+                for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                    reader.seek(begin, min(begin + ROW_BLOCK_SIZE, rows));
+                    const float *y = reader.label();
+                    const float *w = reader.weight();
+                    for (int r = 0; r < reader.block_size(); r++) {
+                        mean[group_of[begin + r]] += (w == nullptr ? 1.0 : w[r]) * y[r];
+                    }
+                }
+                for (int g = 0; g < groups; g++) {
+                    mean[g] = projection->weight[g] == 0 ? 0 : mean[g] / projection->weight[g];
+                }
+                for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                    reader.seek(begin, min(begin + ROW_BLOCK_SIZE, rows));
+                    const float *y = reader.label();
+                    const float *w = reader.weight();
+                    for (int r = 0; r < reader.block_size(); r++) {
+                        double diff = y[r] - mean[group_of[begin + r]];
+                        ss[group_of[begin + r]] += (w == nullptr ? 1.0 : w[r]) * diff * diff;
+                    }
+                }
+            } else {
+                // (label, weight) of each group sorted by label, with prefix sums
+                auto &offset = projection->offset;
+                auto &labels = projection->labels;
+                auto &prefix = projection->prefix;
+                auto &wprefix = projection->wprefix;
+                offset.assign(groups + 1, 0);
+                for (int g = 0; g < groups; g++) {
+                    offset[g + 1] = offset[g] + count[g];
+                }
+                vector<int> fill(offset.begin(), offset.end() - 1);
+                vector<pair<float, float>> pairs(rows);
+                for (int begin = 0; begin < rows; begin += ROW_BLOCK_SIZE) {
+                    reader.seek(begin, min(begin + ROW_BLOCK_SIZE, rows));
+                    const float *y = reader.label();
+                    const float *w = reader.weight();
+                    for (int r = 0; r < reader.block_size(); r++) {
+                        pairs[fill[group_of[begin + r]]++] = {y[r], w == nullptr ? 1.0f : w[r]};
+                    }
+                }
+                labels.resize(rows);
+                prefix.resize(rows + groups);
+                wprefix.resize(rows + groups);
+                for (int g = 0; g < groups; g++) {
+                    std::sort(pairs.begin() + offset[g], pairs.begin() + offset[g + 1]);
+                    double *sum = &prefix[offset[g] + g];
+                    double *wsum = &wprefix[offset[g] + g];
+                    sum[0] = wsum[0] = 0;
+                    for (int i = offset[g]; i < offset[g + 1]; i++) {
+                        int k = i - offset[g];
+                        labels[i] = pairs[i].first;
+                        sum[k + 1] = sum[k] + (double) pairs[i].second * pairs[i].first;
+                        wsum[k + 1] = wsum[k] + pairs[i].second;
+                    }
+                }
+            }
+            return projection;
+        }
+
+        Projection *ProjectionCache::map_program(Program &program, Program &mapped) {
+            static thread_local vector<int> variables;
+            variables.clear();
+            for (int word = 0; word < program.var_bits.size(); word++) {
+                for (int bit = 0; bit < 64 && program.var_bits[word] >> bit != 0; bit++) {
+                    if (program.var_bits[word] >> bit & 1ULL) {
+                        variables.push_back(word * 64 + bit);
+                    }
+                }
+                if (variables.size() > PROJECTION_MAX_VARIABLES) {
+                    return nullptr;
+                }
+            }
+
+            Projection *projection = find_projection(variables);
+            if (projection == nullptr) {
+                return nullptr;
+            }
+
+            // the program with its variables renumbered to the columns of the projection
+            mapped.prefix = program.prefix;
+            mapped.length = program.length;
+            mapped.depth = program.depth;
+            for (auto &node: mapped.prefix) {
+                if (node.node_type == NodeType::VAR) {
+                    node.variable = std::lower_bound(variables.begin(), variables.end(), node.variable) -
+                                    variables.begin();
+                }
+            }
+
+            return projection;
+        }
+
+        bool ProjectionCache::calculate_loss(Program &program, double &loss) {
+            static thread_local Program mapped;
+            Projection *projection = map_program(program, mapped);
+            if (projection == nullptr) {
+                return false;
+            }
+
+            int groups = projection->tuples.rows;
+            DataView tuples = projection->tuples.dataset();
+            DataView unused_label = projection->tuples.label();
+            BlockReader reader(tuples, unused_label);
+            PairwiseSum total_loss;
+            for (int begin = 0; begin < groups; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, groups));
+                const float *predict = eval_block_cpu(mapped, reader);
+                double block_loss = 0;
+                for (int r = 0; r < reader.block_size(); r++) {
+                    int g = begin + r;
+                    double f = predict[r];
+                    if (metric != metric_t::mean_absolute_error) {
+                        double diff = f - projection->mean[g];
+                        block_loss += projection->weight[g] * diff * diff + projection->ss[g];
+                    } else if (!std::isfinite(f)) {
+                        block_loss += std::fabs(f);
+                    } else {
+                        int n = projection->offset[g + 1] - projection->offset[g];
+                        const float *labels = &projection->labels[projection->offset[g]];
+                        const double *prefix = &projection->prefix[projection->offset[g] + g];
+                        const double *wprefix = &projection->wprefix[projection->offset[g] + g];
+                        int k = std::lower_bound(labels, labels + n, (float) f) - labels;
+                        block_loss += f * wprefix[k] - prefix[k] +
+                                      (prefix[n] - prefix[k]) - f * (wprefix[n] - wprefix[k]);
+                    }
+                }
+                total_loss.add(block_loss);
+            }
+            loss = total_loss.result();
+            return true;
+        }
+
+        bool ProjectionCache::calculate_moments(Program &program, ScalingMoments &moments) {
+            assert(metric != metric_t::mean_absolute_error);
+            static thread_local Program mapped;
+            Projection *projection = map_program(program, mapped);
+            if (projection == nullptr) {
+                return false;
+            }
+
+            // the labels of a group enter through their weight, mean and sum of squared deviations
+            int groups = projection->tuples.rows;
+            DataView tuples = projection->tuples.dataset();
+            DataView unused_label = projection->tuples.label();
+            BlockReader reader(tuples, unused_label);
+            MomentSum total_moments;
+            for (int begin = 0; begin < groups; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, groups));
+                const float *predict = eval_block_cpu(mapped, reader);
+                ScalingMoments block_moments;
+                for (int r = 0; r < reader.block_size(); r++) {
+                    int g = begin + r;
+                    double w = projection->weight[g];
+                    double f = predict[r];
+                    double y = projection->mean[g];
+                    block_moments.w += w;
+                    block_moments.f += w * f;
+                    block_moments.ff += w * f * f;
+                    block_moments.fy += w * f * y;
+                    block_moments.y += w * y;
+                    block_moments.yy += w * y * y + projection->ss[g];
+                }
+                total_moments.add(block_moments);
+            }
+            moments = total_moments.result();
+            return true;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef LUMINOCUGP_PROJECTION_CUH
+#define LUMINOCUGP_PROJECTION_CUH
+
+#include <map>
+#include <memory>
+#include "program.cuh"
+
+/**
+ * max number of variables of a program evaluated on a projection
+ */
+#define PROJECTION_MAX_VARIABLES 4
+
+/**
+ * max number of distinct tuples of a projection, it is also limited to 1/8 of the rows
+ */
+#define PROJECTION_MAX_GROUPS 65536
+
+/**
+ * max number of projections kept by a cache
+ */
+#define PROJECTION_MAX_TABLES 256
+
+namespace cusr {
+    namespace program {
+
+        using namespace std;
+
+        /**
+         * the distinct tuples of a set of columns, and the statistics of the label of the rows in each tuple
+         * (w_i is the weight of row i, 1 if the rows are not weighted)
+         *
+         * mean_square_error / root_mean_square_error:
+         *     sum_i w_i * (f - y_i)^2 = weight * (f - mean)^2 + ss
+         * mean_absolute_error (labels of each group are sorted, k of them are less than f):
+         *     sum_i w_i * |f - y_i| = f * wprefix[k] - prefix[k]
+         *                           + (prefix[n] - prefix[k]) - f * (wprefix[n] - wprefix[k])
+         */
+        struct Projection {
+            vector<int> variables;
+            ColumnStore tuples;         // one row per distinct tuple, column j is variables[j]
+            vector<double> weight;
+            vector<double> mean;
+            vector<double> ss;
+            vector<int> offset;         // sorted labels of group g are labels[offset[g], offset[g + 1])
+            vector<float> labels;
+            vector<double> prefix;      // prefix[offset[g] + g + k] = sum of w * y of the first k labels of group g
+            vector<double> wprefix;     // wprefix[offset[g] + g + k] = sum of w of the first k labels of group g
+        };
+
+        /**
+         * evaluates programs that reference few variables on the distinct tuples of their variables,
+         * weighted by the number (or the weight sum) of the rows of each tuple, instead of on every row.
+         * the projections are built on the first request of a variable set, and are only built
+         * when the number of distinct tuples is small, otherwise the set is marked as not projectable
+         */
+        class ProjectionCache {
+        public:
+
+            /**
+             * @param dataset
+             * @param label
+             * @param weight per-row weights, an empty view if the rows are not weighted
+             * @param metric the label statistics depend on the metric
+             */
+            void reset(const DataView &dataset, const DataView &label, const DataView &weight, metric_t metric);
+
+            void clear();
+
+            /**
+             * calculate the loss sum of a program on the projection of its variables
+             *
+             * @param program
+             * @param loss
+             * @return false if the variables of the program are not projectable
+             */
+            bool calculate_loss(Program &program, double &loss);
+
+            /**
+             * calculate the scaling moments of a program on the projection of its variables,
+             * the cache must be reset with a squared error metric
+             *
+             * @param program
+             * @param moments
+             * @return false if the variables of the program are not projectable
+             */
+            bool calculate_moments(Program &program, ScalingMoments &moments);
+
+        private:
+            DataView dataset;
+            DataView label;
+            DataView weight;
+            metric_t metric = metric_t::mean_absolute_error;
+            int max_groups = 0;
+            map<vector<int>, unique_ptr<Projection>> cache; // nullptr if not projectable
+
+            Projection *find_projection(const vector<int> &variables);
+
+            Projection *map_program(Program &program, Program &mapped);
+
+            unique_ptr<Projection> build_projection(const vector<int> &variables);
+        };
+    }
+}
+#endif //LUMINOCUGP_PROJECTION_CUH
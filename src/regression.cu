@@ -1,4 +1,5 @@
 #include "regression.cuh"
+#include <thread>
 
 namespace cusr {
 
@@ -6,68 +7,632 @@ namespace cusr {
     using namespace program;
     using namespace fit;
 
+    /**
+     * row of the k-th row of the storage sample: all rows of a small dataset,
+     * otherwise STORAGE_SAMPLE_ROWS / ROW_BLOCK_SIZE evenly spaced row blocks
+     *
+     * @param rows
+     * @param k
+     * @return
+     */
+    static row_t sample_row(row_t rows, row_t k) {
+        if (rows <= STORAGE_SAMPLE_ROWS) {
+            return k;
+        }
+        row_t spacing = rows / (STORAGE_SAMPLE_ROWS / ROW_BLOCK_SIZE);
+        return k / ROW_BLOCK_SIZE * spacing + k % ROW_BLOCK_SIZE;
+    }
+
+    static void copy_sample_rows(const vector<vector<float>> &dataset, const vector<float> &label,
+                                 ColumnStore &sample) {
+        row_t rows = dataset.size();
+        sample.resize((int) min(rows, (row_t) STORAGE_SAMPLE_ROWS), dataset[0].size());
+        for (int k = 0; k < sample.rows; k++) {
+            row_t row = sample_row(rows, k);
+            for (int col = 0; col < sample.cols; col++) {
+                sample.column(col)[k] = dataset[row][col];
+            }
+            sample.label_column()[k] = label[row];
+        }
+    }
+
+    RegressionEngine::RegressionEngine(dtype_t precision) : precision(precision) {
+        assert(precision == dtype_t::float32 || precision == dtype_t::float64);
+    }
+
     void RegressionEngine::fit(vector<vector<float>> &dataset, vector<float> &label) {
-        this->dataset = dataset;
-        this->label = label;
-        cusr::program::set_constant_prob(this->p_constant);
-        do_fit_init();
+        vector<float> no_weight;
+        fit(dataset, label, no_weight);
+    }
 
-        clock_t iter_begin = clock();
+    void RegressionEngine::fit(vector<vector<float>> &dataset, vector<float> &label, vector<float> &weight) {
+        assert(!dataset.empty() && dataset.size() == label.size());
+        assert(weight.empty() || weight.size() == label.size());
+
+        int data_size = dataset.size();
+        int variable_num = dataset[0].size();
+        if (storage_type != dtype_t::float32 && !use_gpu && !collapse_duplicates &&
+            packed_dataset.pack(dataset, label, storage_type, true)) {
+            // a reduced-precision storage is packed from the rows one column at a time, without a float32 copy
+            // of the dataset, low-cardinality columns are evaluated on their dictionaries by the CPU evaluator
+            copy_sample_rows(dataset, label, float_sample);
+            this->dataset_view = packed_dataset.dataset();
+            this->label_view = packed_dataset.label();
+        } else {
+            // the rows are separately allocated, so they are gathered into a column-major buffer once
+            owned_dataset.resize(data_size, variable_num);
+            for (int j = 0; j < variable_num; j++) {
+                float *column = owned_dataset.column(j);
+                for (int i = 0; i < data_size; i++) {
+                    column[i] = dataset[i][j];
+                }
+            }
+            if (!use_gpu) {
+                owned_dataset.encode_dictionaries();
+            }
+            this->dataset_view = owned_dataset.dataset();
+            this->label_view = make_vector_view(label.data(), data_size);
+        }
+        this->weight_view = weight.empty() ? DataView() : make_vector_view(weight.data(), data_size);
+        do_fit();
 
-        do_population_init();
-        update_population_attributes();
+        owned_dataset.clear();
+    }
 
-        printf("%15s %15s %15s %15s %15s %15s\n",
-               "gen", "best fit", "best len", "best dep", "max len", "max dep");
-        printf("---------------------------------------------------");
-        printf("---------------------------------------------------\n");
+    void RegressionEngine::fit(vector<vector<double>> &dataset, vector<double> &label) {
+        assert(!dataset.empty() && dataset.size() == label.size());
 
-        printf("%15d %15.5f %15d %15d %15d %15d\n",
-               0, best_program.fitness, best_program.length, best_program.depth, max_length_in_population,
-               max_depth_in_population);
+        int data_size = dataset.size();
+        int variable_num = dataset[0].size();
+        owned_double_dataset.resize(data_size, variable_num);
+        for (int j = 0; j < variable_num; j++) {
+            double *column = owned_double_dataset.column(j);
+            for (int i = 0; i < data_size; i++) {
+                column[i] = dataset[i][j];
+            }
+        }
 
-        int iter_times = 1;
+        this->dataset_view = owned_double_dataset.dataset();
+        this->label_view = make_vector_view(label.data(), data_size);
+        this->weight_view = DataView();
+        do_fit();
 
-        while (true) {
-            gen_next_generation();
+        owned_double_dataset.clear();
+    }
+
+    void RegressionEngine::fit(const DataView &dataset, const DataView &label, const DataView &weight) {
+        this->dataset_view = dataset;
+        this->label_view = label;
+        this->weight_view = weight;
+        do_fit();
+    }
+
+    void RegressionEngine::fit(ChunkStream &stream) {
+        // the views only describe the shape, the rows are read from the stream in each generation
+        this->dataset_view = make_view((const float *) nullptr, stream.rows(), stream.cols(), 0, 0);
+        this->label_view = make_vector_view((const float *) nullptr, stream.rows());
+        this->weight_view = DataView();
+        this->chunk_stream = &stream;
+        do_fit();
+        this->chunk_stream = nullptr;
+    }
+
+    void RegressionEngine::fit(ColumnarFile &file) {
+        this->dataset_view = file.dataset();
+        this->label_view = file.label();
+        this->weight_view = DataView();
+        this->columnar_file = &file;
+        do_fit();
+        this->columnar_file = nullptr;
+    }
+
+    void RegressionEngine::fit(SharedColumnar &segment) {
+        fit(segment.dataset(), segment.label());
+    }
+
+    void RegressionEngine::fit(ShardCluster &cluster) {
+        // the views only describe the shape, the rows are held by the workers
+        this->dataset_view = make_view((const float *) nullptr, cluster.rows(), cluster.cols(), 0, 0);
+        this->label_view = make_vector_view((const float *) nullptr, cluster.rows());
+        this->weight_view = DataView();
+        this->shard_cluster = &cluster;
+        do_fit();
+        this->shard_cluster = nullptr;
+    }
+
+    bool RegressionEngine::rows_in_memory() const {
+        return chunk_stream == nullptr && shard_cluster == nullptr;
+    }
+
+    void RegressionEngine::do_fit() {
+        cusr::program::set_constant_prob(this->p_constant);
+        cusr::program::set_deterministic(this->deterministic);
+        do_fit_init();
+
+        clock_t iter_begin = clock();
+
+        if (resolved.islands > 1) {
+            run_islands();
+        } else if (!migration_address.empty()) {
+            run_remote_island();
+        } else {
+            do_population_init();
             update_population_attributes();
 
+            printf("%15s %15s %15s %15s %15s %15s\n",
+                   "gen", "best fit", "best len", "best dep", "max len", "max dep");
+            printf("---------------------------------------------------");
+            printf("---------------------------------------------------\n");
+
             printf("%15d %15.5f %15d %15d %15d %15d\n",
-                   iter_times, best_program.fitness, best_program.length, best_program.depth, max_length_in_population,
+                   0, best_program.fitness, best_program.length, best_program.depth, max_length_in_population,
                    max_depth_in_population);
 
-            if (++iter_times >= generations || this->best_program.fitness <= this->stopping_criteria) {
-                break;
+            int iter_times = 1;
+
+            while (!evaluation_failed) {
+                current_gen = iter_times;
+                gen_next_generation();
+                if (evaluation_failed) {
+                    break;
+                }
+                update_population_attributes();
+
+                printf("%15d %15.5f %15d %15d %15d %15d\n",
+                       iter_times, best_program.fitness, best_program.length, best_program.depth,
+                       max_length_in_population, max_depth_in_population);
+
+                if (++iter_times >= generations || this->best_program.fitness <= this->stopping_criteria) {
+                    break;
+                }
             }
         }
         this->regress_time_in_sec = (float) (clock() - iter_begin) / (float) CLOCKS_PER_SEC;
         printf("---------------------------------------------------");
         printf("---------------------------------------------------\n");
         cout << "> iteration time: " << regress_time_in_sec << "s" << endl;
-        cout << "> best program:   " << prefix_to_infix(best_program.prefix) << endl << endl << endl;
+        cout << "> best program:   " << prefix_to_infix(best_program.prefix) << endl;
+        if (resolved.linear_scaling) {
+            cout << "> linear scaling: " << best_program.slope << " * f + " << best_program.intercept << endl;
+        }
+        if (resolved.const_optimize_top_k > 0) {
+            long long total_cost = 0;
+            for (long long cost: const_optimize_cost_in_each_gen) {
+                total_cost += cost;
+            }
+            cout << "> constant optimization: " << total_cost << " row evaluations in "
+                 << const_optimize_cost_in_each_gen.size() << " generations" << endl;
+        }
+        if (shard_cluster != nullptr) {
+            cout << "> sharded evaluation: " << shard_cluster->rounds << " rounds, "
+                 << shard_cluster->bytes_sent << " bytes sent, " << shard_cluster->bytes_received
+                 << " bytes received, communication / compute: " << shard_cluster->communication_ratio() << endl;
+        }
+        this->storage_deviation = 0;
+        if (packed_dataset.rows > 0) {
+            report_storage_deviation();
+        }
+        cout << endl << endl;
 
-        if (use_gpu) {
+        if (resolved.use_gpu) {
             freeDataSetAndLabel(&device_dataset);
         }
+        projection_cache.clear();
+        case_store.clear();
+        vector<double>().swap(case_weight_prefix);
+        collapsed_dataset.clear();
+        vector<float>().swap(collapsed_weight);
+        packed_dataset.clear();
+        float_sample.clear();
+        packed_sample.clear();
+        vector<float>().swap(sample_weight);
+    }
+
+    /**
+     * indices of the k best programs in ascending order of fitness, NaN counts as the worst fitness
+     *
+     * @param population
+     * @param k
+     * @return
+     */
+    static vector<int> best_indices(const vector<Program> &population, int k) {
+        vector<int> order(population.size());
+        for (int i = 0; i < population.size(); i++) {
+            order[i] = i;
+        }
+        partial_sort(order.begin(), order.begin() + k, order.end(), [&](int a, int b) {
+            double fitness_a = std::isnan(population[a].fitness) ? HUGE_VAL : population[a].fitness;
+            double fitness_b = std::isnan(population[b].fitness) ? HUGE_VAL : population[b].fitness;
+            return fitness_a < fitness_b || (fitness_a == fitness_b && a < b);
+        });
+        return order;
+    }
+
+    void RegressionEngine::run_islands() {
+        // the islands draw from their own streams, also outside deterministic mode
+        unsigned long long base_seed = seed;
+        if (!deterministic) {
+            std::random_device rd;
+            base_seed = (unsigned long long) rd() << 32 | rd();
+        }
+
+        MigrationNetwork network(resolved.islands, migration_topology, max(1, 2 * migration_size));
+        vector<unique_ptr<RegressionEngine>> engines;
+        for (int i = 0; i < resolved.islands; i++) {
+            unsigned long long state = base_seed + (unsigned long long) i;
+            engines.emplace_back(new RegressionEngine(precision));
+            engines.back()->init_island(*this, splitmix64(state));
+        }
+
+        vector<std::thread> workers;
+        for (int i = 0; i < resolved.islands; i++) {
+            workers.emplace_back(&RegressionEngine::evolve_island, engines[i].get(), i, std::ref(network));
+        }
+        for (auto &worker: workers) {
+            worker.join();
+        }
+
+        printf("%15s %15s %15s %15s %15s %15s\n",
+               "island", "best fit", "best len", "best dep", "generations", "migrants in");
+        printf("---------------------------------------------------");
+        printf("---------------------------------------------------\n");
+
+        int best_island = 0;
+        size_t max_generations = 0;
+        for (int i = 0; i < resolved.islands; i++) {
+            RegressionEngine &engine = *engines[i];
+            printf("%15d %15.5f %15d %15d %15d %15d\n",
+                   i, engine.best_program.fitness, engine.best_program.length, engine.best_program.depth,
+                   (int) engine.best_program_in_each_gen.size(), engine.migrants_received);
+            if (engine.best_program.fitness < engines[best_island]->best_program.fitness) {
+                best_island = i;
+            }
+            max_generations = max(max_generations, engine.best_program_in_each_gen.size());
+        }
+        this->best_program = engines[best_island]->best_program;
+
+        // the best program and the optimization cost over the islands in each generation
+        for (size_t gen = 0; gen < max_generations; gen++) {
+            const Program *gen_best = nullptr;
+            long long cost = 0;
+            for (auto &engine: engines) {
+                if (gen < engine->best_program_in_each_gen.size()) {
+                    const Program &program = engine->best_program_in_each_gen[gen];
+                    if (gen_best == nullptr || program.fitness < gen_best->fitness) {
+                        gen_best = &program;
+                    }
+                }
+                if (gen < engine->const_optimize_cost_in_each_gen.size()) {
+                    cost += engine->const_optimize_cost_in_each_gen[gen];
+                }
+            }
+            this->best_program_in_each_gen.push_back(*gen_best);
+            if (resolved.const_optimize_top_k > 0) {
+                this->const_optimize_cost_in_each_gen.push_back(cost);
+            }
+        }
+    }
+
+    void RegressionEngine::init_island(const RegressionEngine &engine, unsigned long long island_seed) {
+        // the options after the checks of do_fit_init
+        this->population_size = engine.population_size;
+        this->generations = engine.generations;
+        this->tournament_size = engine.tournament_size;
+        this->stopping_criteria = engine.stopping_criteria;
+        this->const_range = engine.const_range;
+        this->init_depth = engine.init_depth;
+        this->init_method = engine.init_method;
+        this->function_set = engine.function_set;
+        this->metric = engine.metric;
+        this->restrict_depth = engine.restrict_depth;
+        this->max_program_depth = engine.max_program_depth;
+        this->parsimony_coefficient = engine.parsimony_coefficient;
+        this->lexicase_cases = engine.lexicase_cases;
+        this->p_crossover = engine.p_crossover;
+        this->p_subtree_mutation = engine.p_subtree_mutation;
+        this->p_hoist_mutation = engine.p_hoist_mutation;
+        this->p_point_mutation = engine.p_point_mutation;
+        this->p_point_replace = engine.p_point_replace;
+        this->p_constant = engine.p_constant;
+        this->deterministic = true;
+        this->seed = island_seed;
+        this->const_optimizer = engine.const_optimizer;
+        this->const_optimize_iterations = engine.const_optimize_iterations;
+        this->const_optimize_batch = engine.const_optimize_batch;
+        this->const_optimize_budget = engine.const_optimize_budget;
+        this->migration_interval = engine.migration_interval;
+        this->migration_size = engine.migration_size;
+        this->resolved = engine.resolved;
+        this->resolved.islands = 1;
+
+        // the prepared (collapsed, packed) dataset of the engine is shared and only read
+        this->dataset_view = engine.dataset_view;
+        this->label_view = engine.label_view;
+        this->weight_view = engine.weight_view;
+        this->weight_sum = engine.weight_sum;
+        this->loss_offset = engine.loss_offset;
+        this->variable_nums = engine.variable_nums;
+        this->depth_limit = engine.depth_limit;
+        this->length_limit = engine.length_limit;
+        build_function_table(this->function_table, this->function_set);
+
+        if (resolved.group_by_projection) {
+            projection_cache.reset(dataset_view, label_view, weight_view, metric);
+        }
+    }
+
+    void RegressionEngine::run_remote_island() {
+        RemoteMigration migration;
+        migration.variable_num = variable_nums;
+        if (!migration.connect(migration_address)) {
+            cerr << "> the island evolves alone" << endl;
+        }
+        evolve_island(0, migration);
+        migration.leave(best_program);
+
+        printf("%15s %15s %15s %15s %15s\n", "generations", "best fit", "best len", "best dep", "migrants in");
+        printf("---------------------------------------------------");
+        printf("---------------------------------------------------\n");
+        printf("%15d %15.5f %15d %15d %15d\n",
+               current_gen, best_program.fitness, best_program.length, best_program.depth, migrants_received);
+    }
+
+    void RegressionEngine::evolve_island(int island, Migration &migration) {
+        // the mode of the random engine is per thread, the islands of run_islands are always deterministic
+        cusr::program::set_deterministic(this->deterministic);
+        do_population_init();
+        update_population_attributes();
+
+        for (current_gen = 1; current_gen < generations; current_gen++) {
+            if (best_program.fitness <= stopping_criteria) {
+                migration.stop();
+            }
+            if (migration.stopped() || evaluation_failed) {
+                break;
+            }
+            gen_next_generation();
+            if (evaluation_failed) {
+                break;
+            }
+            receive_migrants(island, migration);
+            update_population_attributes();
+
+            if (current_gen % migration_interval == 0) {
+                send_migrants(island, migration);
+            }
+        }
+        if (best_program.fitness <= stopping_criteria) {
+            migration.stop();
+        }
+        projection_cache.clear();
+        case_store.clear();
+        vector<double>().swap(case_weight_prefix);
+    }
+
+    void RegressionEngine::send_migrants(int island, Migration &migration) {
+        // random neighbours are drawn from the stream of the generation (index -2)
+        set_rand_stream(seed, current_gen, -2);
+        int k = min(migration_size, population_size);
+        vector<int> order = best_indices(population, k);
+        for (int j = 0; j < k; j++) {
+            migration.send(island, population[order[j]]);
+        }
+    }
+
+    void RegressionEngine::receive_migrants(int island, Migration &migration) {
+        Program migrant;
+        while (migration.receive(island, migrant)) {
+            // the migrant replaces the worst program, NaN counts as the worst fitness
+            int worst = 0;
+            for (int i = 1; i < population_size && !std::isnan(population[worst].fitness); i++) {
+                if (std::isnan(population[i].fitness) || population[i].fitness > population[worst].fitness) {
+                    worst = i;
+                }
+            }
+            population[worst] = std::move(migrant);
+            this->migrants_received++;
+        }
     }
 
     void RegressionEngine::do_fit_init() {
-        assert(!dataset.empty() && dataset.size() == label.size());
+        assert(dataset_view.rows > 0 && dataset_view.rows == label_view.rows);
+        assert(weight_view.rows == 0 || weight_view.rows == dataset_view.rows);
+
+        // the fallbacks only apply to this fit, the options of the engine are kept for the next one
+        resolved.linear_scaling = linear_scaling;
+        resolved.selection = selection;
+        resolved.const_optimize_top_k = const_optimize_top_k;
+        resolved.use_gpu = use_gpu;
+        resolved.islands = islands;
+        resolved.group_by_projection = group_by_projection;
+        resolved.collapse_duplicates = collapse_duplicates;
+
+        if (resolved.linear_scaling && metric == metric_t::mean_absolute_error) {
+            cerr << "> linear scaling has a closed form for squared errors only, linear_scaling is ignored" << endl;
+            resolved.linear_scaling = false;
+        }
+        if (resolved.selection == Selection::epsilon_lexicase && !rows_in_memory()) {
+            cerr << "> lexicase cases are sampled from random rows, tournament selection is used instead" << endl;
+            resolved.selection = Selection::tournament;
+        }
+        if (resolved.const_optimize_top_k > 0 && !rows_in_memory()) {
+            cerr << "> constant optimization needs random access to the rows, const_optimize_top_k is ignored" << endl;
+            resolved.const_optimize_top_k = 0;
+        }
+        if (resolved.use_gpu && !rows_in_memory()) {
+            cerr << "> out-of-core and sharded evaluations run on the CPU, use_gpu is ignored" << endl;
+            resolved.use_gpu = false;
+        }
+        if (resolved.islands > 1 && !migration_address.empty()) {
+            cerr << "> an island process evolves a single population, islands is ignored" << endl;
+            resolved.islands = 1;
+        }
+        if (resolved.islands > 1 && !rows_in_memory()) {
+            cerr << "> the islands need random access to the rows, a single population is evolved" << endl;
+            resolved.islands = 1;
+        }
+        if (resolved.islands > 1 && resolved.use_gpu) {
+            cerr << "> the islands evolve on CPU threads, use_gpu is ignored" << endl;
+            resolved.use_gpu = false;
+        }
+        if (precision == dtype_t::float64) {
+            // the GPU kernels, the projections and the collapsed store are float
+            if (resolved.use_gpu) {
+                cerr << "> double precision evaluation runs on the CPU, use_gpu is ignored" << endl;
+                resolved.use_gpu = false;
+            }
+            if (resolved.group_by_projection || resolved.collapse_duplicates) {
+                cerr << "> group_by_projection and collapse_duplicates are ignored in double precision" << endl;
+                resolved.group_by_projection = false;
+                resolved.collapse_duplicates = false;
+            }
+        }
+
+        this->variable_nums = dataset_view.cols;
+        build_function_table(this->function_table, this->function_set);
 
-        this->variable_nums = dataset[0].size();
+        // offspring are built within the limits, the GPU path is also limited by its stack and constant buffers
+        this->depth_limit = restrict_depth ? max_program_depth : INT_MAX;
+        this->length_limit = INT_MAX;
+        if (resolved.use_gpu) {
+            this->depth_limit = min(this->depth_limit, DEPTH);
+            this->length_limit = MAX_PREFIX_LEN - 1;
+        }
+
+        this->const_optimize_cost_in_each_gen.clear();
+        this->migrants_received = 0;
+        this->evaluation_failed = false;
+
+        // the fitness is the weighted mean of the losses over the original rows
+        this->weight_sum = dataset_view.rows;
+        this->loss_offset = 0;
+        if (weight_view.rows > 0) {
+            vector<double> block(min(dataset_view.rows, (row_t) ROW_BLOCK_SIZE));
+            PairwiseSum total;
+            for (row_t begin = 0; begin < dataset_view.rows; begin += ROW_BLOCK_SIZE) {
+                row_t end = min(begin + ROW_BLOCK_SIZE, dataset_view.rows);
+                read_column(weight_view, 0, begin, end, block.data());
+                double block_sum = 0;
+                for (int i = 0; i < end - begin; i++) {
+                    block_sum += block[i];
+                }
+                total.add(block_sum);
+            }
+            this->weight_sum = total.result();
+        }
+        if (shard_cluster != nullptr) {
+            this->weight_sum = shard_cluster->weight_sum();
+        }
+
+        if (resolved.collapse_duplicates && rows_in_memory() && columnar_file == nullptr) {
+            collapse_duplicate_rows();
+        }
 
-        if (use_gpu) {
+        if (storage_type != dtype_t::float32 && rows_in_memory() && columnar_file == nullptr) {
+            if (resolved.use_gpu) {
+                cerr << "> the GPU evaluates a float32 copy of the dataset, storage_type is ignored" << endl;
+            } else {
+                pack_dataset();
+            }
+        }
+
+        // each island builds its own projections
+        if (resolved.group_by_projection && resolved.islands <= 1) {
+            projection_cache.reset(dataset_view, label_view, weight_view, metric);
+        }
+
+        if (resolved.use_gpu) {
             do_gpu_init();
         }
     }
 
+    void RegressionEngine::collapse_duplicate_rows() {
+        // the mean of the labels of the same x is a sufficient statistic for the squared error only
+        bool by_label = metric == metric_t::mean_absolute_error;
+        double residual = 0;
+        row_t unique_rows = collapse_rows(dataset_view, label_view, weight_view, by_label,
+                                        collapsed_dataset, collapsed_weight, residual);
+        if (unique_rows == dataset_view.rows) {
+            return;
+        }
+
+        if (!resolved.use_gpu) {
+            collapsed_dataset.encode_dictionaries();
+        }
+        // the collapsed rows have their own dictionaries, so the gathered rows of fit(vector) are not kept
+        if (owned_dataset.rows > 0 && owned_dataset.dataset().data == dataset_view.data) {
+            owned_dataset.clear();
+        }
+        this->dataset_view = collapsed_dataset.dataset();
+        this->label_view = collapsed_dataset.label();
+        this->weight_view = make_vector_view(collapsed_weight.data(), unique_rows);
+        this->loss_offset = residual;
+    }
+
+    /**
+     * read a column at the rows of the storage sample (see sample_row), a row block at a time
+     *
+     * @param view
+     * @param col
+     * @param dst
+     */
+    static void read_sample_column(const DataView &view, int col, float *dst) {
+        if (view.rows <= STORAGE_SAMPLE_ROWS) {
+            read_column(view, col, 0, view.rows, dst);
+            return;
+        }
+        for (row_t k = 0; k < STORAGE_SAMPLE_ROWS; k += ROW_BLOCK_SIZE) {
+            row_t begin = sample_row(view.rows, k);
+            read_column(view, col, begin, begin + ROW_BLOCK_SIZE, dst + k);
+        }
+    }
+
+    static void copy_sample_rows(const DataView &dataset, const DataView &label, ColumnStore &sample) {
+        sample.resize((int) min(dataset.rows, (row_t) STORAGE_SAMPLE_ROWS), dataset.cols);
+        for (int col = 0; col < dataset.cols; col++) {
+            read_sample_column(dataset, col, sample.column(col));
+        }
+        read_sample_column(label, 0, sample.label_column());
+    }
+
+    void RegressionEngine::pack_dataset() {
+        // fit(vector) packs the rows and gathers the float32 sample itself
+        if (packed_dataset.rows == 0 || dataset_view.data != packed_dataset.dataset().data) {
+            if (!packed_dataset.pack(dataset_view, label_view, storage_type)) {
+                return;
+            }
+
+            // dictionary-encoded columns are exact and already narrow, they are still read through their
+            // dictionaries
+            DataView packed = packed_dataset.dataset();
+            packed.dictionaries = dataset_view.dictionaries;
+
+            // the storage deviation is measured on a sample, so the float32 copy of the engine is not kept
+            copy_sample_rows(dataset_view, label_view, float_sample);
+            for (ColumnStore *store: {&owned_dataset, &collapsed_dataset}) {
+                if (store->rows > 0 && store->dataset().data == dataset_view.data) {
+                    store->release_columns();
+                }
+            }
+            this->dataset_view = packed;
+            this->label_view = packed_dataset.label();
+        }
+
+        copy_sample_rows(dataset_view, label_view, packed_sample);
+        sample_weight.resize(weight_view.rows > 0 ? float_sample.rows : 0);
+        if (!sample_weight.empty()) {
+            read_sample_column(weight_view, 0, sample_weight.data());
+        }
+    }
+
     void RegressionEngine::do_population_init() {
         this->population.clear();
 
         // full initialize
         if (this->init_method == InitMethod::full) {
             for (int i = 0; i < population_size; i++) {
-                int depth = gen_rand_int(init_depth.first, init_depth.second);
+                set_rand_stream(seed, 0, i);
+                int depth = rand_init_depth();
                 this->population.emplace_back(*gen_full_init_program(depth, const_range, function_set, variable_nums));
             }
         }
@@ -75,7 +640,8 @@ namespace cusr {
         // growth initialize
         if (this->init_method == InitMethod::growth) {
             for (int i = 0; i < population_size; i++) {
-                int depth = gen_rand_int(init_depth.first, init_depth.second);
+                set_rand_stream(seed, 0, i);
+                int depth = rand_init_depth();
                 this->population.emplace_back(
                         *gen_growth_init_program(depth, const_range, function_set, variable_nums));
             }
@@ -88,60 +654,90 @@ namespace cusr {
             int growth_size = population_size - full_size;
 
             for (int i = 0; i < full_size; i++) {
-                int depth = gen_rand_int(init_depth.first, init_depth.second);
+                set_rand_stream(seed, 0, i);
+                int depth = rand_init_depth();
                 this->population.emplace_back(*gen_full_init_program(depth, const_range, function_set, variable_nums));
             }
 
             for (int i = 0; i < growth_size; i++) {
-                int depth = gen_rand_int(init_depth.first, init_depth.second);
+                set_rand_stream(seed, 0, full_size + i);
+                int depth = rand_init_depth();
                 this->population.emplace_back(
                         *gen_growth_init_program(depth, const_range, function_set, variable_nums));
             }
         }
 
-        if (use_gpu) {
+        if (resolved.use_gpu) {
             calculate_population_fitness_gpu();
         } else {
             calculate_population_fitness_cpu();
         }
+        optimize_best_constants();
     }
 
-    Program RegressionEngine::do_mutation(Program &program) {
-        Program ret;
+    int RegressionEngine::rand_init_depth() {
+        int depth = gen_rand_int(init_depth.first, init_depth.second);
 
+        // a tree of depth d has at most 2^d - 1 nodes
+        while (depth > 2 && (depth > depth_limit || depth >= 31 || (1 << depth) - 1 > length_limit)) {
+            depth--;
+        }
+        return depth;
+    }
+
+    void RegressionEngine::do_mutation(Program &program, Program &ret, int offspring) {
         float rand_float = gen_rand_float(0, 1);
 
         if (rand_float < p_crossover) {
-            int index = tournament_selection_cpu(population, tournament_size, parsimony_coefficient);
-            ret = crossover_mutation(program, population[index]);
+            int index = select_parent(offspring, 1);
+            crossover_mutation(program, population[index], ret, depth_limit, length_limit);
         } else if (rand_float < p_crossover + p_hoist_mutation) {
-            ret = hoist_mutation(program);
+            ret = program;
+            hoist_mutation(ret);
         } else if (rand_float < p_crossover + p_hoist_mutation + p_point_mutation) {
-            ret = point_mutation(program, function_set, const_range, variable_nums);
+            ret = program;
+            point_mutation(ret, function_table, const_range, variable_nums);
         } else if (rand_float < p_crossover + p_hoist_mutation + p_point_mutation + p_subtree_mutation) {
             int rand_int = gen_rand_int(init_depth.first, init_depth.second);
-            ret = subtree_mutation(program, rand_int, const_range, function_set, variable_nums);
+            subtree_mutation(program, ret, rand_int, const_range, function_set, variable_nums,
+                             depth_limit, length_limit);
         } else if (rand_float <
                    p_crossover + p_hoist_mutation + p_point_mutation + p_subtree_mutation + p_point_replace) {
-            ret = point_replace_mutation(program, function_set, const_range, variable_nums);
+            ret = program;
+            point_replace_mutation(ret, function_table, const_range, variable_nums);
         } else {
-            return program;
+            ret = program;
         }
+    }
 
-        ret.depth = get_depth_of_prefix(ret.prefix);
+    void RegressionEngine::select_lexicase_parents() {
+        // the sample and the selections are drawn from the stream of the generation (index -1)
+        set_rand_stream(seed, current_gen, -1);
+        unsigned long long state = gen_rand_int(0, INT_MAX);
+        state = state << 31 | gen_rand_int(0, INT_MAX);
 
-        // hoist until the depth under the specified depth
-        while (restrict_depth && ret.depth > max_program_depth) {
-            ret = hoist_mutation(ret);
-            ret.depth = get_depth_of_prefix(ret.prefix);
+        update_used_columns();
+        // weighted rows are sampled in proportion to their weights, the sums are built once per fit
+        if (weight_view.rows > 0 && case_weight_prefix.empty()) {
+            weight_prefix_sums(weight_view, case_weight_prefix);
         }
+        sample_cases(dataset_view, label_view, used_columns, case_weight_prefix, lexicase_cases, state, case_store);
+        calculate_case_errors(population, case_store, case_matrix);
+
+        // a parent and a donor for each offspring
+        epsilon_lexicase_selections(case_matrix, 2 * population_size, splitmix64(state), lexicase_parents);
+    }
 
-        ret.length = ret.prefix.size();
-        return ret;
+    int RegressionEngine::select_parent(int offspring, int which) {
+        if (resolved.selection == Selection::epsilon_lexicase) {
+            return lexicase_parents[2 * offspring + which];
+        }
+        return tournament_selection_cpu(population, tournament_size, parsimony_coefficient);
     }
 
     void RegressionEngine::gen_next_generation() {
-        vector<Program> next_gen;
+        // the buffers of the previous generation are reused
+        next_population.resize(population_size);
 
         // elite strategy
         int best_fitness_index = 0;
@@ -151,23 +747,29 @@ namespace cusr {
             }
         }
 
-        next_gen.emplace_back(population[best_fitness_index]);
+        next_population[0] = population[best_fitness_index];
+
+        if (resolved.selection == Selection::epsilon_lexicase) {
+            select_lexicase_parents();
+        }
 
         // selection and do mutation
         for (int i = 1; i < population_size; i++) {
-            int index = tournament_selection_cpu(population, tournament_size, parsimony_coefficient);
-            next_gen.emplace_back(do_mutation(population[index]));
+            // the stream of each individual is independent of how the others are generated
+            set_rand_stream(seed, current_gen, i);
+            int index = select_parent(i, 0);
+            do_mutation(population[index], next_population[i], i);
         }
 
-        population.assign(next_gen.begin(), next_gen.end());
+        population.swap(next_population);
 
         // fitness evaluation
-        if (use_gpu) {
+        if (resolved.use_gpu) {
             calculate_population_fitness_gpu();
         } else {
             calculate_population_fitness_cpu();
         }
-
+        optimize_best_constants();
     }
 
     void RegressionEngine::update_population_attributes() {
@@ -194,19 +796,216 @@ namespace cusr {
         this->best_program_in_each_gen.emplace_back(this->best_program);
     }
 
+    template<typename S>
+    void RegressionEngine::add_block_losses(vector<Program> &programs, const vector<char> &evaluated,
+                                            const DataView &dataset, const DataView &label, const DataView &weight,
+                                            vector<S> &totals) {
+        if (precision == dtype_t::float64) {
+            program::add_block_losses<double>(programs, evaluated, dataset, label, weight, metric, totals);
+        } else {
+            program::add_block_losses<float>(programs, evaluated, dataset, label, weight, metric, totals);
+        }
+    }
+
+    double RegressionEngine::total_to_fitness(const PairwiseSum &total, Program & /*program*/) {
+        return loss_to_fitness(total.result() + loss_offset, weight_sum, this->metric);
+    }
+
+    double RegressionEngine::total_to_fitness(const MomentSum &total, Program &program) {
+        return loss_to_fitness(linear_scaling_loss(total.result(), program) + loss_offset, weight_sum, this->metric);
+    }
+
+    double RegressionEngine::sample_fitness(const ColumnStore &sample, const DataView &weight,
+                                            double sample_weight_sum) {
+        vector<Program> best(1, best_program);
+        vector<char> evaluated(1, 0);
+        if (resolved.linear_scaling) {
+            vector<MomentSum> totals(1);
+            add_block_losses(best, evaluated, sample.dataset(), sample.label(), weight, totals);
+            return loss_to_fitness(linear_scaling_loss(totals[0].result(), best[0]), sample_weight_sum, metric);
+        }
+        vector<PairwiseSum> totals(1);
+        add_block_losses(best, evaluated, sample.dataset(), sample.label(), weight, totals);
+        return loss_to_fitness(totals[0].result(), sample_weight_sum, metric);
+    }
+
+    void RegressionEngine::report_storage_deviation() {
+        DataView weight;
+        double sample_weight_sum = float_sample.rows;
+        if (!sample_weight.empty()) {
+            weight = make_vector_view(sample_weight.data(), sample_weight.size());
+            PairwiseSum total;
+            for (float w: sample_weight) {
+                total.add(w);
+            }
+            sample_weight_sum = total.result();
+        }
+
+        // both on the same rows, so the difference is the effect of the storage type only
+        float packed_fitness = sample_fitness(packed_sample, weight, sample_weight_sum);
+        float float_fitness = sample_fitness(float_sample, weight, sample_weight_sum);
+        this->storage_deviation = packed_fitness - float_fitness;
+        cout << "> fitness on " << float_sample.rows << " sampled rows: " << packed_fitness << " ("
+             << float_fitness << " in float32, deviation " << storage_deviation << ")" << endl;
+    }
+
+    void RegressionEngine::update_used_columns() {
+        used_columns.assign((variable_nums + 63) / 64, 0);
+        for (auto &program: population) {
+            for (int i = 0; i < program.var_bits.size(); i++) {
+                used_columns[i] |= program.var_bits[i];
+            }
+        }
+    }
+
+    template<typename S>
+    void RegressionEngine::evaluate_population_cpu(vector<Program> &programs, const vector<char> &evaluated) {
+        vector<S> totals(programs.size());
+        bool complete = true;
+        if (shard_cluster != nullptr) {
+            if (!shard_cluster->evaluate(programs, evaluated, metric, precision, totals)) {
+                cerr << "> a shard worker failed, the fit is stopped" << endl;
+                complete = false;
+            }
+        } else if (chunk_stream == nullptr) {
+            add_block_losses(programs, evaluated, dataset_view, label_view, weight_view, totals);
+        } else {
+            // one sequential pass over the file, the next chunk is read while the current one is evaluated
+            for (chunk_stream->rewind(); chunk_stream->next();) {
+                add_block_losses(programs, evaluated, chunk_stream->dataset(), chunk_stream->label(), DataView(),
+                                 totals);
+            }
+            if (chunk_stream->failed()) {
+                cerr << "> failed to read a chunk of the dataset, the fit is stopped" << endl;
+                complete = false;
+            }
+        }
+
+        // the sums of a partial pass would underestimate the losses
+        if (!complete) {
+            this->evaluation_failed = true;
+        }
+        for (int i = 0; i < programs.size(); i++) {
+            if (!evaluated[i]) {
+                programs[i].fitness = complete ? total_to_fitness(totals[i], programs[i]) : HUGE_VAL;
+            }
+        }
+    }
+
     void RegressionEngine::calculate_population_fitness_cpu() {
-        for (int i = 0; i < population_size; i++) {
-            calculate_fitness_cpu(&population[i], dataset, label, dataset.size(), this->metric);
+        // only the columns referenced by the population are read
+        update_used_columns();
+        if (columnar_file != nullptr) {
+            columnar_file->page_columns(used_columns);
+        }
+        if (chunk_stream != nullptr) {
+            chunk_stream->set_used_columns(used_columns);
+        }
+
+        // programs with few variables are evaluated on the distinct tuples of their variables
+        vector<char> evaluated(population_size, 0);
+        if (resolved.group_by_projection && rows_in_memory()) {
+            for (int i = 0; i < population_size; i++) {
+                double loss;
+                if (resolved.linear_scaling) {
+                    ScalingMoments moments;
+                    evaluated[i] = projection_cache.calculate_moments(population[i], moments);
+                    loss = evaluated[i] ? linear_scaling_loss(moments, population[i]) : 0;
+                } else {
+                    evaluated[i] = projection_cache.calculate_loss(population[i], loss);
+                }
+                if (evaluated[i]) {
+                    population[i].fitness = loss_to_fitness(loss + loss_offset, weight_sum, this->metric);
+                }
+            }
+        }
+
+        if (resolved.linear_scaling) {
+            evaluate_population_cpu<MomentSum>(population, evaluated);
+        } else {
+            evaluate_population_cpu<PairwiseSum>(population, evaluated);
+        }
+    }
+
+    void RegressionEngine::optimize_best_constants() {
+        if (resolved.const_optimize_top_k <= 0) {
+            return;
+        }
+
+        // the best programs with constants
+        int k = min(resolved.const_optimize_top_k, population_size);
+        vector<int> order = best_indices(population, k);
+
+        // the window of rows of this generation
+        row_t rows = dataset_view.rows;
+        row_t batch = const_optimize_batch > 0 ? min(const_optimize_batch, rows) : rows;
+        row_t begin = (row_t) current_gen * batch % rows;
+        row_t end = min(begin + batch, rows);
+
+        long long cost = 0;
+        vector<Program> tuned;
+        vector<int> tuned_index;
+        for (int j = 0; j < k; j++) {
+            Program &program = population[order[j]];
+            if (count_constants(program) == 0) {
+                continue;
+            }
+            // the re-evaluation of the tuned programs on the whole dataset, this one included, is charged first
+            long long remaining = 0;
+            if (const_optimize_budget > 0) {
+                remaining = const_optimize_budget - cost - (long long) (tuned.size() + 1) * rows;
+                if (remaining <= 0) {
+                    break;
+                }
+            }
+            Program candidate = program;
+            long long spent;
+            if (const_optimizer == ConstOptimizer::hill_climbing) {
+                set_rand_stream(seed, current_gen, population_size + j);
+                spent = perturb_constants(candidate, dataset_view, label_view, weight_view, begin, end, metric,
+                                          const_optimize_iterations, remaining);
+            } else {
+                spent = optimize_constants(candidate, dataset_view, label_view, weight_view, begin, end, metric,
+                                           const_optimize_iterations, remaining);
+            }
+            if (spent == 0) {
+                // not even one pass fits into the budget, a program with fewer constants may still fit
+                continue;
+            }
+            cost += spent;
+            tuned.push_back(candidate);
+            tuned_index.push_back(order[j]);
+        }
+
+        // the tuned programs are evaluated on the whole dataset
+        if (!tuned.empty()) {
+            if (resolved.use_gpu) {
+                int blockNum = (int) min((rows - 1) / THREAD_PER_BLOCK + 1, (row_t) MAX_GRID_BLOCKS);
+                calculatePopulationFitness(this->device_dataset, blockNum, tuned, this->metric,
+                                           resolved.linear_scaling);
+            } else if (resolved.linear_scaling) {
+                evaluate_population_cpu<MomentSum>(tuned, vector<char>(tuned.size(), 0));
+            } else {
+                evaluate_population_cpu<PairwiseSum>(tuned, vector<char>(tuned.size(), 0));
+            }
+            cost += (long long) tuned.size() * rows;
+        }
+        for (int j = 0; j < tuned.size(); j++) {
+            if (tuned[j].fitness < population[tuned_index[j]].fitness) {
+                population[tuned_index[j]] = tuned[j];
+            }
         }
+        this->const_optimize_cost_in_each_gen.push_back(cost);
     }
 
     void RegressionEngine::calculate_population_fitness_gpu() {
-        int blockNum = (dataset.size() - 1) / THREAD_PER_BLOCK + 1;
-        calculatePopulationFitness(this->device_dataset, blockNum, population, this->metric);
+        int blockNum = (int) min((dataset_view.rows - 1) / THREAD_PER_BLOCK + 1, (row_t) MAX_GRID_BLOCKS);
+        calculatePopulationFitness(this->device_dataset, blockNum, population, this->metric,
+                                   resolved.linear_scaling);
     }
 
     void RegressionEngine::do_gpu_init() {
-        copyDatasetAndLabel(&device_dataset, dataset, label);
+        copyDatasetAndLabel(&device_dataset, dataset_view, label_view, weight_view, weight_sum, loss_offset);
     }
 
     RegressionEngine::~RegressionEngine() {
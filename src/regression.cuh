@@ -3,14 +3,29 @@
 
 #include <sstream>
 #include <utility>
+#include <climits>
 #include "program.cuh"
 #include "fit_eval.cuh"
+#include "stream.cuh"
+#include "columnar.cuh"
+#include "projection.cuh"
+#include "optimize.cuh"
+#include "selection.cuh"
+#include "island.cuh"
+#include "shard.cuh"
+
+/**
+ * number of rows on which the fitness in a reduced-precision storage_type is compared with float32,
+ * a multiple of ROW_BLOCK_SIZE
+ */
+#define STORAGE_SAMPLE_ROWS (1 << 16)
 
 namespace cusr {
 
     using namespace std;
     using namespace program;
     using namespace fit;
+    using namespace data;
 
     /**
      * Symbolic regression engine.
@@ -34,6 +49,13 @@ namespace cusr {
 
         RegressionEngine() = default;
 
+        /**
+         * @param precision scalar type of the CPU evaluation, dtype_t::float32 or dtype_t::float64.
+         * float runs keep the SIMD width of float, double runs convert the dataset to double block by block
+         * (float64 views are read directly), the GPU, projections and collapsed rows are float only
+         */
+        explicit RegressionEngine(dtype_t precision);
+
         ~RegressionEngine();
 
         /**
@@ -100,7 +122,8 @@ namespace cusr {
 
         /**
          * depth restriction for a program, less than 20 is recommend
-         * since GPU restrict the max length of the prefix is 2048, too large for this parameter may lead to the overflow
+         * crossover and subtree mutation only select donor subtrees that keep the offspring under this depth,
+         * on the GPU path, the depth is also limited by DEPTH and the length is limited by MAX_PREFIX_LEN
          */
         int max_program_depth = 10;
 
@@ -110,6 +133,22 @@ namespace cusr {
          */
         float parsimony_coefficient = 0;
 
+        /**
+         * selection method
+         *
+         * selection_t::tournament
+         * selection_t::epsilon_lexicase  the parents of each generation are selected by epsilon-lexicase
+         *                                on lexicase_cases rows sampled for the generation (in-memory datasets
+         *                                and columnar files), weighted rows in proportion to their weights.
+         *                                the selections run on worker threads
+         */
+        Selection selection = Selection::tournament;
+
+        /**
+         * number of rows sampled as the cases of epsilon-lexicase selection in each generation
+         */
+        int lexicase_cases = 64;
+
         /**
          * probability to perform various mutations
          */
@@ -129,6 +168,125 @@ namespace cusr {
          */
         bool use_gpu = false;
 
+        /**
+         * deterministic mode
+         * random streams are derived from (seed, generation, index of the individual),
+         * and the loss of each program is reduced by a fixed-shape tree over fixed row blocks,
+         * so that the same seed always reproduces the same best_program and fitness values
+         */
+        bool deterministic = false;
+
+        /**
+         * seed of the random streams, valid in deterministic mode
+         */
+        unsigned long long seed = 0;
+
+        /**
+         * evaluate programs that reference at most PROJECTION_MAX_VARIABLES variables
+         * on the distinct tuples of those variables, weighted by their row counts (CPU, in-memory datasets).
+         * the loss is the same up to rounding, it pays off when the inputs are coarse-grained
+         */
+        bool group_by_projection = false;
+
+        /**
+         * collapse duplicate rows into unique weighted rows before the evolution
+         * (in-memory datasets of at most INT_MAX rows, not columnar files).
+         * MSE / RMSE: rows with the same x are collapsed, their label is the weighted mean of the labels,
+         * and the sum of squared deviations from the means is added to each loss.
+         * MAE: rows with the same (x, y) are collapsed
+         */
+        bool collapse_duplicates = false;
+
+        /**
+         * element type of the in-memory dataset and label during the evolution (CPU)
+         * dtype_t::float16, dtype_t::bfloat16 or scaled dtype_t::int16 halve the bytes read by the evaluator,
+         * the values are converted to floats block by block and the losses are accumulated in float / double.
+         * fit(vector) packs the rows one column at a time, the other fits release the float32 copy of the engine
+         * after packing. a sample of the rows is kept in both types,
+         * and at the end the deviation of the fitness of the best program on the sample is reported
+         */
+        dtype_t storage_type = dtype_t::float32;
+
+        /**
+         * fitness after the optimal linear scaling slope * f(x) + intercept of the output (squared error metrics).
+         * the sums of f, f^2 and f * y are accumulated in the evaluation pass, and the scaled loss follows
+         * in closed form, so the rows are still read once. slope and intercept are stored in the programs
+         */
+        bool linear_scaling = false;
+
+        /**
+         * number of the best programs of each generation whose constants are tuned by Levenberg-Marquardt,
+         * 0 disables the constant optimization (in-memory datasets and columnar files).
+         * the gradients come from a forward-mode pass over a window of const_optimize_batch rows,
+         * which moves through the dataset from generation to generation.
+         * a tuned program replaces the original one if its fitness on the whole dataset is better
+         */
+        int const_optimize_top_k = 0;
+
+        /**
+         * method of the constant optimization
+         *
+         * const_optimizer_t::levenberg_marquardt
+         * const_optimizer_t::hill_climbing  evaluates PERTURB_LANES perturbed constant vectors in one pass,
+         *                                   for non-smooth function sets (MAX, MIN, protected DIV)
+         */
+        ConstOptimizer const_optimizer = ConstOptimizer::levenberg_marquardt;
+
+        /**
+         * max number of Levenberg-Marquardt or hill climbing steps per program
+         */
+        int const_optimize_iterations = 5;
+
+        /**
+         * number of rows of the window, 0 refers to the whole dataset
+         */
+        row_t const_optimize_batch = 4096;
+
+        /**
+         * max number of row evaluations spent on the constant optimization per generation, 0 refers to no limit.
+         * a row of a pass with gradients counts as 1 + number of constants, a row of a hill climbing pass counts as
+         * PERTURB_LANES, and the evaluation of a tuned program on the whole dataset counts as the number of rows
+         */
+        long long const_optimize_budget = 0;
+
+        /**
+         * number of islands, each island evolves its own population of population_size programs on a separate thread
+         * with its own random stream (CPU, in-memory datasets and columnar files), 1 disables the island model.
+         * the islands share the dataset and do not wait for each other, every migration_interval generations,
+         * the migration_size best programs of an island are sent to its neighbours over lock-free queues,
+         * and replace the worst programs of the receiving island at the end of its current generation.
+         * the run stops when all islands reach the generations or any island reaches the stopping criteria.
+         * the arrival of migrants depends on the thread timing, so the runs are not reproducible in deterministic mode
+         */
+        int islands = 1;
+
+        /**
+         * number of generations between two migrations of an island
+         */
+        int migration_interval = 10;
+
+        /**
+         * number of programs sent by an island in each migration
+         */
+        int migration_size = 2;
+
+        /**
+         * neighbours of an island
+         *
+         * topology_t::ring           island i sends its migrants to island i + 1
+         * topology_t::random_island  each migrant is sent to a random other island
+         */
+        Topology migration_topology = Topology::ring;
+
+        /**
+         * address of a MigrationCoordinator, "unix:<path>" or "tcp:<host>:<port>", empty if not used.
+         * the engine evolves one island of a multi-process island model: its migration_size best programs are sent
+         * to the coordinator every migration_interval generations, the coordinator relays them to another island
+         * (its topology applies), and the programs relayed to this island replace its worst programs.
+         * the final best program is reported to the coordinator, which tracks the best program of all islands
+         */
+        string migration_address;
+
         /**
          * fit dataset and training
          *
@@ -137,6 +295,78 @@ namespace cusr {
          */
         void fit(vector<vector<float>> &dataset, vector<float> &label);
 
+        /**
+         * fit dataset with per-sample weights, the loss of each row is multiplied by its weight,
+         * and the fitness is the weighted mean of the losses
+         *
+         * @param dataset
+         * @param label
+         * @param weight
+         */
+        void fit(vector<vector<float>> &dataset, vector<float> &label, vector<float> &weight);
+
+        /**
+         * fit a double dataset, the values keep their precision if the engine is constructed with dtype_t::float64
+         *
+         * @param dataset
+         * @param label
+         */
+        void fit(vector<vector<double>> &dataset, vector<double> &label);
+
+        /**
+         * fit dataset and training without copying the dataset
+         * the buffers are owned by the caller and must be valid until fit returns
+         *
+         * // row-major float buffer with rows * cols elements
+         * reg.fit(make_row_major_view(x, rows, cols), make_vector_view(y, rows));
+         *
+         * @param dataset view of the dataset (float or double, row-major, column-major or strided)
+         * @param label view of the label
+         * @param weight view of the per-sample weights, an empty view if the samples are not weighted
+         */
+        void fit(const DataView &dataset, const DataView &label, const DataView &weight = DataView());
+
+        /**
+         * fit a dataset that is larger than memory
+         * each generation makes one sequential pass over the file,
+         * the population is evaluated on a chunk while the next chunk is read in the background.
+         * the fitness values are the same as fitting the whole dataset in memory, runs on the CPU only
+         *
+         * ChunkStream stream;
+         * if (stream.open_columnar("data.col")) {
+         *     reg.fit(stream);
+         * }
+         *
+         * @param stream
+         */
+        void fit(ChunkStream &stream);
+
+        /**
+         * fit a memory-mapped columnar file
+         * before each evaluation, the columns referenced by the population are paged in
+         * and the unreferenced columns are released, so wide datasets only keep the features in use in memory
+         *
+         * @param file
+         */
+        void fit(ColumnarFile &file);
+
+        /**
+         * fit a columnar dataset in shared memory, the rows are read in place from the read-only mapping
+         *
+         * @param segment created or attached segment
+         */
+        void fit(SharedColumnar &segment);
+
+        /**
+         * fit a dataset whose rows are sharded across worker processes (see ShardWorker)
+         * the population is evolved here, and each evaluation broadcasts the new programs to the workers
+         * and reduces their partial loss sums (or linear scaling moments). runs on the CPU,
+         * the communication-to-compute ratio is reported at the end
+         *
+         * @param cluster connected workers
+         */
+        void fit(ShardCluster &cluster);
+
         /**
          * predict
          * @param dataset
@@ -159,29 +389,135 @@ namespace cusr {
          */
         float regress_time_in_sec;
 
+        /**
+         * fitness of the best program on a sample of STORAGE_SAMPLE_ROWS rows (all rows of a smaller dataset)
+         * in the reduced-precision storage_type minus its fitness on the same rows in float32,
+         * 0 if storage_type is float32
+         */
+        float storage_deviation = 0;
+
+        /**
+         * row evaluations spent on the constant optimization in each generation (see const_optimize_budget)
+         */
+        vector<long long> const_optimize_cost_in_each_gen;
+
+        /**
+         * if or not the last fit was stopped because the rows of an evaluation could not be read
+         * (a failed read of a ChunkStream, or a lost worker of a ShardCluster).
+         * the programs of that evaluation get HUGE_VAL fitness, and best_program is the best program
+         * of the last generation evaluated in full (it has HUGE_VAL fitness if the initial population
+         * could not be evaluated)
+         */
+        bool evaluation_failed = false;
+
     private:
 
-        GPUDataset device_dataset;
+        /**
+         * options of the current fit after the fallbacks of do_fit_init, the public options are not changed
+         */
+        struct ResolvedOptions {
+            bool linear_scaling = false;
+            Selection selection = Selection::tournament;
+            int const_optimize_top_k = 0;
+            bool use_gpu = false;
+            int islands = 1;
+            bool group_by_projection = false;
+            bool collapse_duplicates = false;
+        } resolved;
+
+        dtype_t precision = dtype_t::float32;
+        GPUDataset device_dataset{};
         vector<Program> population;
-        vector<vector<float>> dataset;
-        vector<float> label;
+        vector<Program> next_population;
+        FunctionTable function_table;
+        DataView dataset_view;
+        DataView label_view;
+        DataView weight_view;
+        ColumnStore owned_dataset;
+        DoubleColumnStore owned_double_dataset;
+        ColumnStore collapsed_dataset;
+        PackedStore packed_dataset;
+        ColumnStore float_sample;     // rows of the dataset in float32 for the storage deviation
+        ColumnStore packed_sample;    // the same rows read from packed_dataset
+        vector<float> sample_weight;
+        vector<float> collapsed_weight;
+        double weight_sum = 0;
+        double loss_offset = 0;
+        ChunkStream *chunk_stream = nullptr;
+        ColumnarFile *columnar_file = nullptr;
+        ShardCluster *shard_cluster = nullptr;
+        vector<unsigned long long> used_columns;
+        ProjectionCache projection_cache;
+        ColumnStore case_store;
+        vector<double> case_weight_prefix;
+        CaseMatrix case_matrix;
+        vector<int> lexicase_parents;
 
         int variable_nums;
         int max_length_in_population = 0;
         int max_depth_in_population = 0;
+        int current_gen = 0;
+        int depth_limit = INT_MAX;
+        int length_limit = INT_MAX;
+        int migrants_received = 0;
+
+        void do_fit();
+
+        void run_islands();
+
+        void run_remote_island();
+
+        void init_island(const RegressionEngine &engine, unsigned long long island_seed);
+
+        void evolve_island(int island, Migration &migration);
+
+        void send_migrants(int island, Migration &migration);
+
+        void receive_migrants(int island, Migration &migration);
 
         void do_gpu_init();
 
         void do_fit_init();
 
+        bool rows_in_memory() const;
+
+        void collapse_duplicate_rows();
+
+        void pack_dataset();
+
+        void report_storage_deviation();
+
+        double sample_fitness(const ColumnStore &sample, const DataView &weight, double sample_weight_sum);
+
+        template<typename S>
+        void add_block_losses(vector<Program> &programs, const vector<char> &evaluated, const DataView &dataset,
+                              const DataView &label, const DataView &weight, vector<S> &totals);
+
+        template<typename S>
+        void evaluate_population_cpu(vector<Program> &programs, const vector<char> &evaluated);
+
+        void optimize_best_constants();
+
+        double total_to_fitness(const PairwiseSum &total, Program &program);
+
+        double total_to_fitness(const MomentSum &total, Program &program);
+
         void do_population_init();
 
-        Program do_mutation(Program &program);
+        int rand_init_depth();
+
+        void do_mutation(Program &program, Program &ret, int offspring);
+
+        void select_lexicase_parents();
+
+        int select_parent(int offspring, int which);
 
         void gen_next_generation();
 
         void update_population_attributes();
 
+        void update_used_columns();
+
         void calculate_population_fitness_cpu();
 
         void calculate_population_fitness_gpu();
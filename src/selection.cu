@@ -0,0 +1,187 @@
+#include "selection.cuh"
+#include <cassert>
+#include <thread>
+#include <unordered_set>
+
+/**
+ * min number of selections per worker thread
+ */
+#define SELECTIONS_PER_THREAD 64
+
+namespace cusr {
+    namespace program {
+
+        void weight_prefix_sums(const DataView &weight, vector<double> &weight_prefix) {
+            weight_prefix.resize(weight.rows);
+            vector<double> block(min(weight.rows, (row_t) ROW_BLOCK_SIZE));
+            double total = 0;
+            for (row_t begin = 0; begin < weight.rows; begin += ROW_BLOCK_SIZE) {
+                row_t end = min(begin + ROW_BLOCK_SIZE, weight.rows);
+                read_column(weight, 0, begin, end, block.data());
+                for (row_t r = begin; r < end; r++) {
+                    total += max(block[r - begin], 0.0);
+                    weight_prefix[r] = total;
+                }
+            }
+            if (!(total > 0) || !std::isfinite(total)) {
+                vector<double>().swap(weight_prefix);
+            }
+        }
+
+        void sample_cases(const DataView &dataset, const DataView &label, const vector<unsigned long long> &used,
+                          const vector<double> &weight_prefix, int cases, unsigned long long &state,
+                          ColumnStore &store) {
+            row_t rows = dataset.rows;
+            cases = (int) min((row_t) cases, rows);
+
+            vector<row_t> sample;
+            if (!weight_prefix.empty()) {
+                // the first row whose prefix sum exceeds a uniform draw in [0, total weight)
+                assert((row_t) weight_prefix.size() == rows);
+                double total = weight_prefix.back();
+                for (int i = 0; i < cases; i++) {
+                    double u = (double) (splitmix64(state) >> 11) * (1.0 / 9007199254740992.0) * total;
+                    row_t r = upper_bound(weight_prefix.begin(), weight_prefix.end(), u) - weight_prefix.begin();
+                    sample.push_back(min(r, rows - 1));
+                }
+            } else {
+                // distinct rows by Floyd's algorithm
+                unordered_set<row_t> chosen;
+                for (row_t j = rows - cases; j < rows; j++) {
+                    row_t r = (row_t) (splitmix64(state) % (unsigned long long) (j + 1));
+                    if (!chosen.insert(r).second) {
+                        chosen.insert(j);
+                        r = j;
+                    }
+                    sample.push_back(r);
+                }
+            }
+            // visited in ascending order
+            sort(sample.begin(), sample.end());
+
+            store.resize(cases, dataset.cols);
+            for (int col = 0; col <= dataset.cols; col++) {
+                float *dst = col < dataset.cols ? store.column(col) : store.label_column();
+                bool is_used = col == dataset.cols ||
+                               (col >> 6 < used.size() && (used[col >> 6] >> (col & 63) & 1ULL));
+                for (int i = 0; i < cases; i++) {
+                    if (!is_used) {
+                        dst[i] = 0;
+                    } else if (col < dataset.cols) {
+                        read_column(dataset, col, sample[i], sample[i] + 1, &dst[i]);
+                    } else {
+                        read_column(label, 0, sample[i], sample[i] + 1, &dst[i]);
+                    }
+                }
+            }
+        }
+
+        void calculate_case_errors(vector<Program> &population, const ColumnStore &store, CaseMatrix &matrix) {
+            int cases = store.rows;
+            int programs = population.size();
+            matrix.cases = cases;
+            matrix.programs = programs;
+            matrix.errors.resize((size_t) cases * programs);
+            matrix.epsilon.resize(cases);
+
+            DataView dataset = store.dataset();
+            DataView label = store.label();
+            BlockReader reader(dataset, label);
+            for (int begin = 0; begin < cases; begin += ROW_BLOCK_SIZE) {
+                reader.seek(begin, min(begin + ROW_BLOCK_SIZE, cases));
+                const float *real_value = reader.label();
+                for (int p = 0; p < programs; p++) {
+                    Program &program = population[p];
+                    const float *predict = eval_block_cpu(program, reader);
+                    for (int r = 0; r < reader.block_size(); r++) {
+                        double error = std::fabs(program.slope * predict[r] + program.intercept - real_value[r]);
+                        matrix.errors[(size_t) (begin + r) * programs + p] = std::isfinite(error) ? (float) error
+                                                                                                   : HUGE_VALF;
+                    }
+                }
+            }
+
+            // median absolute deviation of each case
+            vector<float> values(programs);
+            for (int c = 0; c < cases; c++) {
+                const float *errors = &matrix.errors[(size_t) c * programs];
+                values.assign(errors, errors + programs);
+                nth_element(values.begin(), values.begin() + programs / 2, values.end());
+                float median = values[programs / 2];
+                for (int p = 0; p < programs; p++) {
+                    values[p] = std::fabs(errors[p] - median);
+                }
+                nth_element(values.begin(), values.begin() + programs / 2, values.end());
+                matrix.epsilon[c] = std::isfinite(values[programs / 2]) ? values[programs / 2] : 0;
+            }
+        }
+
+        int epsilon_lexicase_selection(const CaseMatrix &matrix, unsigned long long state) {
+            static thread_local vector<int> candidates;
+            static thread_local vector<int> order;
+            int programs = matrix.programs;
+            candidates.resize(programs);
+            for (int p = 0; p < programs; p++) {
+                candidates[p] = p;
+            }
+            order.resize(matrix.cases);
+            for (int c = 0; c < matrix.cases; c++) {
+                order[c] = c;
+            }
+
+            int size = programs;
+            for (int i = 0; i < matrix.cases && size > 1; i++) {
+                // the next case of a random order (Fisher-Yates)
+                int j = i + (int) (splitmix64(state) % (unsigned long long) (matrix.cases - i));
+                swap(order[i], order[j]);
+                int c = order[i];
+                const float *errors = &matrix.errors[(size_t) c * programs];
+
+                float best = HUGE_VALF;
+                for (int k = 0; k < size; k++) {
+                    best = min(best, errors[candidates[k]]);
+                }
+                float threshold = best + matrix.epsilon[c];
+                int kept = 0;
+                for (int k = 0; k < size; k++) {
+                    if (errors[candidates[k]] <= threshold) {
+                        candidates[kept++] = candidates[k];
+                    }
+                }
+                size = kept;
+            }
+            return candidates[splitmix64(state) % (unsigned long long) size];
+        }
+
+        void epsilon_lexicase_selections(const CaseMatrix &matrix, int count, unsigned long long seed,
+                                         vector<int> &selected) {
+            selected.resize(count);
+            auto work = [&](int begin, int end) {
+                for (int s = begin; s < end; s++) {
+                    unsigned long long state = seed + (unsigned long long) s;
+                    state = splitmix64(state);
+                    selected[s] = epsilon_lexicase_selection(matrix, state);
+                }
+            };
+
+            int threads = (int) min((count + SELECTIONS_PER_THREAD - 1) / SELECTIONS_PER_THREAD,
+                                    max(1, (int) std::thread::hardware_concurrency()));
+            if (threads <= 1) {
+                work(0, count);
+                return;
+            }
+            vector<std::thread> workers;
+            int per_thread = (count + threads - 1) / threads;
+            for (int t = 0; t < threads; t++) {
+                int begin = t * per_thread;
+                int end = min(count, begin + per_thread);
+                if (begin < end) {
+                    workers.emplace_back(work, begin, end);
+                }
+            }
+            for (auto &worker: workers) {
+                worker.join();
+            }
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef LUMINOCUGP_SELECTION_CUH
+#define LUMINOCUGP_SELECTION_CUH
+
+#include "program.cuh"
+
+namespace cusr {
+    namespace program {
+
+        using namespace std;
+
+        typedef enum Selection {
+            tournament,
+            epsilon_lexicase
+        } selection_t;
+
+        /**
+         * errors of a population on a down-sampled set of rows (cases), stored case-major,
+         * error(case c, program p) = errors[c * programs + p]
+         * epsilon[c] is the median absolute deviation of the errors of case c over the population
+         */
+        struct CaseMatrix {
+            int cases = 0;
+            int programs = 0;
+            vector<float> errors;
+            vector<float> epsilon;
+        };
+
+        /**
+         * gather a random sample of rows of a dataset, uniform without replacement, or in proportion to
+         * the row weights with replacement, so a row of weight w counts as w rows of weight 1
+         *
+         * @param dataset
+         * @param label
+         * @param used bitset of the columns to gather, the other columns are filled with 0
+         * @param weight_prefix sums of the weights of the rows [0, r] for each row r, empty for a uniform sample
+         * @param cases number of sampled rows (at most the number of rows)
+         * @param state random state, advanced by the sampling
+         * @param store the sampled rows and their labels
+         */
+        void sample_cases(const DataView &dataset, const DataView &label, const vector<unsigned long long> &used,
+                          const vector<double> &weight_prefix, int cases, unsigned long long &state,
+                          ColumnStore &store);
+
+        /**
+         * sums of the weights of the rows [0, r] for each row r, as used by sample_cases.
+         * empty if the weights do not sum to a positive finite number
+         *
+         * @param weight
+         * @param weight_prefix
+         */
+        void weight_prefix_sums(const DataView &weight, vector<double> &weight_prefix);
+
+        /**
+         * absolute errors |slope * f + intercept - y| of a population on the sampled rows, and the epsilon of each case
+         * (non-finite errors are infinity)
+         *
+         * @param population
+         * @param store
+         * @param matrix
+         */
+        void calculate_case_errors(vector<Program> &population, const ColumnStore &store, CaseMatrix &matrix);
+
+        /**
+         * epsilon-lexicase selection
+         * the cases are visited in a random order, and each case keeps the candidates whose error is within
+         * epsilon of the best candidate on the case, until one candidate is left or the cases run out
+         *
+         * @param matrix
+         * @param state random state of the selection
+         * @return index of the selected program
+         */
+        int epsilon_lexicase_selection(const CaseMatrix &matrix, unsigned long long state);
+
+        /**
+         * run count independent selections on worker threads, selection s draws from the stream (seed, s),
+         * so the result does not depend on the number of threads
+         *
+         * @param matrix
+         * @param count
+         * @param seed
+         * @param selected
+         */
+        void epsilon_lexicase_selections(const CaseMatrix &matrix, int count, unsigned long long seed,
+                                         vector<int> &selected);
+    }
+}
+#endif //LUMINOCUGP_SELECTION_CUH
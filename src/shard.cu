@@ -0,0 +1,283 @@
+#include "shard.cuh"
+#include "socket.cuh"
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+namespace cusr {
+    namespace fit {
+
+        using namespace net;
+
+        /**
+         * message types between the master and the workers
+         */
+        typedef enum ShardMessage {
+            HELLO = 1,     // worker to master on connection: rows (8 bytes), cols (4 bytes), weight sum (8 bytes)
+            EVALUATE = 2,  // master to worker: metric, precision, scaling (1 byte each), count (4 bytes), programs
+            RESULT = 3     // worker to master: compute seconds (8 bytes), a partial sum per program
+        } shard_message_t;
+
+        template<typename T>
+        static void put(string &buffer, T value) {
+            buffer.append((const char *) &value, sizeof(T));
+        }
+
+        template<typename T>
+        static T get(const string &buffer, size_t &pos) {
+            T value;
+            memcpy(&value, buffer.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        static double seconds_since(chrono::steady_clock::time_point begin) {
+            return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        }
+
+        /**
+         * evaluate the programs of an EVALUATE message on the slice of a worker
+         *
+         * @param request
+         * @param dataset
+         * @param label
+         * @param weight
+         * @param reply RESULT payload
+         * @return false if the request is malformed
+         */
+        template<typename V>
+        static bool evaluate_slice(const string &request, const DataView &dataset, const DataView &label,
+                                   const DataView &weight, string &reply) {
+            auto begin = chrono::steady_clock::now();
+            size_t pos = 3;
+            auto metric = (metric_t) request[0];
+            bool is_double = request[1] != 0;
+            uint32_t count = get<uint32_t>(request, pos);
+            // each encoded program takes more than one byte, so a count beyond the payload is malformed
+            if (count > request.size() - pos) {
+                return false;
+            }
+            vector<Program> programs(count);
+            for (auto &program: programs) {
+                if (!decode_program(request, pos, program, dataset.cols)) {
+                    return false;
+                }
+            }
+
+            vector<BasicPairwiseSum<V>> totals(count);
+            vector<char> evaluated(count, 0);
+            if (is_double) {
+                add_block_losses<double>(programs, evaluated, dataset, label, weight, metric, totals);
+            } else {
+                add_block_losses<float>(programs, evaluated, dataset, label, weight, metric, totals);
+            }
+
+            reply.clear();
+            put(reply, seconds_since(begin));
+            for (auto &total: totals) {
+                put(reply, total.result());
+            }
+            return true;
+        }
+
+        ShardWorker::~ShardWorker() {
+            close();
+        }
+
+        bool ShardWorker::open(const string &address) {
+            close();
+            this->listener = listen_socket(address);
+            if (address.compare(0, 5, "unix:") == 0) {
+                this->unix_path = address.substr(5);
+            }
+            return listener >= 0;
+        }
+
+        void ShardWorker::close() {
+            if (listener >= 0) {
+                close_socket(listener);
+                if (!unix_path.empty()) {
+                    unlink(unix_path.c_str());
+                }
+            }
+            this->listener = -1;
+            this->unix_path.clear();
+        }
+
+        void ShardWorker::serve(const DataView &dataset, const DataView &label, const DataView &weight, int sessions) {
+            assert(listener >= 0 && dataset.rows == label.rows);
+            double weight_sum = dataset.rows;
+            if (weight.rows > 0) {
+                vector<double> block(min(weight.rows, (row_t) ROW_BLOCK_SIZE));
+                PairwiseSum total;
+                for (row_t begin = 0; begin < weight.rows; begin += ROW_BLOCK_SIZE) {
+                    row_t end = min(begin + ROW_BLOCK_SIZE, weight.rows);
+                    read_column(weight, 0, begin, end, block.data());
+                    double block_sum = 0;
+                    for (int i = 0; i < end - begin; i++) {
+                        block_sum += block[i];
+                    }
+                    total.add(block_sum);
+                }
+                weight_sum = total.result();
+            }
+
+            string hello;
+            put<uint64_t>(hello, dataset.rows);
+            put<uint32_t>(hello, dataset.cols);
+            put<double>(hello, weight_sum);
+
+            for (int session = 0; sessions < 0 || session < sessions; session++) {
+                int fd = accept_socket(listener);
+                if (fd < 0) {
+                    cerr << "> failed to accept a master" << endl;
+                    return;
+                }
+                uint8_t type;
+                string request, reply;
+                bool alive = send_message(fd, ShardMessage::HELLO, hello);
+                while (alive && receive_message(fd, type, request)) {
+                    bool valid = type == ShardMessage::EVALUATE && request.size() >= 7;
+                    if (valid && request[2]) {
+                        valid = evaluate_slice<ScalingMoments>(request, dataset, label, weight, reply);
+                    } else if (valid) {
+                        valid = evaluate_slice<double>(request, dataset, label, weight, reply);
+                    }
+                    if (!valid) {
+                        cerr << "> invalid request from the master" << endl;
+                        break;
+                    }
+                    alive = send_message(fd, ShardMessage::RESULT, reply);
+                }
+                close_socket(fd);
+            }
+        }
+
+        ShardCluster::~ShardCluster() {
+            close();
+        }
+
+        bool ShardCluster::connect(const vector<string> &addresses) {
+            close();
+            this->bytes_sent = 0;
+            this->bytes_received = 0;
+            this->round_seconds = 0;
+            this->compute_seconds = 0;
+            this->rounds = 0;
+            uint8_t type;
+            string hello;
+            for (auto &address: addresses) {
+                int fd = connect_socket(address);
+                if (fd < 0) {
+                    close();
+                    return false;
+                }
+                workers.push_back(fd);
+                if (!receive_message(fd, type, hello) || type != ShardMessage::HELLO || hello.size() != 20) {
+                    cerr << "> invalid shard worker: " << address << endl;
+                    close();
+                    return false;
+                }
+                size_t pos = 0;
+                auto rows = (row_t) get<uint64_t>(hello, pos);
+                auto cols = (int) get<uint32_t>(hello, pos);
+                if (workers.size() > 1 && cols != total_cols) {
+                    cerr << "> shard worker " << address << " has " << cols << " columns, " << total_cols
+                         << " expected" << endl;
+                    close();
+                    return false;
+                }
+                this->total_rows += rows;
+                this->total_cols = cols;
+                this->total_weight += get<double>(hello, pos);
+            }
+            return !workers.empty();
+        }
+
+        void ShardCluster::close() {
+            for (int fd: workers) {
+                close_socket(fd);
+            }
+            workers.clear();
+            this->total_rows = 0;
+            this->total_cols = 0;
+            this->total_weight = 0;
+        }
+
+        template<typename V>
+        bool ShardCluster::evaluate_sums(vector<Program> &programs, const vector<char> &evaluated, metric_t metric,
+                                         dtype_t precision, vector<BasicPairwiseSum<V>> &totals) {
+            auto begin = chrono::steady_clock::now();
+            vector<int> index;
+            string request;
+            put<uint8_t>(request, metric);
+            put<uint8_t>(request, precision == dtype_t::float64);
+            put<uint8_t>(request, is_same<V, ScalingMoments>::value);
+            put<uint32_t>(request, 0);
+            for (int i = 0; i < programs.size(); i++) {
+                if (!evaluated[i]) {
+                    index.push_back(i);
+                    encode_program(programs[i], request);
+                }
+            }
+            uint32_t count = index.size();
+            memcpy(&request[3], &count, sizeof(count));
+            if (workers.empty()) {
+                return false;
+            }
+            if (index.empty()) {
+                return true;
+            }
+
+            // the workers evaluate their slices at the same time
+            for (int fd: workers) {
+                if (!send_message(fd, ShardMessage::EVALUATE, request)) {
+                    // the rows of the lost slice cannot be evaluated any more, and the replies
+                    // of the other workers would be out of step with the next request
+                    close();
+                    return false;
+                }
+                this->bytes_sent += request.size();
+            }
+
+            // the partial sums are reduced in the order of the workers
+            double slowest = 0;
+            uint8_t type;
+            string reply;
+            for (int fd: workers) {
+                if (!receive_message(fd, type, reply) || type != ShardMessage::RESULT ||
+                    reply.size() != sizeof(double) + count * sizeof(V)) {
+                    close();
+                    return false;
+                }
+                this->bytes_received += reply.size();
+                size_t pos = 0;
+                slowest = max(slowest, get<double>(reply, pos));
+                for (int i: index) {
+                    totals[i].add(get<V>(reply, pos));
+                }
+            }
+
+            this->round_seconds += seconds_since(begin);
+            this->compute_seconds += slowest;
+            this->rounds++;
+            return true;
+        }
+
+        bool ShardCluster::evaluate(vector<Program> &programs, const vector<char> &evaluated, metric_t metric,
+                                    dtype_t precision, vector<PairwiseSum> &totals) {
+            return evaluate_sums(programs, evaluated, metric, precision, totals);
+        }
+
+        bool ShardCluster::evaluate(vector<Program> &programs, const vector<char> &evaluated, metric_t metric,
+                                    dtype_t precision, vector<MomentSum> &totals) {
+            return evaluate_sums(programs, evaluated, metric, precision, totals);
+        }
+
+        double ShardCluster::communication_ratio() const {
+            return compute_seconds > 0 ? (round_seconds - compute_seconds) / compute_seconds : 0;
+        }
+    }
+}
@@ -0,0 +1,148 @@
+#ifndef LUMINOCUGP_SHARD_CUH
+#define LUMINOCUGP_SHARD_CUH
+
+#include <string>
+#include <vector>
+#include "program.cuh"
+
+namespace cusr {
+    namespace fit {
+
+        using namespace std;
+        using namespace program;
+
+        /**
+         * a worker process of a row-sharded evaluation, which holds a slice of the rows of a dataset.
+         * for each generation, it receives the encoded programs from the master (see ShardCluster),
+         * and returns the partial loss sum (or the linear scaling moments) of each program over its rows
+         *
+         * ShardWorker worker;
+         * if (worker.open("tcp:0.0.0.0:7001")) {
+         *     worker.serve(slice.dataset(), slice.label());
+         * }
+         */
+        class ShardWorker {
+        public:
+            ShardWorker() = default;
+
+            ~ShardWorker();
+
+            ShardWorker(const ShardWorker &) = delete;
+
+            ShardWorker &operator=(const ShardWorker &) = delete;
+
+            /**
+             * @param address "unix:<path>" or "tcp:<host>:<port>"
+             * @return if or not the worker listens on the address
+             */
+            bool open(const string &address);
+
+            /**
+             * serve masters one after another, a session ends when its master disconnects
+             *
+             * @param dataset the slice of the rows held by this worker
+             * @param label
+             * @param weight per-row weights, an empty view if the rows are not weighted
+             * @param sessions number of masters to serve, -1 refers to no limit
+             */
+            void serve(const DataView &dataset, const DataView &label, const DataView &weight = DataView(),
+                       int sessions = 1);
+
+            void close();
+
+        private:
+            int listener = -1;
+            string unix_path;
+        };
+
+        /**
+         * the master side of a row-sharded evaluation, the rows of the dataset are the slices of the workers
+         * in the order of their addresses. the programs of each evaluation are broadcast to all workers
+         * in the encoding of encode_program, the workers evaluate their slices in parallel,
+         * and their partial sums are reduced in the order of the workers, so the fitness does not depend on timing
+         *
+         * ShardCluster cluster;
+         * if (cluster.connect({"tcp:host1:7001", "tcp:host2:7001"})) {
+         *     reg.fit(cluster);
+         * }
+         */
+        class ShardCluster {
+        public:
+            ShardCluster() = default;
+
+            ~ShardCluster();
+
+            ShardCluster(const ShardCluster &) = delete;
+
+            ShardCluster &operator=(const ShardCluster &) = delete;
+
+            /**
+             * @param addresses
+             * @return false if a worker is unreachable or the slices have different numbers of columns
+             */
+            bool connect(const vector<string> &addresses);
+
+            void close();
+
+            row_t rows() const { return total_rows; }
+
+            int cols() const { return total_cols; }
+
+            /**
+             * sum of the weights of all rows, the number of rows if the rows are not weighted
+             */
+            double weight_sum() const { return total_weight; }
+
+            /**
+             * add the loss sum over the rows of all workers to totals[i] for the programs not evaluated yet
+             *
+             * @param programs
+             * @param evaluated
+             * @param metric
+             * @param precision scalar type of the evaluation on the workers, float32 or float64
+             * @param totals
+             * @return false if a worker fails or no worker is connected, the totals are incomplete.
+             * the cluster is closed after a failure, and the following evaluations fail as well
+             */
+            bool evaluate(vector<Program> &programs, const vector<char> &evaluated, metric_t metric,
+                          dtype_t precision, vector<PairwiseSum> &totals);
+
+            /**
+             * add the linear scaling moments over the rows of all workers to totals[i]
+             * for the programs not evaluated yet
+             *
+             * @param programs
+             * @param evaluated
+             * @param metric
+             * @param precision
+             * @param totals
+             * @return false if a worker fails or no worker is connected, the totals are incomplete
+             */
+            bool evaluate(vector<Program> &programs, const vector<char> &evaluated, metric_t metric,
+                          dtype_t precision, vector<MomentSum> &totals);
+
+            /**
+             * wall time of the evaluations minus the time the slowest worker of each evaluation spent on computing,
+             * divided by the latter
+             */
+            double communication_ratio() const;
+
+            long long bytes_sent = 0;
+            long long bytes_received = 0;
+            double round_seconds = 0;
+            double compute_seconds = 0;
+            int rounds = 0;
+
+        private:
+            vector<int> workers;
+            row_t total_rows = 0;
+            int total_cols = 0;
+            double total_weight = 0;
+
+            template<typename V>
+            bool evaluate_sums(vector<Program> &programs, const vector<char> &evaluated, metric_t metric,
+                               dtype_t precision, vector<BasicPairwiseSum<V>> &totals);
+        };
+    }
+}
+#endif //LUMINOCUGP_SHARD_CUH
@@ -0,0 +1,226 @@
+#include "socket.cuh"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace cusr {
+    namespace net {
+
+        /**
+         * resolve an address and create a socket for it
+         *
+         * @param address
+         * @param storage
+         * @param length
+         * @return file descriptor of the socket, -1 if the address is invalid
+         */
+        static int open_socket(const string &address, sockaddr_storage &storage, socklen_t &length) {
+            memset(&storage, 0, sizeof(storage));
+            if (address.compare(0, 5, "unix:") == 0) {
+                string path = address.substr(5);
+                auto *un = (sockaddr_un *) &storage;
+                if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+                    cerr << "> invalid socket path: " << address << endl;
+                    return -1;
+                }
+                un->sun_family = AF_UNIX;
+                memcpy(un->sun_path, path.c_str(), path.size() + 1);
+                length = sizeof(sockaddr_un);
+                return socket(AF_UNIX, SOCK_STREAM, 0);
+            }
+
+            size_t colon = address.rfind(':');
+            if (address.compare(0, 4, "tcp:") != 0 || colon <= 4) {
+                cerr << "> invalid socket address: " << address << endl;
+                return -1;
+            }
+            string host = address.substr(4, colon - 4);
+            string port = address.substr(colon + 1);
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo *info = nullptr;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &info) != 0 || info == nullptr) {
+                cerr << "> cannot resolve " << address << endl;
+                return -1;
+            }
+            memcpy(&storage, info->ai_addr, info->ai_addrlen);
+            length = info->ai_addrlen;
+            int fd = socket(info->ai_family, SOCK_STREAM, 0);
+            freeaddrinfo(info);
+            return fd;
+        }
+
+        /**
+         * messages are small and latency-bound
+         *
+         * @param fd
+         */
+        static void set_no_delay(int fd) {
+            sockaddr_storage storage{};
+            socklen_t length = sizeof(storage);
+            if (getsockname(fd, (sockaddr *) &storage, &length) == 0 && storage.ss_family != AF_UNIX) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+        }
+
+        int listen_socket(const string &address) {
+            sockaddr_storage storage;
+            socklen_t length;
+            int fd = open_socket(address, storage, length);
+            if (fd < 0) {
+                return -1;
+            }
+            if (storage.ss_family == AF_UNIX) {
+                unlink(((sockaddr_un *) &storage)->sun_path);
+            } else {
+                int one = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            }
+            if (bind(fd, (sockaddr *) &storage, length) != 0 || listen(fd, SOMAXCONN) != 0) {
+                cerr << "> cannot listen on " << address << ": " << strerror(errno) << endl;
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        int connect_socket(const string &address) {
+            sockaddr_storage storage;
+            socklen_t length;
+            int fd = open_socket(address, storage, length);
+            if (fd < 0) {
+                return -1;
+            }
+            if (connect(fd, (sockaddr *) &storage, length) != 0) {
+                cerr << "> cannot connect to " << address << ": " << strerror(errno) << endl;
+                close(fd);
+                return -1;
+            }
+            set_no_delay(fd);
+            return fd;
+        }
+
+        int accept_socket(int listener) {
+            int fd;
+            do {
+                fd = accept(listener, nullptr, nullptr);
+            } while (fd < 0 && errno == EINTR);
+            if (fd >= 0) {
+                set_no_delay(fd);
+            }
+            return fd;
+        }
+
+        void close_socket(int fd) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        void set_send_timeout(int fd, int timeout_ms) {
+            timeval timeout{};
+            timeout.tv_sec = timeout_ms / 1000;
+            timeout.tv_usec = timeout_ms % 1000 * 1000;
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+
+        static bool write_all(int fd, const char *data, size_t bytes) {
+            while (bytes > 0) {
+                // a closed peer is reported as an error instead of SIGPIPE
+                ssize_t written = send(fd, data, bytes, MSG_NOSIGNAL);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    return false;
+                }
+                data += written;
+                bytes -= written;
+            }
+            return true;
+        }
+
+        static bool read_all(int fd, char *data, size_t bytes) {
+            while (bytes > 0) {
+                ssize_t count = recv(fd, data, bytes, 0);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    return false;
+                }
+                data += count;
+                bytes -= count;
+            }
+            return true;
+        }
+
+        bool send_message(int fd, uint8_t type, const string &payload) {
+            if (payload.size() > MAX_MESSAGE_SIZE) {
+                return false;
+            }
+            char header[5];
+            uint32_t length = payload.size();
+            header[0] = (char) type;
+            memcpy(header + 1, &length, sizeof(length));
+
+            // one write for small messages
+            if (payload.size() <= 4096) {
+                string message(header, sizeof(header));
+                message += payload;
+                return write_all(fd, message.data(), message.size());
+            }
+            return write_all(fd, header, sizeof(header)) && write_all(fd, payload.data(), payload.size());
+        }
+
+        bool receive_message(int fd, uint8_t &type, string &payload) {
+            char header[5];
+            uint32_t length;
+            if (!read_all(fd, header, sizeof(header))) {
+                return false;
+            }
+            type = header[0];
+            memcpy(&length, header + 1, sizeof(length));
+            if (length > MAX_MESSAGE_SIZE) {
+                return false;
+            }
+            payload.resize(length);
+            return read_all(fd, &payload[0], length);
+        }
+
+        bool wait_readable(int fd, int timeout_ms) {
+            pollfd item{fd, POLLIN, 0};
+            int ready;
+            do {
+                ready = poll(&item, 1, timeout_ms);
+            } while (ready < 0 && errno == EINTR);
+            return ready > 0;
+        }
+
+        bool wait_readable(const vector<int> &fds, int timeout_ms, vector<char> &readable) {
+            vector<pollfd> items(fds.size());
+            for (int i = 0; i < fds.size(); i++) {
+                items[i] = {fds[i], POLLIN, 0};
+            }
+            int ready;
+            do {
+                ready = poll(items.data(), items.size(), timeout_ms);
+            } while (ready < 0 && errno == EINTR);
+            readable.assign(fds.size(), 0);
+            for (int i = 0; i < fds.size() && ready > 0; i++) {
+                readable[i] = items[i].revents != 0;
+            }
+            return ready > 0;
+        }
+    }
+}
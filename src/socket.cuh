@@ -0,0 +1,91 @@
+#ifndef LUMINOCUGP_SOCKET_CUH
+#define LUMINOCUGP_SOCKET_CUH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * max payload bytes of a message
+ */
+#define MAX_MESSAGE_SIZE (1 << 30)
+
+namespace cusr {
+    namespace net {
+
+        using namespace std;
+
+        /**
+         * framed messages over stream sockets between processes of the same host (or hosts of the same byte order).
+         * a message is a type byte, the payload length (4 bytes) and the payload.
+         * the addresses are "unix:<path>" for Unix domain sockets and "tcp:<host>:<port>" for TCP
+         */
+
+        /**
+         * listen on an address, a stale Unix domain socket file is replaced
+         *
+         * @param address
+         * @return file descriptor of the listening socket, -1 if it fails
+         */
+        int listen_socket(const string &address);
+
+        /**
+         * @param address
+         * @return file descriptor of the connection, -1 if it fails
+         */
+        int connect_socket(const string &address);
+
+        /**
+         * @param listener
+         * @return file descriptor of the accepted connection, -1 if it fails
+         */
+        int accept_socket(int listener);
+
+        void close_socket(int fd);
+
+        /**
+         * a send which cannot make progress for timeout_ms fails instead of blocking,
+         * so a peer which stops reading is reported like a broken connection
+         *
+         * @param fd
+         * @param timeout_ms
+         */
+        void set_send_timeout(int fd, int timeout_ms);
+
+        /**
+         * @param fd
+         * @param type
+         * @param payload
+         * @return false if the connection is closed or broken
+         */
+        bool send_message(int fd, uint8_t type, const string &payload);
+
+        /**
+         * wait for a whole message
+         *
+         * @param fd
+         * @param type
+         * @param payload
+         * @return false if the connection is closed or broken, or the message is too long
+         */
+        bool receive_message(int fd, uint8_t &type, string &payload);
+
+        /**
+         * @param fd
+         * @param timeout_ms 0 returns at once, -1 waits without limit
+         * @return if or not the socket has data (or an end of stream) to read
+         */
+        bool wait_readable(int fd, int timeout_ms);
+
+        /**
+         * wait until any of the sockets has data (or an end of stream) to read
+         *
+         * @param fds
+         * @param timeout_ms -1 waits without limit
+         * @param readable readable[i] is set if fds[i] is readable
+         * @return if or not any socket is readable
+         */
+        bool wait_readable(const vector<int> &fds, int timeout_ms, vector<char> &readable);
+    }
+}
+#endif //LUMINOCUGP_SOCKET_CUH
@@ -0,0 +1,212 @@
+#include "stream.cuh"
+#include "columnar.cuh"
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+namespace cusr {
+    namespace data {
+
+        using namespace std;
+
+        static bool seek_file(FILE *file, long long offset) {
+#ifdef _WIN32
+            return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+            return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+        }
+
+        static long long file_size(FILE *file) {
+#ifdef _WIN32
+            _fseeki64(file, 0, SEEK_END);
+            return _ftelli64(file);
+#else
+            fseeko(file, 0, SEEK_END);
+            return ftello(file);
+#endif
+        }
+
+        ChunkStream::~ChunkStream() {
+            close();
+        }
+
+        void ChunkStream::set_chunk_rows(int rows) {
+            // chunks are made of whole row blocks, so the blocks are the same as in memory
+            rows = max(rows, 1);
+            chunk_rows = (rows + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE * ROW_BLOCK_SIZE;
+            chunk_num = (int) ((total_rows + chunk_rows - 1) / chunk_rows);
+        }
+
+        bool ChunkStream::open_columnar(const string &path, int chunk_rows) {
+            close();
+            file = fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                cerr << "ChunkStream: cannot open " << path << endl;
+                return false;
+            }
+
+            // only the header is read, the column blocks are read chunk by chunk
+            ColumnarHeader header{};
+            long long size = file_size(file);
+            if (!seek_file(file, 0) || fread(&header, sizeof(header), 1, file) != 1 ||
+                !check_columnar_header(&header, size)) {
+                cerr << "ChunkStream: invalid columnar file " << path << endl;
+                close();
+                return false;
+            }
+
+            this->raw = false;
+            this->dtype = (dtype_t) header.dtype;
+            this->total_rows = header.rows;
+            this->total_cols = header.cols;
+            this->data_offset = header.data_offset;
+            this->column_stride = header.column_stride;
+            set_chunk_rows(chunk_rows);
+            return true;
+        }
+
+        bool ChunkStream::open_raw(const string &path, int cols, dtype_t dtype, int chunk_rows) {
+            close();
+            file = fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                cerr << "ChunkStream: cannot open " << path << endl;
+                return false;
+            }
+
+            if (dtype != dtype_t::float32 && dtype != dtype_t::float64) {
+                cerr << "ChunkStream: only float32 and float64 records are supported" << endl;
+                close();
+                return false;
+            }
+
+            long long record_size = (long long) (cols + 1) * (dtype == dtype_t::float64 ? 8 : 4);
+            long long size = file_size(file);
+            if (cols <= 0 || size % record_size != 0) {
+                cerr << "ChunkStream: the size of " << path << " is not a multiple of the record size" << endl;
+                close();
+                return false;
+            }
+
+            this->raw = true;
+            this->dtype = dtype;
+            this->total_rows = size / record_size;
+            this->total_cols = cols;
+            this->data_offset = 0;
+            this->column_stride = 0;
+            set_chunk_rows(chunk_rows);
+            return true;
+        }
+
+        void ChunkStream::close() {
+            wait();
+            if (file != nullptr) {
+                fclose(file);
+                file = nullptr;
+            }
+            slots[0].clear();
+            slots[1].clear();
+            vector<char>().swap(staging);
+            total_rows = total_cols = chunk_num = 0;
+            current = -1;
+            filter_columns = false;
+            used_columns.clear();
+        }
+
+        void ChunkStream::set_used_columns(const vector<unsigned long long> &used) {
+            // the prefetcher reads the bitset
+            wait();
+            filter_columns = true;
+            used_columns = used;
+        }
+
+        void ChunkStream::rewind() {
+            wait();
+            current = -1;
+            read_failed = false;
+            prefetch(0);
+        }
+
+        bool ChunkStream::next() {
+            wait();
+            current++;
+            if (current >= chunk_num || !slot_ok[current % 2]) {
+                read_failed |= current < chunk_num;
+                current = chunk_num;
+                return false;
+            }
+            // the slot of the previous chunk is free now
+            prefetch(current + 1);
+            return true;
+        }
+
+        void ChunkStream::prefetch(int chunk) {
+            if (chunk >= chunk_num) {
+                return;
+            }
+            int slot = chunk % 2;
+            prefetcher = std::thread([this, chunk, slot]() {
+                slot_ok[slot] = read_chunk(chunk, slots[slot]);
+            });
+        }
+
+        void ChunkStream::wait() {
+            if (prefetcher.joinable()) {
+                prefetcher.join();
+            }
+        }
+
+        bool ChunkStream::read_chunk(int chunk, ColumnStore &store) {
+            row_t begin = (row_t) chunk * chunk_rows;
+            int rows = (int) min((row_t) chunk_rows, total_rows - begin);
+            size_t elem_size = dtype == dtype_t::float64 ? sizeof(double) : sizeof(float);
+            // only the used columns take memory, so a chunk of a wide file with few used columns stays small
+            store.resize(rows, total_cols, filter_columns ? used_columns : vector<unsigned long long>());
+
+            if (!raw) {
+                // rows [begin, begin + rows) of each column block, the label is the last block
+                for (int col = 0; col <= total_cols; col++) {
+                    if (filter_columns && col < total_cols && !test_column(used_columns, col)) {
+                        continue;
+                    }
+                    float *dst = col < total_cols ? store.column(col) : store.label_column();
+                    long long offset = data_offset + column_stride * col + (long long) begin * elem_size;
+                    if (!seek_file(file, offset)) {
+                        return false;
+                    }
+                    if (dtype == dtype_t::float32) {
+                        if (fread(dst, sizeof(float), rows, file) != (size_t) rows) {
+                            return false;
+                        }
+                    } else {
+                        staging.resize(rows * elem_size);
+                        if (fread(staging.data(), elem_size, rows, file) != (size_t) rows) {
+                            return false;
+                        }
+                        read_column(make_vector_view((const double *) staging.data(), rows), 0, 0, rows, dst);
+                    }
+                }
+                return true;
+            }
+
+            // records are read at once and transposed into the columns
+            long record = total_cols + 1;
+            staging.resize(rows * record * elem_size);
+            if (!seek_file(file, (long long) begin * record * elem_size) ||
+                fread(staging.data(), elem_size * record, rows, file) != (size_t) rows) {
+                return false;
+            }
+            DataView records = dtype == dtype_t::float64
+                               ? make_row_major_view((const double *) staging.data(), rows, record)
+                               : make_row_major_view((const float *) staging.data(), rows, record);
+            for (int col = 0; col < total_cols; col++) {
+                if (filter_columns && !test_column(used_columns, col)) {
+                    continue;
+                }
+                read_column(records, col, 0, rows, store.column(col));
+            }
+            read_column(records, total_cols, 0, rows, store.label_column());
+            return true;
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef LUMINOCUGP_STREAM_CUH
+#define LUMINOCUGP_STREAM_CUH
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include "dataset.cuh"
+
+/**
+ * default number of rows of a chunk
+ */
+#define DEFAULT_CHUNK_ROWS (1 << 20)
+
+namespace cusr {
+    namespace data {
+
+        using namespace std;
+
+        /**
+         * streams a dataset that does not fit in memory from a file in row chunks
+         * two chunk buffers are used: while the caller evaluates one chunk, the next one is read by a background thread
+         *
+         * ChunkStream stream;
+         * stream.open_columnar("data.col");
+         * for (stream.rewind(); stream.next();) {
+         *     evaluate(stream.dataset(), stream.label());
+         * }
+         */
+        class ChunkStream {
+        public:
+
+            ChunkStream() = default;
+
+            ~ChunkStream();
+
+            ChunkStream(const ChunkStream &) = delete;
+
+            ChunkStream &operator=(const ChunkStream &) = delete;
+
+            /**
+             * stream a columnar file (see columnar.cuh)
+             *
+             * @param path
+             * @param chunk_rows rows of each chunk, rounded up to a multiple of ROW_BLOCK_SIZE
+             * @return if or not the file is opened
+             */
+            bool open_columnar(const string &path, int chunk_rows = DEFAULT_CHUNK_ROWS);
+
+            /**
+             * stream a raw binary file of row-major records,
+             * each record is cols features followed by the label
+             *
+             * @param path
+             * @param cols number of features
+             * @param dtype element type in the file (float32 or float64)
+             * @param chunk_rows rows of each chunk, rounded up to a multiple of ROW_BLOCK_SIZE
+             * @return if or not the file is opened
+             */
+            bool open_raw(const string &path, int cols, dtype_t dtype = dtype_t::float32,
+                          int chunk_rows = DEFAULT_CHUNK_ROWS);
+
+            void close();
+
+            /**
+             * only read the feature columns in the bitset in the following passes, the other columns are undefined
+             * @param used
+             */
+            void set_used_columns(const vector<unsigned long long> &used);
+
+            /**
+             * start a pass over the file, the first chunk is prefetched
+             */
+            void rewind();
+
+            /**
+             * move to the next chunk, the previous chunk is released and the one after is prefetched
+             * @return false at the end of the pass or if a read fails
+             */
+            bool next();
+
+            /**
+             * views of the current chunk
+             */
+            DataView dataset() const { return slots[current % 2].dataset(); }
+
+            DataView label() const { return slots[current % 2].label(); }
+
+            /**
+             * first row of the current chunk
+             */
+            row_t chunk_begin() const { return (row_t) current * chunk_rows; }
+
+            row_t rows() const { return total_rows; }
+
+            int cols() const { return total_cols; }
+
+            /**
+             * if or not a read failed during the last pass
+             */
+            bool failed() const { return read_failed; }
+
+        private:
+            FILE *file = nullptr;
+            bool raw = false;
+            dtype_t dtype = dtype_t::float32;
+            row_t total_rows = 0;
+            int total_cols = 0;
+            int chunk_rows = 0;
+            int chunk_num = 0;
+            long long data_offset = 0;
+            long long column_stride = 0;   // bytes between column blocks of a columnar file
+
+            bool filter_columns = false;
+            vector<unsigned long long> used_columns;
+
+            int current = -1;
+            bool read_failed = false;
+            bool slot_ok[2] = {false, false};
+            ColumnStore slots[2];
+            vector<char> staging;
+            std::thread prefetcher;
+
+            void set_chunk_rows(int rows);
+
+            void prefetch(int chunk);
+
+            void wait();
+
+            bool read_chunk(int chunk, ColumnStore &store);
+        };
+    }
+}
+#endif //LUMINOCUGP_STREAM_CUH
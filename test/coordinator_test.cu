@@ -0,0 +1,96 @@
+// multi-process island model: a coordinator and four island processes on localhost, one island is killed
+// while the others migrate through the coordinator, which must drop it and wait for the others to leave
+
+#include "../include/cusr.h"
+#include <csignal>
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace cusr;
+
+static const int ISLANDS = 4;
+static const int KILLED = 2;
+
+static pid_t fork_coordinator(const string &address, topology_t topology) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // a coordinator which hangs is killed by the alarm and fails the test
+        alarm(120);
+        MigrationCoordinator coordinator(topology, 3);
+        coordinator.send_timeout_ms = 1000;
+        if (!coordinator.open(address)) {
+            _exit(2);
+        }
+        coordinator.run(ISLANDS);
+        printf("coordinator: %d joined, %d died, %lld migrants relayed, best %g\n", coordinator.islands_joined,
+               coordinator.islands_died, coordinator.migrants_relayed, coordinator.best_program.fitness);
+        bool ok = coordinator.islands_joined == ISLANDS && coordinator.islands_died == 1 &&
+                  coordinator.migrants_relayed > 0 && isfinite(coordinator.best_program.fitness);
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+    return pid;
+}
+
+static pid_t fork_island(const string &address, int island, vector<vector<float>> &dataset,
+                         vector<float> &real_value) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stdout)) {
+            _exit(2);
+        }
+        RegressionEngine reg;
+        reg.population_size = 200;
+        reg.generations = island == KILLED ? 1000000 : 40;
+        reg.stopping_criteria = -1;
+        reg.deterministic = true;
+        reg.seed = 11 + island;
+        reg.metric = mean_square_error;
+        reg.migration_address = address;
+        reg.migration_interval = 2;
+        reg.fit(dataset, real_value);
+        _exit(0);
+    }
+    return pid;
+}
+
+int main() {
+    int rows = 5000;
+    vector<vector<float>> dataset(rows, vector<float>(3));
+    vector<float> real_value(rows);
+    for (int i = 0; i < rows; i++) {
+        float a = (i % 101) / 25.f, b = (i % 37) / 10.f, c = i % 7;
+        dataset[i] = {a, b, c};
+        real_value[i] = a * a * b - c * a + 0.5f * b;
+    }
+
+    string suffix = to_string(getpid());
+    vector<string> addresses = {"unix:/tmp/cusr_coordinator_test_" + suffix,
+                                "tcp:127.0.0.1:" + to_string(40000 + getpid() % 20000)};
+    int failures = 0;
+    for (int i = 0; i < 2; i++) {
+        topology_t topology = i == 0 ? Topology::ring : Topology::random_island;
+        pid_t coordinator = fork_coordinator(addresses[i], topology);
+        usleep(200000);
+
+        vector<pid_t> islands;
+        for (int island = 0; island < ISLANDS; island++) {
+            islands.push_back(fork_island(addresses[i], island, dataset, real_value));
+        }
+        sleep(2);
+        kill(islands[KILLED], SIGKILL);
+
+        int status;
+        for (pid_t pid: islands) {
+            waitpid(pid, nullptr, 0);
+        }
+        waitpid(coordinator, &status, 0);
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        printf("%s: %s, %s topology\n", ok ? "ok" : "FAIL", addresses[i].c_str(), i == 0 ? "ring" : "random");
+        failures += !ok;
+    }
+    return failures == 0 ? 0 : 1;
+}
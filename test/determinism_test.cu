@@ -0,0 +1,61 @@
+// deterministic mode: two fits with the same seed must find the same best program, bit for bit.
+// the second fit runs on another thread while the calling thread runs a fit outside deterministic mode,
+// which must not switch the random engine of the deterministic one
+
+#include "../include/cusr.h"
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+using namespace cusr;
+
+static Program deterministic_fit(vector<vector<float>> &dataset, vector<float> &real_value, Selection selection) {
+    RegressionEngine reg;
+    reg.population_size = 300;
+    reg.generations = 10;
+    reg.stopping_criteria = -1;
+    reg.deterministic = true;
+    reg.seed = 7;
+    reg.metric = mean_square_error;
+    reg.selection = selection;
+    reg.islands = 1;
+    reg.fit(dataset, real_value);
+    return reg.best_program;
+}
+
+static void random_fit(vector<vector<float>> &dataset, vector<float> &real_value) {
+    RegressionEngine reg;
+    reg.population_size = 300;
+    reg.generations = 10;
+    reg.stopping_criteria = -1;
+    reg.metric = mean_square_error;
+    reg.fit(dataset, real_value);
+}
+
+int main() {
+    int rows = 2000;
+    vector<vector<float>> dataset(rows, vector<float>(3));
+    vector<float> real_value(rows);
+    for (int i = 0; i < rows; i++) {
+        float a = (i % 101) / 25.f, b = (i % 37) / 10.f, c = i % 7;
+        dataset[i] = {a, b, c};
+        real_value[i] = a * a * b - c * a + 0.5f * b;
+    }
+
+    int failures = 0;
+    for (Selection selection: {Selection::tournament, Selection::epsilon_lexicase}) {
+        Program first = deterministic_fit(dataset, real_value, selection);
+        Program second;
+        std::thread rerun([&]() { second = deterministic_fit(dataset, real_value, selection); });
+        random_fit(dataset, real_value);
+        rerun.join();
+
+        bool ok = memcmp(&first.fitness, &second.fitness, sizeof(first.fitness)) == 0 &&
+                  prefix_to_infix(first.prefix) == prefix_to_infix(second.prefix);
+        printf("%s: %s selection, best fitness %.17g and %.17g\n", ok ? "ok" : "FAIL",
+               selection == Selection::tournament ? "tournament" : "epsilon-lexicase", first.fitness,
+               second.fitness);
+        failures += !ok;
+    }
+    return failures == 0 ? 0 : 1;
+}
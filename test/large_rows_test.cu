@@ -0,0 +1,100 @@
+// datasets of more than 2^31 rows, in sparse files which take no disk space:
+// a raw file read through a ChunkStream and a columnar file mapped into memory.
+// all values are zero, so the loss of the constant 0.5 is exact in any order of summation
+
+#include "../include/cusr.h"
+#include <cstdio>
+#include <unistd.h>
+
+using namespace cusr;
+
+static const row_t ROWS = 3000000000LL;
+
+static Program constant_program(float value) {
+    Program program;
+    program.prefix.emplace_back();
+    program.prefix[0].node_type = NodeType::CONST;
+    program.prefix[0].constant = value;
+    update_program_info(program);
+    return program;
+}
+
+static bool check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    return ok;
+}
+
+static int test_stream(const string &path) {
+    // records of (x0, y) in float32
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr || fclose(file) != 0 || truncate(path.c_str(), ROWS * 8) != 0) {
+        return !check(false, "create the sparse raw file");
+    }
+
+    int failures = 0;
+    ChunkStream stream;
+    if (!stream.open_raw(path, 1, dtype_t::float32, 1 << 22)) {
+        unlink(path.c_str());
+        return !check(false, "open the raw file");
+    }
+    failures += !check(stream.rows() == ROWS, "rows of the raw file");
+
+    vector<Program> programs(1, constant_program(0.5f));
+    vector<char> evaluated(1, 0);
+    vector<PairwiseSum> totals(1);
+    row_t streamed = 0, last_begin = 0;
+    for (stream.rewind(); stream.next();) {
+        streamed += stream.dataset().rows;
+        last_begin = stream.chunk_begin();
+        add_block_losses<float>(programs, evaluated, stream.dataset(), stream.label(), DataView(),
+                                mean_square_error, totals);
+    }
+    failures += !check(!stream.failed() && streamed == ROWS, "rows streamed");
+    failures += !check(last_begin > INT32_MAX, "chunks beyond 2^31 rows");
+    failures += !check(totals[0].result() == 0.25 * ROWS, "exact loss sum of the streamed rows");
+    unlink(path.c_str());
+    return failures;
+}
+
+static int test_columnar(const string &path) {
+    // a file of one row is written, and its header is rewritten for ROWS rows of zeros
+    vector<vector<float>> dataset(1, vector<float>(1, 0));
+    vector<float> label(1, 0);
+    ColumnarHeader header;
+    FILE *file = nullptr;
+    bool ok = write_columnar(path, dataset, label) && (file = fopen(path.c_str(), "r+b")) != nullptr &&
+              fread(&header, sizeof(header), 1, file) == 1;
+    if (ok) {
+        header.rows = ROWS;
+        header.column_stride = (ROWS * sizeof(float) + 63) / 64 * 64;
+        ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+    ok = file != nullptr && fclose(file) == 0 && ok &&
+         truncate(path.c_str(), (off_t) (header.data_offset + header.column_stride * 2)) == 0;
+    if (!ok) {
+        unlink(path.c_str());
+        return !check(false, "create the sparse columnar file");
+    }
+
+    int failures = 0;
+    ColumnarFile columnar;
+    if (!columnar.open(path)) {
+        unlink(path.c_str());
+        return !check(false, "open the columnar file");
+    }
+    failures += !check(columnar.rows() == ROWS && columnar.dataset().rows == ROWS, "rows of the columnar file");
+
+    Program program = constant_program(0.5f);
+    calculate_fitness_cpu(&program, columnar.dataset(), columnar.label(), mean_absolute_error);
+    failures += !check(program.fitness == 0.5f, "exact mean absolute error of the mapped rows");
+    columnar.close();
+    unlink(path.c_str());
+    return failures;
+}
+
+int main() {
+    string suffix = to_string(getpid());
+    int failures = test_stream("/tmp/cusr_large_rows_" + suffix + ".raw");
+    failures += test_columnar("/tmp/cusr_large_rows_" + suffix + ".col");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+// error bound of the loss accumulation on 1e8 rows: the mean squared error of a program
+// is compared against a reference summed in long double, a single float total would lose several digits
+
+#include "../include/cusr.h"
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cusr;
+
+int main(int argc, char **argv) {
+    row_t rows = argc > 1 ? atoll(argv[1]) : 100000000LL;
+    ColumnStore store;
+    store.resize(rows, 1);
+    for (row_t i = 0; i < rows; i++) {
+        store.column(0)[i] = (float) ((i * 2654435761u) % 1000003) / 1000003.f;
+        store.label_column()[i] = 0.5f;
+    }
+
+    long double reference = 0;
+    for (row_t i = 0; i < rows; i++) {
+        float error = store.column(0)[i] - 0.5f;
+        reference += (long double) (error * error);
+    }
+    double expected = (double) (reference / rows);
+
+    // the program x0, whose squared errors are summed in the evaluation as in the reference
+    Program program;
+    program.prefix.emplace_back();
+    program.prefix[0].node_type = NodeType::VAR;
+    program.prefix[0].variable = 0;
+    update_program_info(program);
+    vector<Program> programs(1, program);
+    vector<char> evaluated(1, 0);
+    vector<PairwiseSum> totals(1);
+    add_block_losses<float>(programs, evaluated, store.dataset(), store.label(), DataView(), mean_square_error,
+                            totals);
+    double actual = loss_to_fitness(totals[0].result(), rows, mean_square_error);
+
+    double error = fabs(actual - expected) / expected;
+    bool ok = error < 1e-12;
+    printf("%s: %lld rows, reference %.15g, evaluation %.15g, relative error %.3g\n", ok ? "ok" : "FAIL",
+           (long long) rows, expected, actual, error);
+    return ok ? 0 : 1;
+}
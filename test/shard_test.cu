@@ -0,0 +1,155 @@
+// sharded evaluation over local worker processes: the fit over unix and tcp workers is compared
+// against the fit of all rows in one process, malformed requests must be rejected, then a worker is killed
+// and the fit must stop
+
+#include "../include/cusr.h"
+#include "../src/socket.cuh"
+#include <csignal>
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace cusr;
+
+static const int ROWS = 60000;
+static const int WORKERS = 3;
+
+static vector<float> dataset(ROWS * 3), real_value(ROWS), weight(ROWS);
+
+static pid_t fork_worker(const string &address, int worker) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        row_t begin = (row_t) ROWS * worker / WORKERS;
+        row_t end = (row_t) ROWS * (worker + 1) / WORKERS;
+        ShardWorker shard;
+        if (!shard.open(address)) {
+            _exit(2);
+        }
+        shard.serve(make_row_major_view(&dataset[begin * 3], end - begin, 3),
+                    make_vector_view(&real_value[begin], end - begin),
+                    make_vector_view(&weight[begin], end - begin), -1);
+        _exit(0);
+    }
+    return pid;
+}
+
+static void set_options(RegressionEngine &reg, bool linear_scaling) {
+    reg.population_size = 200;
+    reg.generations = 8;
+    reg.deterministic = true;
+    reg.seed = 7;
+    reg.metric = mean_square_error;
+    reg.linear_scaling = linear_scaling;
+}
+
+/**
+ * send an EVALUATE request (message type 2) after the HELLO of a worker (type 1)
+ *
+ * @return if or not the worker replies, it drops the connection on a malformed request
+ */
+static bool answered(const string &address, uint32_t count, const Program &program) {
+    string request = {(char) mean_square_error, 0, 0};
+    request.append((const char *) &count, sizeof(count));
+    encode_program(program, request);
+    int fd = net::connect_socket(address);
+    uint8_t type;
+    string reply;
+    bool ok = fd >= 0 && net::receive_message(fd, type, reply) && type == 1 && net::send_message(fd, 2, request) &&
+              net::receive_message(fd, type, reply);
+    net::close_socket(fd);
+    return ok;
+}
+
+static bool connect_all(ShardCluster &cluster, const vector<string> &addresses) {
+    // the workers may not listen yet
+    for (int retry = 0; retry < 50; retry++) {
+        if (cluster.connect(addresses)) {
+            return true;
+        }
+        usleep(100000);
+    }
+    return false;
+}
+
+int main() {
+    for (int i = 0; i < ROWS; i++) {
+        float a = (i % 101) / 25.f, b = (i % 37) / 10.f, c = i % 7;
+        dataset[i * 3] = a;
+        dataset[i * 3 + 1] = b;
+        dataset[i * 3 + 2] = c;
+        real_value[i] = a * a * b - c * a + 0.5f * b;
+        weight[i] = 1 + i % 3;
+    }
+
+    string suffix = to_string(getpid());
+    vector<string> addresses = {"unix:/tmp/cusr_shard_test_0_" + suffix, "unix:/tmp/cusr_shard_test_1_" + suffix,
+                                "tcp:127.0.0.1:" + to_string(40000 + getpid() % 20000)};
+    vector<pid_t> workers;
+    for (int i = 0; i < WORKERS; i++) {
+        workers.push_back(fork_worker(addresses[i], i));
+    }
+
+    int failures = 0;
+    for (int linear_scaling = 0; linear_scaling < 2; linear_scaling++) {
+        RegressionEngine local;
+        set_options(local, linear_scaling);
+        local.fit(make_row_major_view(dataset.data(), ROWS, 3), make_vector_view(real_value.data(), ROWS),
+                  make_vector_view(weight.data(), ROWS));
+
+        RegressionEngine sharded;
+        set_options(sharded, linear_scaling);
+        ShardCluster cluster;
+        if (!connect_all(cluster, addresses)) {
+            printf("FAIL: cannot connect to the workers\n");
+            failures++;
+            break;
+        }
+        sharded.fit(cluster);
+
+        // the partial sums are reduced in another order, the fitness is the same up to rounding
+        double expected = local.best_program.fitness, actual = sharded.best_program.fitness;
+        bool same = fabs(expected - actual) <= 1e-6 * fabs(expected) + 1e-12;
+        printf("%s: linear scaling %d, in-process %.10g, sharded %.10g\n", same ? "ok" : "FAIL", linear_scaling,
+               expected, actual);
+        failures += !same || sharded.evaluation_failed;
+    }
+
+    // a count beyond the payload and a variable the workers do not have are rejected, the worker serves on
+    Program program;
+    program.prefix.emplace_back();
+    program.prefix[0].node_type = NodeType::VAR;
+    program.prefix[0].variable = 2;
+    update_program_info(program);
+    bool rejects = !answered(addresses[0], 0xffffffffu, program) && answered(addresses[0], 1, program);
+    program.prefix[0].variable = 3;
+    update_program_info(program);
+    rejects = rejects && !answered(addresses[0], 1, program);
+    printf("%s: malformed requests are rejected\n", rejects ? "ok" : "FAIL");
+    failures += !rejects;
+
+    // a lost worker stops the fit instead of evaluating the programs on the remaining rows
+    RegressionEngine reg;
+    set_options(reg, false);
+    ShardCluster cluster;
+    if (connect_all(cluster, addresses)) {
+        kill(workers[1], SIGKILL);
+        waitpid(workers[1], nullptr, 0);
+        reg.fit(cluster);
+        bool stopped = reg.evaluation_failed && reg.best_program.fitness == HUGE_VAL;
+        printf("%s: the fit stops when a worker dies\n", stopped ? "ok" : "FAIL");
+        failures += !stopped;
+    } else {
+        printf("FAIL: cannot connect to the workers\n");
+        failures++;
+    }
+
+    for (pid_t pid: workers) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    for (int i = 0; i < 2; i++) {
+        unlink(addresses[i].substr(5).c_str());
+    }
+    return failures == 0 ? 0 : 1;
+}